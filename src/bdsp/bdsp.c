@@ -7,6 +7,7 @@
 #include "automation-utils.h"
 #include "user-io.h"
 #include "persist.h"
+#include "bdsp.seq.h"
 
 /* Static functions */
 static void temporary_control(void);
@@ -169,11 +170,10 @@ void shiny_arceus_hunting(void)
 
 	for (;;) {
 		/* Stick up then neutral */
-		send_update(BT_NONE, DP_NEUTRAL, S_TOP, S_NEUTRAL);
-		send_update(BT_NONE, DP_NEUTRAL, S_TOP, S_NEUTRAL);
-		send_update(BT_NONE, DP_NEUTRAL, S_TOP, S_NEUTRAL);
-		send_update(BT_NONE, DP_NEUTRAL, S_TOP, S_NEUTRAL);
-		send_update(BT_NONE, DP_NEUTRAL, S_NEUTRAL, S_NEUTRAL);
+		SEND_STICKS_SEQUENCE(
+			{ { BT_NONE,	DP_NEUTRAL,	SEQ_HOLD,	4 },	{ S_XY_TOP },		{ S_XY_NEUTRAL } },
+			{ { BT_NONE,	DP_NEUTRAL,	SEQ_HOLD,	1 },	{ S_XY_NEUTRAL },	{ S_XY_NEUTRAL } },
+		);
 
 		/* Wait for the animation to finish */
 		_delay_ms(12000);
@@ -203,22 +203,12 @@ void reset_game(void)
 {
 	persist_set_value(get_reset_count() + 1);
 
-	SEND_BUTTON_SEQUENCE(
-		{ BT_H,		DP_NEUTRAL,	SEQ_HOLD,	3 },	/* Home button */
-		{ BT_NONE,	DP_NEUTRAL, SEQ_HOLD,	20 },	/* Wait for home */
-		{ BT_X,		DP_NEUTRAL,	SEQ_HOLD,	1 },	/* Ask to close game */
-		{ BT_NONE,	DP_NEUTRAL, SEQ_HOLD,	10 },	/* Wait for menu */
-		{ BT_A,		DP_NEUTRAL,	SEQ_HOLD,	1 },	/* Confirm close */
-		{ BT_NONE,	DP_NEUTRAL, SEQ_HOLD,	40 },	/* Wait for close */
-		{ BT_A,		DP_NEUTRAL,	SEQ_MASH,	20 },	/* Relaunch game */
-	);
+	SEND_CLOSE_AND_RELAUNCH_GAME();
 
 	/* Wait for the game to start */
 	_delay_ms(20000);
 
-	SEND_BUTTON_SEQUENCE(
-		{ BT_A,		DP_NEUTRAL,	SEQ_MASH,	80 }, /* Validate menu */
-	);
+	SEND_VALIDATE_GAME_MENU();
 
 	/* Wait for the game to load */
 	_delay_ms(9500);
@@ -0,0 +1,106 @@
+/*
+ * Benchmark program, run in the co-simulation by make bench
+ *
+ * Runs the main µC hot paths between benchmark markers (see bench.h), while
+ * the USB interface (also built with the markers) handles the messages and
+ * measures its own hot paths. The cycles spent sleeping while waiting for
+ * the USB interface are not counted.
+ */
+
+#include <avr/io.h>
+
+#include "automation.h"
+#include "persist.h"
+#include "script.h"
+#include "bench.h"
+
+/* Number of runs of each benchmark */
+#define ITERATIONS 32
+
+/* S_SCALED inputs and result; volatile so the evaluation is not done at
+   compile time */
+static volatile struct stick_coord scale_coord = { 219, 37 };
+static volatile uint8_t scale_value = 100;
+static volatile struct stick_coord scale_result;
+
+/* Script with the same updates as the benchmarked button sequence, plus a
+   stick move and a loop */
+static const uint8_t PROGMEM bench_script[] = {
+	SC_PRESS(BT_A,		DP_NEUTRAL),
+	SC_MASH(BT_NONE,	DP_BOTTOM,	1),
+	SC_HOLD(BT_B,		DP_NEUTRAL,	2),
+	SC_WAIT(1),
+	SC_MASH(BT_X,		DP_RIGHT,	2),
+	SC_WAIT(1),
+	SC_STICKS(S_XY_TOPRIGHT, S_XY_NEUTRAL),
+	SC_LOOP(2),
+		SC_PRESS(BT_A | BT_B,	DP_NEUTRAL),
+		SC_WAIT(1),
+	SC_END_LOOP,
+	SC_STICKS(S_XY_NEUTRAL, S_XY_NEUTRAL),
+	SC_WAIT(1),
+	SC_END,
+};
+
+
+int main(void)
+{
+	init_automation();
+
+	for (uint8_t i = 0 ; i < ITERATIONS ; i += 1) {
+		BENCH_START(BENCH_CALIBRATION);
+		BENCH_END(BENCH_CALIBRATION);
+	}
+
+	for (uint8_t i = 0 ; i < ITERATIONS ; i += 1) {
+		BENCH_START(BENCH_S_SCALED);
+		scale_result = S_SCALED(scale_coord, scale_value);
+		BENCH_END(BENCH_S_SCALED);
+	}
+
+	/* The LED state changes on each update, so a message is always sent */
+	for (uint8_t i = 0 ; i < ITERATIONS ; i += 1) {
+		set_leds(i & BOTH_LEDS);
+
+		BENCH_START(BENCH_SEND_CURRENT);
+		send_current();
+		BENCH_END(BENCH_SEND_CURRENT);
+	}
+
+	/* The steps are measured by send_button_sequence */
+	for (uint8_t i = 0 ; i < ITERATIONS / 8 ; i += 1) {
+		SEND_BUTTON_SEQUENCE(
+			{ BT_A,		DP_NEUTRAL,	SEQ_HOLD,	1 },
+			{ BT_NONE,	DP_BOTTOM,	SEQ_MASH,	1 },
+			{ BT_B,		DP_NEUTRAL,	SEQ_HOLD,	2 },
+			{ BT_NONE,	DP_NEUTRAL,	SEQ_HOLD,	1 },
+			{ BT_X,		DP_RIGHT,	SEQ_MASH,	2 },
+			{ BT_NONE,	DP_NEUTRAL,	SEQ_HOLD,	1 },
+			{ BT_A | BT_B,	DP_NEUTRAL,	SEQ_HOLD,	1 },
+			{ BT_NONE,	DP_NEUTRAL,	SEQ_HOLD,	1 },
+		);
+	}
+
+	/* The instructions are measured by run_script */
+	for (uint8_t i = 0 ; i < ITERATIONS / 8 ; i += 1) {
+		run_script(bench_script, NULL, 0, 0);
+	}
+
+	for (uint8_t i = 0 ; i < ITERATIONS ; i += 1) {
+		BENCH_START(BENCH_INIT_PERSIST);
+		init_persist();
+		BENCH_END(BENCH_INIT_PERSIST);
+
+		BENCH_START(BENCH_PERSIST_SET_VALUE);
+		persist_set_value(i);
+		BENCH_END(BENCH_PERSIST_SET_VALUE);
+	}
+
+	pause_automation();
+
+	/* Signal the end of the benchmarks */
+	BENCH_START(BENCH_COUNT);
+
+	for (;;) {
+	}
+}
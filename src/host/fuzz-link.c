@@ -0,0 +1,524 @@
+/*
+ * Fuzz harness of the USB interface link protocol (host build only)
+ *
+ * The USB interface program is included in this file, so its state machine
+ * (handle_recv_byte, refresh_controller_data, panic…) can be driven directly
+ * and its state checked. There is no virtual clock: the serial link bytes are
+ * put in the receive ring buffer through the RX interrupt handler, and each
+ * host poll refreshes the controller data as on the first poll of a cycle.
+ *
+ * The input is a list of records. The first byte of each one is:
+ *  - bits 0-4: number N of bytes that follow (the record data);
+ *  - bits 5-6: number of host polls after the data is received;
+ *  - bit 7: if set, the data is a message without its trailer, which is
+ *    added with the expected sequence number and a valid CRC (so most
+ *    messages get through); with no data, a byte with a frame error is
+ *    received instead.
+ *
+ * After each received byte and host poll, these invariants are checked:
+ *  - the frame queue, chunk buffer and credit counters are in their bounds;
+ *  - the controller data is neutral in panic mode, and otherwise made of
+ *    neutral parts and of the data of messages that were accepted;
+ *  - the USB interface only sends valid characters to the main µC.
+ * At the end of the input, the main µC re-sync procedure is done (with the
+ * same number of query bytes as send_sync_query), and must succeed; a message
+ * sent after it must then be output.
+ *
+ * Built with libFuzzer by default (make fuzz-link); without LIBFUZZER
+ * defined, the program runs the input files given as arguments, or the
+ * standard input (for AFL and for reproducing a crash).
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "hal.h"
+
+/* The USB interface program, with its entry point renamed */
+#define main usb_iface_main
+#include "usb-iface.c"
+#undef main
+
+/* Record header fields */
+#define RECORD_LENGTH_MASK 0x1F
+#define RECORD_POLLS_SHIFT 5
+#define RECORD_POLLS_MASK 0x03
+#define RECORD_MESSAGE 0x80
+
+/* Maximum number of accepted button states and stick positions remembered
+   for the controller data check; beyond it, the check is not done */
+#define MAX_ACCEPTED 4096
+
+/* Size of the button and D-pad part of the controller data, and of the
+   sticks part that follows it */
+#define BUTTONS_SIZE 3
+#define STICKS_SIZE 4
+
+/* Static functions */
+static void run_input(const uint8_t* data, size_t size);
+static void reset_state(void);
+static void receive_byte(uint8_t byte, bool frame_error);
+static void receive_message(const uint8_t* message, uint8_t size);
+static void poll(void);
+static void check_state(const char* event);
+static void record_accepted(uint8_t prev_queue_count);
+static bool find_accepted(const uint8_t (*list)[STICKS_SIZE], size_t count,
+	const uint8_t* part, uint8_t size);
+static void re_sync_check(void);
+static void fail(const char* event, const char* message);
+
+
+/* Emulated registers, as used by the USB interface program */
+volatile struct hal_regs hal_regs;
+uint8_t hal_usb_endpoint;
+static uint8_t ucsr1a_cell;
+
+/* Frame error flag of the byte being received by the RX interrupt handler */
+static bool rx_frame_error;
+
+/* Characters sent by the USB interface to the main µC since the last
+   reset_state or re-sync query */
+static uint8_t sent_chars[256];
+static size_t sent_count;
+
+/* Button and D-pad states, and stick positions, of the messages accepted by
+   the USB interface */
+static uint8_t accepted_buttons[MAX_ACCEPTED][STICKS_SIZE];
+static size_t accepted_buttons_count;
+static uint8_t accepted_sticks[MAX_ACCEPTED][STICKS_SIZE];
+static size_t accepted_sticks_count;
+static bool accepted_overflow;
+
+
+#ifdef LIBFUZZER
+int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size)
+{
+	run_input(data, size);
+	return 0;
+}
+
+#else
+int main(int argc, char* argv[])
+{
+	static uint8_t data[1 << 20];
+
+	for (int idx = 1 ; idx < argc || idx == 1 ; idx += 1) {
+		FILE* file = (argc > 1) ? fopen(argv[idx], "rb") : stdin;
+		if (file == NULL) {
+			fprintf(stderr, "Unable to open %s\n", argv[idx]);
+			return 2;
+		}
+
+		size_t size = fread(data, 1, sizeof(data), file);
+		if (file != stdin) {
+			fclose(file);
+		}
+
+		run_input(data, size);
+	}
+
+	return 0;
+}
+#endif
+
+
+/*
+ * Drive the USB interface with an input, checking the invariants.
+ */
+void run_input(const uint8_t* data, size_t size)
+{
+	reset_state();
+
+	size_t pos = 0;
+	while (pos < size) {
+		uint8_t header = data[pos];
+		uint8_t length = header & RECORD_LENGTH_MASK;
+		uint8_t polls = (header >> RECORD_POLLS_SHIFT) & RECORD_POLLS_MASK;
+
+		pos += 1;
+		if (length > size - pos) {
+			length = size - pos;
+		}
+
+		if (!(header & RECORD_MESSAGE)) {
+			for (uint8_t idx = 0 ; idx < length ; idx += 1) {
+				receive_byte(data[pos + idx], false);
+			}
+		} else if (length == 0) {
+			receive_byte(0, true);
+		} else {
+			receive_message(&data[pos], length);
+		}
+
+		pos += length;
+
+		for (uint8_t idx = 0 ; idx < polls ; idx += 1) {
+			poll();
+		}
+	}
+
+	re_sync_check();
+}
+
+
+/*
+ * Put the USB interface in its state after a power-up (the initial sync is
+ * done), and forget the accepted messages.
+ */
+void reset_state(void)
+{
+	rx_head = 0;
+	rx_tail = 0;
+	rx_overflow = false;
+	fast_link = false;
+
+	/* A first cycle with no message leaves the panic check of
+	   refresh_controller_data in its initial state */
+	reset_link_state();
+	uint8_t new_seq_credits;
+	refresh_controller_data(&new_seq_credits);
+	reset_link_state();
+
+	sent_count = 0;
+	accepted_buttons_count = 0;
+	accepted_sticks_count = 0;
+	accepted_overflow = false;
+}
+
+
+/*
+ * Receive a byte from the main µC, and handle it.
+ */
+void receive_byte(uint8_t byte, bool frame_error)
+{
+	uint8_t prev_queue_count = frame_queue_count;
+
+	hal_regs.udr1 = byte;
+	rx_frame_error = frame_error;
+	hal_usart1_rx_vect();
+	rx_frame_error = false;
+
+	handle_serial_comm();
+
+	record_accepted(prev_queue_count);
+	check_state("byte received");
+}
+
+
+/*
+ * Receive a message from the main µC, followed by its trailer.
+ */
+void receive_message(const uint8_t* message, uint8_t size)
+{
+	uint8_t seq = expected_seq;
+	uint8_t crc = 0;
+
+	for (uint8_t idx = 0 ; idx < size ; idx += 1) {
+		crc = _crc8_ccitt_update(crc, message[idx]);
+		receive_byte(message[idx], false);
+	}
+
+	crc = _crc8_ccitt_update(crc, seq);
+	receive_byte(seq, false);
+	receive_byte(crc, false);
+}
+
+
+/*
+ * Host poll, on the first poll of a cycle.
+ */
+void poll(void)
+{
+	uint8_t new_seq_credits = 0;
+	uint8_t new_credits = refresh_controller_data(&new_seq_credits);
+
+	while (new_credits > 0) {
+		Serial_SendByte(READY_FOR_DATA_CHAR);
+		new_credits -= 1;
+	}
+
+	while (new_seq_credits > 0) {
+		Serial_SendByte(SEQUENCE_READY_CHAR);
+		new_seq_credits -= 1;
+	}
+
+	check_state("host poll");
+}
+
+
+/*
+ * Check the invariants of the USB interface state.
+ */
+void check_state(const char* event)
+{
+	uint8_t held = ((out_hold_cycles > 0) || playing_chunk) ? 1 : 0;
+
+	if ((frame_queue_head >= FRAME_QUEUE_SIZE) ||
+			(frame_queue_count + granted_credits + held > FRAME_QUEUE_SIZE)) {
+		fail(event, "frame queue and credits out of bounds");
+	}
+
+	if ((seq_chunk_head >= SEQUENCE_CHUNK_COUNT) ||
+			(seq_chunk_count + granted_seq_credits > SEQUENCE_CHUNK_COUNT)) {
+		fail(event, "sequence chunks and credits out of bounds");
+	}
+
+	if (playing_chunk && ((seq_chunk_count == 0) ||
+			(play_pos > seq_chunk_steps[seq_chunk_head]))) {
+		fail(event, "sequence chunk play position out of bounds");
+	}
+
+	if (recv_chunk_pos + recv_chunk_remaining >
+			SEQUENCE_CHUNK_STEPS * SEQUENCE_STEP_SIZE) {
+		fail(event, "sequence chunk receive position out of bounds");
+	}
+
+	if ((recv_pending_bytes >> (DATA_SIZE - 1)) != 0) {
+		fail(event, "pending controller data bytes out of bounds");
+	}
+
+	if ((out_cycle_length == 0) || (recv_cycle_length == 0)) {
+		fail(event, "null cycle length");
+	}
+
+	/* The controller data is checked in two parts, since the sticks of a
+	   sequence step come from the previous data */
+	if (panic_mode) {
+		if (memcmp(out_data, neutral_controller_data, DATA_SIZE - 1) != 0) {
+			fail(event, "controller data not neutral in panic mode");
+		}
+	} else if (!accepted_overflow) {
+		const uint8_t* buttons = out_data;
+		const uint8_t* sticks = out_data + BUTTONS_SIZE;
+
+		if ((memcmp(buttons, neutral_controller_data, BUTTONS_SIZE) != 0) &&
+				!find_accepted(accepted_buttons, accepted_buttons_count,
+					buttons, BUTTONS_SIZE)) {
+			fail(event, "buttons of the controller data never sent");
+		}
+
+		if ((memcmp(sticks, neutral_controller_data + BUTTONS_SIZE, STICKS_SIZE) != 0) &&
+				!find_accepted(accepted_sticks, accepted_sticks_count,
+					sticks, STICKS_SIZE)) {
+			fail(event, "sticks of the controller data never sent");
+		}
+	}
+
+	for (size_t idx = 0 ; idx < sent_count ; idx += 1) {
+		uint8_t sent = sent_chars[idx];
+
+		if ((sent != READY_FOR_DATA_CHAR) && (sent != SEQUENCE_READY_CHAR) &&
+				(sent != RE_SYNC_CHAR) && (sent != NAK_CHAR) &&
+				(sent != LINK_SPEED_ACK_CHAR) && !(sent & RETRANSMIT_ACK)) {
+			fail(event, "invalid character sent to the main µC");
+		}
+	}
+}
+
+
+/*
+ * Remember the button states and stick positions of the message accepted by
+ * the USB interface, if any.
+ */
+void record_accepted(uint8_t prev_queue_count)
+{
+	if (frame_queue_count <= prev_queue_count) {
+		return;
+	}
+
+	uint8_t tail = frame_queue_head + frame_queue_count - 1;
+	if (tail >= FRAME_QUEUE_SIZE) {
+		tail -= FRAME_QUEUE_SIZE;
+	}
+
+	const struct data_update* update = &frame_queue[tail];
+	uint8_t step_count = 1;
+	const uint8_t* steps = update->data;
+
+	if (update->repeat == 0) {
+		/* Sequence chunk; the last one received */
+		uint8_t chunk = seq_chunk_head + seq_chunk_count - 1;
+		if (chunk >= SEQUENCE_CHUNK_COUNT) {
+			chunk -= SEQUENCE_CHUNK_COUNT;
+		}
+
+		step_count = seq_chunk_steps[chunk];
+		steps = seq_chunks[chunk];
+	} else if (accepted_sticks_count < MAX_ACCEPTED) {
+		memcpy(accepted_sticks[accepted_sticks_count], update->data + BUTTONS_SIZE,
+			STICKS_SIZE);
+		accepted_sticks_count += 1;
+	} else {
+		accepted_overflow = true;
+	}
+
+	for (uint8_t idx = 0 ; idx < step_count ; idx += 1) {
+		if (accepted_buttons_count == MAX_ACCEPTED) {
+			accepted_overflow = true;
+			return;
+		}
+
+		/* The D-pad byte of a step also has the mash flag and cycle bits */
+		const uint8_t* step = steps + idx * SEQUENCE_STEP_SIZE;
+		uint8_t* buttons = accepted_buttons[accepted_buttons_count];
+
+		memcpy(buttons, step, BUTTONS_SIZE);
+		if (update->repeat == 0) {
+			buttons[2] &= 0x0F;
+		}
+
+		accepted_buttons_count += 1;
+	}
+}
+
+
+/*
+ * Returns true if a controller data part is in a list of accepted ones.
+ */
+bool find_accepted(const uint8_t (*list)[STICKS_SIZE], size_t count,
+	const uint8_t* part, uint8_t size)
+{
+	for (size_t idx = 0 ; idx < count ; idx += 1) {
+		if (memcmp(list[idx], part, size) == 0) {
+			return true;
+		}
+	}
+
+	return false;
+}
+
+
+/*
+ * Do the re-sync procedure of the main µC, then check that the USB interface
+ * is reset, and that it outputs a new message.
+ */
+void re_sync_check(void)
+{
+	const uint8_t max_tries = MAX_MESSAGE_SIZE + MESSAGE_TRAILER_SIZE +
+		ERROR_RE_SYNC_QUERY_COUNT;
+	bool synced = false;
+
+	sent_count = 0;
+
+	for (uint8_t tries = 0 ; (tries < max_tries) && !synced ; tries += 1) {
+		receive_byte(RE_SYNC_QUERY_BYTE, false);
+		synced = (memchr(sent_chars, RE_SYNC_CHAR, sent_count) != NULL);
+	}
+
+	if (!synced) {
+		fail("re-sync", "no re-sync character after the re-sync queries");
+	}
+
+	if (panic_mode || (frame_queue_count != 0) || (seq_chunk_count != 0) ||
+			(memcmp(out_data, neutral_controller_data, DATA_SIZE - 1) != 0)) {
+		fail("re-sync", "state not reset");
+	}
+
+	/* The ready signals are sent on the next cycle; a message with all the
+	   fields is then output on the cycle after it */
+	poll();
+
+	if (memchr(sent_chars, READY_FOR_DATA_CHAR, sent_count) == NULL) {
+		fail("re-sync", "no ready signal after the re-sync");
+	}
+
+	const uint8_t message[] = {
+		UPDATE_HEADER | UPDATE_BUTTONS | UPDATE_D_PAD | UPDATE_L_STICK | UPDATE_R_STICK,
+		0x04, 0x00, 0x02, 0x12, 0x34, 0x56, 0x78, MAGIC_VALUE,
+	};
+
+	receive_message(message, sizeof(message));
+	poll();
+
+	if (memcmp(out_data, &message[1], DATA_SIZE - 1) != 0) {
+		fail("re-sync", "message not output after the re-sync");
+	}
+}
+
+
+/*
+ * Report an invariant violation, and abort so the fuzzer saves the input.
+ */
+void fail(const char* event, const char* message)
+{
+	fprintf(stderr, "After %s: %s\n", event, message);
+	fprintf(stderr, "Controller data:");
+	for (uint8_t idx = 0 ; idx < DATA_SIZE ; idx += 1) {
+		fprintf(stderr, " %02x", out_data[idx]);
+	}
+
+	fprintf(stderr, "\nPanic mode %u, frame queue %u (%u credits), chunks %u "
+		"(%u credits), receive error %d\n", panic_mode, frame_queue_count,
+		granted_credits, seq_chunk_count, granted_seq_credits, recv_error);
+	abort();
+}
+
+
+/*
+ * Emulated hardware
+ */
+
+volatile uint8_t* hal_ucsr1a(void)
+{
+	/* The transmitter is always done, so the link speed change acknowledge
+	   does not wait */
+	ucsr1a_cell = (1 << TXC1) | (1 << UDRE1);
+	if (rx_frame_error) {
+		ucsr1a_cell |= (1 << FE1);
+	}
+
+	return &ucsr1a_cell;
+}
+
+void hal_usb_serial_send(uint8_t byte)
+{
+	if (sent_count < sizeof(sent_chars)) {
+		sent_chars[sent_count] = byte;
+		sent_count += 1;
+	}
+}
+
+void hal_usb_serial_init(uint32_t baud, bool double_speed)
+{
+	(void)baud;
+	(void)double_speed;
+}
+
+void hal_delay_us(double us)
+{
+	(void)us;
+}
+
+void hal_usb_set_leds(uint8_t leds)
+{
+	(void)leds;
+}
+
+void hal_usb_interrupt_enable(void)
+{
+}
+
+/* The USB interface main loop and the endpoint functions are not used */
+bool hal_usb_in_ready(void)
+{
+	return false;
+}
+
+void hal_usb_in_write(const void* data, uint16_t size)
+{
+	(void)data;
+	(void)size;
+}
+
+void hal_usb_in_commit(void)
+{
+}
+
+uint16_t hal_usb_frame_number(void)
+{
+	return 0;
+}
+
+void hal_usb_task(void)
+{
+}
@@ -0,0 +1,1350 @@
+/*
+ * Hardware abstraction layer for the host build: emulation of the hardware
+ * used by the main µC and USB µC programs, on a virtual clock.
+ *
+ * The main µC program runs on the process stack; the USB µC program runs in
+ * a coroutine, which is resumed when it has something to do (received byte,
+ * host poll, end of a delay). The serial link between the µCs is emulated at
+ * the byte level with the baud rate configured on each side, and a virtual
+ * USB host polls the IN endpoint at a regular interval.
+ */
+
+#define _XOPEN_SOURCE 700
+
+#include "hal.h"
+#include "trace.h"
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <ucontext.h>
+#include <unistd.h>
+
+
+/* Number of CPU cycles in a ms, and in a µs */
+#define MS_CYCLES (HAL_CPU_FREQ / 1000)
+#define US_CYCLES (HAL_CPU_FREQ / 1000000)
+
+/* Time taken by each read of a status register that is polled */
+#define POLL_CYCLES 8
+
+/* Time taken by an iteration of the USB µC main loop */
+#define USB_LOOP_CYCLES 200
+
+/* Time taken to write an EEPROM byte (3.4 ms) */
+#define EEPROM_WRITE_CYCLES (MS_CYCLES * 34 / 10)
+
+/* Size of the main µC EEPROM */
+#define EEPROM_SIZE 1024
+
+/* Time the push button is held, and released between presses, in ms */
+#define PRESS_HOLD_MS 100
+#define PRESS_GAP_MS 150
+
+/* The main µC starts waiting for the button when it reads it after not
+   reading it for that long (ms) */
+#define BUTTON_WAIT_GAP_MS 20
+
+/* Push button bit of PINB */
+#define PINB_BUTTON (1 << 4)
+
+/* L LED bit of PORTB */
+#define PORTB_L_LED (1 << 5)
+
+/* In panic mode, the groups of L LED blinks are separated by a longer pause
+   (ms, see panic in automation.c) */
+#define PANIC_PAUSE_MS 1000
+
+/* Maximum number of link fault ranges (-x option) */
+#define MAX_LINK_FAULTS 16
+
+/* Once the button script is done, the run ends when the main µC waits for
+   the button for that long without sending anything to the USB µC (ms) */
+#define SCRIPT_END_IDLE_MS 30000
+
+/* The run is considered stalled (panic mode…) if the main µC does not send
+   anything nor read the button for that long (ms) */
+#define STALL_MS (30 * 60 * 1000UL)
+
+/* Start time of the main µC, after the USB µC, so the initial sync character
+   is received as on a power-up (ms) */
+#define MAIN_START_MS 1
+
+/* Stack size of the USB µC program */
+#define USB_STACK_SIZE 65536
+
+/* Time value meaning “never” */
+#define NEVER UINT64_MAX
+
+/* Size of a USB report */
+#define REPORT_SIZE 8
+
+
+/* Emulated serial controller */
+struct usart {
+	uint32_t baud; /* Current baud rate */
+
+	/* Bytes being sent (in the shift register, then in the data register),
+	   with their baud rate and the time they are completely sent */
+	struct {
+		uint8_t value;
+		uint32_t baud;
+		uint64_t end;
+	} tx[2];
+	uint8_t tx_count;
+
+	/* Receive FIFO */
+	struct {
+		uint8_t value;
+		bool error; /* Frame error */
+	} rx[2];
+	uint8_t rx_count;
+
+	/* Statistics */
+	uint64_t sent; /* Bytes sent */
+	uint64_t frame_errors; /* Bytes received with a frame error */
+	uint64_t overruns; /* Bytes lost because the receive FIFO was full */
+};
+
+/* Press group of the button script */
+struct press_group {
+	uint8_t count; /* Number of presses */
+	uint32_t delay_ms; /* Delay after the end of the previous group */
+};
+
+/* Range of bytes sent by the main µC that are corrupted or dropped */
+struct link_fault {
+	uint64_t first; /* Index of the first byte */
+	uint64_t last; /* Index of the last byte (UINT64_MAX: until the end) */
+	bool drop; /* True to drop the bytes, false to corrupt them */
+};
+
+/* Execution context */
+enum context {
+	CTX_MAIN, /* Main µC program */
+	CTX_USB, /* USB µC program */
+};
+
+
+volatile struct hal_regs hal_regs;
+uint8_t hal_usb_endpoint;
+int hal_argc;
+char** hal_argv;
+void (*hal_report_hook)(uint64_t time_us, const uint8_t* report);
+
+/* Current time, in CPU cycles */
+static uint64_t now;
+
+/* Time limit of the run (NEVER if none) */
+static uint64_t time_limit = NEVER;
+
+/* Context being executed, and interrupt handler execution state */
+static enum context ctx = CTX_MAIN;
+static bool main_in_isr;
+static bool usb_in_isr;
+
+/* Main µC serial controller, data register content and whether it was
+   accessed since the last sync, and status register content */
+static struct usart main_usart;
+static volatile uint16_t udr0_cell;
+static bool udr0_accessed;
+static volatile uint8_t ucsr0a_cell;
+
+/* Main µC interrupts enabled, interrupts blocked for one instruction after
+   sei, and number of interrupt handlers executed */
+static bool main_int_enabled;
+static bool sei_delay;
+static uint64_t main_isr_count;
+
+/* Main µC port B input */
+static volatile uint8_t pinb_cell;
+
+/* Main µC L LED state, time it was last turned off, and number of blinks since
+   the last long pause; the number of blinks of the previous group is the
+   panic mode, if the main µC is in panic mode */
+static bool l_led_on;
+static uint64_t l_led_off_time;
+static uint8_t l_led_blinks;
+static uint8_t l_led_group_blinks;
+
+/* Main µC EEPROM, and file it is saved to */
+static uint8_t eeprom[EEPROM_SIZE];
+static const char* eeprom_file;
+
+/* USB µC serial controller, status register content, and frame error flag of
+   the byte being handled by the receive interrupt handler */
+static struct usart usb_usart;
+static volatile uint8_t ucsr1a_cell;
+static bool usb_rx_error;
+
+/* USB µC interrupts enabled */
+static bool usb_int_enabled;
+
+/* Faults injected on the bytes sent by the main µC, and number of bytes it
+   sent that were delivered to the USB µC or dropped */
+static struct link_fault link_faults[MAX_LINK_FAULTS];
+static size_t link_fault_count;
+static uint64_t main_bytes_handled;
+
+/* USB µC program coroutine. It is resumed at usb_wake; usb_idle is true if it
+   is waiting for something to happen at the end of a main loop iteration,
+   and usb_kick is set when something happens. */
+static ucontext_t sched_context;
+static ucontext_t usb_context;
+static uint64_t usb_wake;
+static bool usb_idle;
+static bool usb_kick;
+
+/* IN endpoint buffer, and whether it contains a report for the next poll */
+static uint8_t in_report[REPORT_SIZE];
+static bool in_report_ready;
+
+/* Interval between the host polls, and time of the next one */
+static uint64_t poll_interval = 8 * MS_CYCLES;
+static uint64_t next_poll;
+
+/* Last report sent to the host */
+static uint8_t last_report[REPORT_SIZE];
+
+/* USB µC LED state */
+static uint8_t usb_leds;
+
+/* Button script, index of the current press group, and its state */
+static struct press_group* script;
+static size_t script_length;
+static size_t script_pos;
+static uint64_t group_arm_time;
+static uint64_t group_start;
+static bool group_started;
+static uint64_t script_end_time;
+
+/* Last time the button was read, and time the main µC started waiting for
+   the button */
+static uint64_t last_button_read = NEVER;
+static uint64_t button_wait_start;
+
+/* Last time the main µC sent a byte, and sent a byte or read the button */
+static uint64_t last_tx_time;
+static uint64_t last_activity;
+
+/* Trace of the reports received by the host (NULL if not recorded) */
+static struct trace_writer* trace;
+
+/* Function markers of the main µC program (NULL if not recorded) */
+static FILE* markers;
+
+/* Report statistics */
+static uint64_t report_count;
+static uint64_t active_report_count;
+static uint64_t missed_poll_count;
+
+/* Verbose output */
+static bool verbose;
+
+/* Wall clock time at the start of the run */
+static struct timespec wall_start;
+
+
+/* Static functions */
+static void usage(const char* prog_name);
+static bool parse_script(const char* spec);
+static bool parse_link_faults(const char* spec);
+static void load_eeprom(void);
+static void finish(const char* reason, int status);
+static void log_event(const char* format, ...)
+	__attribute__((format(printf, 1, 2)));
+static void usb_entry(void);
+static void usb_resume(void);
+static void usb_wait(uint64_t cycles);
+static void usb_notify(void);
+static void spin(uint64_t cycles);
+static void watch_l_led(void);
+static void main_entry(void);
+static void sync_main(void);
+static void dispatch_main_interrupts(void);
+static void dispatch_usb_interrupts(void);
+static void advance_to(uint64_t target);
+static uint64_t next_event_time(void);
+static void process_events(void);
+static void host_poll(void);
+static bool button_pressed(void);
+static uint32_t ubrr_baud(uint16_t ubrr, bool double_speed);
+static void usart_send(struct usart* usart, uint8_t value);
+static void usart_deliver(struct usart* usart, struct usart* peer);
+
+/* Function entry and exit hooks of the code built with
+   -finstrument-functions */
+void __cyg_profile_func_enter(void* func, void* call_site)
+	__attribute__((no_instrument_function));
+void __cyg_profile_func_exit(void* func, void* call_site)
+	__attribute__((no_instrument_function));
+
+
+int main(int argc, char* argv[])
+{
+	const char* trace_file = NULL;
+	const char* marker_file = NULL;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "b:e:m:p:r:t:vx:h")) != -1) {
+		switch (opt) {
+			case 'b':
+				if (!parse_script(optarg)) {
+					fprintf(stderr, "Invalid button script: %s\n", optarg);
+					return 2;
+				}
+			break;
+
+			case 'e':
+				eeprom_file = optarg;
+			break;
+
+			case 'm':
+				marker_file = optarg;
+			break;
+
+			case 'p': {
+				long interval = strtol(optarg, NULL, 10);
+				if ((interval < 1) || (interval > 32)) {
+					fprintf(stderr, "The poll interval must be between 1 and 32 ms\n");
+					return 2;
+				}
+
+				poll_interval = interval * MS_CYCLES;
+			}
+			break;
+
+			case 'r':
+				trace_file = optarg;
+			break;
+
+			case 't':
+				time_limit = (uint64_t)(strtod(optarg, NULL) * 1000) * MS_CYCLES;
+			break;
+
+			case 'v':
+				verbose = true;
+			break;
+
+			case 'x':
+				if (!parse_link_faults(optarg)) {
+					fprintf(stderr, "Invalid link faults: %s\n", optarg);
+					return 2;
+				}
+			break;
+
+			default:
+				usage(argv[0]);
+				return (opt == 'h') ? 0 : 2;
+		}
+	}
+
+	hal_argc = argc - optind;
+	hal_argv = argv + optind;
+
+	if (trace_file != NULL) {
+		trace = trace_create(trace_file, poll_interval / US_CYCLES);
+		if (trace == NULL) {
+			return 1;
+		}
+	}
+
+	/* The address of program_main maps the recorded addresses to the symbols
+	   of the executable, which may be loaded anywhere */
+	if (marker_file != NULL) {
+		markers = fopen(marker_file, "w");
+		if (markers == NULL) {
+			fprintf(stderr, "Unable to create %s\n", marker_file);
+			return 1;
+		}
+
+		fprintf(markers, "# program_main %p\n", (void*)program_main);
+	}
+
+	load_eeprom();
+	clock_gettime(CLOCK_MONOTONIC, &wall_start);
+
+	if (script_length > 0) {
+		group_arm_time = script[0].delay_ms * MS_CYCLES;
+	}
+
+	/* Both µCs start with the serial link disabled and the button released */
+	main_usart.baud = ubrr_baud(0, false);
+	usb_usart.baud = ubrr_baud(0, false);
+	pinb_cell = PINB_BUTTON;
+	memcpy(last_report, (const uint8_t[]){ 0, 0, 0x08, 128, 128, 128, 128, 0 },
+		REPORT_SIZE);
+
+	/* Start the USB µC program, then the main µC program */
+	static uint8_t usb_stack[USB_STACK_SIZE];
+
+	getcontext(&usb_context);
+	usb_context.uc_stack.ss_sp = usb_stack;
+	usb_context.uc_stack.ss_size = sizeof(usb_stack);
+	usb_context.uc_link = NULL;
+	makecontext(&usb_context, usb_entry, 0);
+	usb_wake = 0;
+
+	advance_to(MAIN_START_MS * MS_CYCLES);
+	int status = program_main();
+
+	finish("the main µC program returned", status);
+	return status;
+}
+
+
+/*
+ * Print the command line usage.
+ */
+void usage(const char* prog_name)
+{
+	fprintf(stderr,
+		"Usage: %s [-v] [-b SCRIPT] [-e EEPROM_FILE] [-m MARKER_FILE] [-p POLL_MS]\n"
+		"       [-r TRACE_FILE] [-t SECONDS] [-x FAULTS] [ARG...]\n"
+		"Run the automation program on a virtual clock, with an emulated USB interface.\n"
+		"The arguments are passed to the program (replay-host: the trace to replay).\n"
+		"\n"
+		"  -b SCRIPT       button presses, as a comma-separated list of press groups\n"
+		"                  COUNT[@SECONDS]: COUNT presses, done when the program waits\n"
+		"                  for the button, at least SECONDS after the previous group\n"
+		"                  (the run ends once the program waits for the button after\n"
+		"                  the last group)\n"
+		"  -e EEPROM_FILE  load the EEPROM content from this file, and save it\n"
+		"  -m MARKER_FILE  record the entries and exits of the program functions to\n"
+		"                  this file (see tools/traceinfo.py)\n"
+		"  -p POLL_MS      USB host poll interval (8 for a Switch, 1 for a PC)\n"
+		"  -r TRACE_FILE   record the USB reports to this trace file\n"
+		"  -t SECONDS      maximum virtual duration of the run\n"
+		"  -v              log the button presses and the USB report changes\n"
+		"  -x FAULTS       corrupt or drop bytes sent by the main µC, as a\n"
+		"                  comma-separated list of ranges [d]FIRST[-[LAST]]: the\n"
+		"                  bytes are counted from 0, LAST defaults to FIRST and is\n"
+		"                  unbounded if omitted after '-', and 'd' drops them\n"
+		"                  instead of inverting their bits\n",
+		prog_name);
+}
+
+
+/*
+ * Parse the button script.
+ */
+bool parse_script(const char* spec)
+{
+	while (*spec != '\0') {
+		char* end;
+		long count = strtol(spec, &end, 10);
+		double delay = 0;
+
+		if ((end == spec) || (count < 1) || (count > 255)) {
+			return false;
+		}
+
+		spec = end;
+
+		if (*spec == '@') {
+			delay = strtod(spec + 1, &end);
+			if ((end == spec + 1) || (delay < 0)) {
+				return false;
+			}
+
+			spec = end;
+		}
+
+		if (*spec == ',') {
+			spec += 1;
+		} else if (*spec != '\0') {
+			return false;
+		}
+
+		script = realloc(script, (script_length + 1) * sizeof(*script));
+		if (script == NULL) {
+			return false;
+		}
+
+		script[script_length].count = count;
+		script[script_length].delay_ms = delay * 1000;
+		script_length += 1;
+	}
+
+	return true;
+}
+
+
+/*
+ * Parse the link faults to inject.
+ */
+bool parse_link_faults(const char* spec)
+{
+	while (*spec != '\0') {
+		struct link_fault fault = { 0, 0, false };
+		char* end;
+
+		if (*spec == 'd') {
+			fault.drop = true;
+			spec += 1;
+		}
+
+		fault.first = strtoull(spec, &end, 10);
+		if ((end == spec) || (link_fault_count == MAX_LINK_FAULTS)) {
+			return false;
+		}
+
+		spec = end;
+		fault.last = fault.first;
+
+		if (*spec == '-') {
+			spec += 1;
+			fault.last = UINT64_MAX;
+
+			if ((*spec >= '0') && (*spec <= '9')) {
+				fault.last = strtoull(spec, &end, 10);
+				spec = end;
+			}
+
+			if (fault.last < fault.first) {
+				return false;
+			}
+		}
+
+		if (*spec == ',') {
+			spec += 1;
+		} else if (*spec != '\0') {
+			return false;
+		}
+
+		link_faults[link_fault_count] = fault;
+		link_fault_count += 1;
+	}
+
+	return true;
+}
+
+
+/*
+ * Load the EEPROM content from its file, if it exists; the EEPROM is erased
+ * otherwise.
+ */
+void load_eeprom(void)
+{
+	memset(eeprom, 0xFF, sizeof(eeprom));
+
+	if (eeprom_file == NULL) {
+		return;
+	}
+
+	FILE* file = fopen(eeprom_file, "rb");
+	if (file != NULL) {
+		size_t size = fread(eeprom, 1, sizeof(eeprom), file);
+		(void)size;
+		fclose(file);
+	}
+}
+
+
+/*
+ * End the run: save the EEPROM content and the trace, and print the
+ * statistics.
+ */
+void finish(const char* reason, int status)
+{
+	if ((trace != NULL) && !trace_finish(trace, now / US_CYCLES)) {
+		status = 1;
+	}
+
+	if ((markers != NULL) && (fclose(markers) != 0)) {
+		fprintf(stderr, "Unable to write the function markers\n");
+		status = 1;
+	}
+
+	if (eeprom_file != NULL) {
+		FILE* file = fopen(eeprom_file, "wb");
+		if ((file == NULL) || (fwrite(eeprom, 1, sizeof(eeprom), file) != sizeof(eeprom))) {
+			fprintf(stderr, "Unable to save the EEPROM content to %s\n", eeprom_file);
+			status = 1;
+		}
+
+		if (file != NULL) {
+			fclose(file);
+		}
+	}
+
+	struct timespec wall_end;
+	clock_gettime(CLOCK_MONOTONIC, &wall_end);
+
+	double virtual_time = (double)now / HAL_CPU_FREQ;
+	double wall_time = (wall_end.tv_sec - wall_start.tv_sec) +
+		(wall_end.tv_nsec - wall_start.tv_nsec) / 1e9;
+	uint64_t seconds = now / HAL_CPU_FREQ;
+
+	printf("End of the run: %s\n", reason);
+	printf("Virtual time: %.3f s (%u:%02u:%02u)\n", virtual_time,
+		(unsigned)(seconds / 3600), (unsigned)(seconds / 60 % 60),
+		(unsigned)(seconds % 60));
+	printf("Wall time: %.3f s (%.0f times faster)\n", wall_time,
+		virtual_time / (wall_time > 0 ? wall_time : 1e-9));
+	printf("USB reports: %llu sent, %llu not neutral, %llu polls without a report\n",
+		(unsigned long long)report_count,
+		(unsigned long long)active_report_count,
+		(unsigned long long)missed_poll_count);
+	printf("Serial link: %u baud, %llu bytes sent by the main µC, %llu by the "
+		"USB µC, %llu frame errors, %llu overruns\n", (unsigned)main_usart.baud,
+		(unsigned long long)main_usart.sent, (unsigned long long)usb_usart.sent,
+		(unsigned long long)(main_usart.frame_errors + usb_usart.frame_errors),
+		(unsigned long long)(main_usart.overruns + usb_usart.overruns));
+
+	fflush(stdout);
+	exit(status);
+}
+
+
+/*
+ * Print a timestamped message in verbose mode.
+ */
+void log_event(const char* format, ...)
+{
+	if (!verbose) {
+		return;
+	}
+
+	va_list args;
+	va_start(args, format);
+
+	printf("[%11.3f] ", (double)now / HAL_CPU_FREQ);
+	vprintf(format, args);
+	putchar('\n');
+
+	va_end(args);
+}
+
+
+/*
+ * Entry point of the USB µC coroutine.
+ */
+void usb_entry(void)
+{
+	usb_iface_main();
+
+	fprintf(stderr, "The USB µC program returned\n");
+	exit(1);
+}
+
+
+/*
+ * Run the USB µC program until it waits again.
+ */
+void usb_resume(void)
+{
+	ctx = CTX_USB;
+	swapcontext(&sched_context, &usb_context);
+	ctx = CTX_MAIN;
+}
+
+
+/*
+ * Make the USB µC program wait for the specified time; the other events are
+ * processed meanwhile.
+ */
+void usb_wait(uint64_t cycles)
+{
+	usb_wake = now + cycles;
+	swapcontext(&usb_context, &sched_context);
+}
+
+
+/*
+ * Signal that something happened for the USB µC program; its main loop will
+ * run another iteration.
+ */
+void usb_notify(void)
+{
+	usb_kick = true;
+
+	if (usb_idle) {
+		usb_wake = now;
+	}
+}
+
+
+/*
+ * Let the specified time pass while polling a register. The time is not
+ * counted in the interrupt handlers.
+ */
+void spin(uint64_t cycles)
+{
+	if (ctx == CTX_USB) {
+		if (!usb_in_isr) {
+			usb_wait(cycles);
+		}
+	} else if (!main_in_isr) {
+		advance_to(now + cycles);
+	}
+}
+
+
+/*
+ * Count the blinks of the main µC L LED, to find the panic mode.
+ */
+void watch_l_led(void)
+{
+	bool on = (hal_regs.ddrb & PORTB_L_LED) && (hal_regs.portb & PORTB_L_LED);
+
+	if (on && !l_led_on) {
+		if (now - l_led_off_time >= PANIC_PAUSE_MS * MS_CYCLES) {
+			l_led_group_blinks = l_led_blinks;
+			l_led_blinks = 0;
+		}
+
+		l_led_blinks += 1;
+	} else if (!on && l_led_on) {
+		l_led_off_time = now;
+	}
+
+	l_led_on = on;
+}
+
+
+/*
+ * Called when the main µC program accesses the hardware: complete the
+ * previous register accesses, and run the pending interrupt handlers (unless
+ * interrupts were just enabled).
+ */
+void main_entry(void)
+{
+	sync_main();
+
+	if (sei_delay) {
+		sei_delay = false;
+	} else {
+		dispatch_main_interrupts();
+	}
+}
+
+
+/*
+ * Complete the register accesses of the main µC program: send the byte
+ * written to the data register, or remove the byte read from it from the
+ * receive FIFO; apply the double speed mode bit.
+ */
+void sync_main(void)
+{
+	if (udr0_accessed) {
+		udr0_accessed = false;
+
+		if (udr0_cell < 0x100) {
+			if (main_usart.tx_count < 2) {
+				usart_send(&main_usart, udr0_cell);
+			} else {
+				log_event("Main µC data register written while not empty");
+			}
+
+			last_tx_time = now;
+			last_activity = now;
+
+		} else if (main_usart.rx_count > 0) {
+			main_usart.rx[0] = main_usart.rx[1];
+			main_usart.rx_count -= 1;
+		}
+	}
+
+	main_usart.baud = ubrr_baud(hal_regs.ubrr0, ucsr0a_cell & (1 << 1));
+}
+
+
+/*
+ * Run the main µC interrupt handlers that are pending, if interrupts are
+ * enabled.
+ */
+void dispatch_main_interrupts(void)
+{
+	while (main_int_enabled && !main_in_isr) {
+		void (*handler)(void);
+
+		if ((hal_regs.ucsr0b & (1 << 7)) && (main_usart.rx_count > 0)) {
+			handler = &hal_usart0_rx_vect;
+		} else if ((hal_regs.ucsr0b & (1 << 5)) && (main_usart.tx_count < 2)) {
+			handler = &hal_usart0_udre_vect;
+		} else {
+			break;
+		}
+
+		main_in_isr = true;
+		handler();
+		main_in_isr = false;
+
+		main_isr_count += 1;
+		sync_main();
+	}
+}
+
+
+/*
+ * Run the USB µC receive interrupt handler for each received byte, if
+ * interrupts are enabled.
+ */
+void dispatch_usb_interrupts(void)
+{
+	if (!usb_int_enabled || usb_in_isr || !(hal_regs.ucsr1b & (1 << 7)) ||
+			(usb_usart.rx_count == 0)) {
+		return;
+	}
+
+	enum context prev_ctx = ctx;
+
+	while (usb_usart.rx_count > 0) {
+		hal_regs.udr1 = usb_usart.rx[0].value;
+		usb_rx_error = usb_usart.rx[0].error;
+		usb_usart.rx[0] = usb_usart.rx[1];
+		usb_usart.rx_count -= 1;
+
+		ctx = CTX_USB;
+		usb_in_isr = true;
+		hal_usart1_rx_vect();
+		usb_in_isr = false;
+	}
+
+	ctx = prev_ctx;
+	usb_notify();
+}
+
+
+/*
+ * Let the time pass until the specified time, processing the events and
+ * running the main µC interrupt handlers. Must only be called by the main µC
+ * program, outside of its interrupt handlers.
+ */
+void advance_to(uint64_t target)
+{
+	for (;;) {
+		uint64_t event_time = next_event_time();
+		if (event_time > target) {
+			break;
+		}
+
+		if (event_time > now) {
+			now = event_time;
+		}
+
+		process_events();
+		dispatch_main_interrupts();
+
+		if (now >= time_limit) {
+			finish("time limit reached", 0);
+		}
+	}
+
+	now = target;
+
+	if (now >= time_limit) {
+		finish("time limit reached", 0);
+	}
+
+	if (now - last_activity > STALL_MS * MS_CYCLES) {
+		if ((l_led_group_blinks != 0) && (l_led_on ||
+				(now - l_led_off_time < 2 * PANIC_PAUSE_MS * MS_CYCLES))) {
+			char reason[64];
+			snprintf(reason, sizeof(reason), "the main µC program is in panic mode %u",
+				l_led_group_blinks);
+			finish(reason, 1);
+		}
+
+		finish("the main µC program stalled", 1);
+	}
+}
+
+
+/*
+ * Returns the time of the next event.
+ */
+uint64_t next_event_time(void)
+{
+	uint64_t event_time = next_poll;
+
+	if ((main_usart.tx_count > 0) && (main_usart.tx[0].end < event_time)) {
+		event_time = main_usart.tx[0].end;
+	}
+
+	if ((usb_usart.tx_count > 0) && (usb_usart.tx[0].end < event_time)) {
+		event_time = usb_usart.tx[0].end;
+	}
+
+	if (usb_wake < event_time) {
+		event_time = usb_wake;
+	}
+
+	return event_time;
+}
+
+
+/*
+ * Process the events happening at the current time.
+ */
+void process_events(void)
+{
+	while ((main_usart.tx_count > 0) && (main_usart.tx[0].end <= now)) {
+		usart_deliver(&main_usart, &usb_usart);
+		dispatch_usb_interrupts();
+	}
+
+	while ((usb_usart.tx_count > 0) && (usb_usart.tx[0].end <= now)) {
+		usart_deliver(&usb_usart, &main_usart);
+	}
+
+	if (next_poll <= now) {
+		host_poll();
+		next_poll += poll_interval;
+	}
+
+	if (usb_wake <= now) {
+		usb_wake = NEVER;
+		usb_resume();
+	}
+}
+
+
+/*
+ * Poll the IN endpoint from the virtual USB host.
+ */
+void host_poll(void)
+{
+	static const uint8_t neutral_report[REPORT_SIZE - 1] = {
+		0, 0, 0x08, 128, 128, 128, 128,
+	};
+
+	if (!in_report_ready) {
+		missed_poll_count += 1;
+		return;
+	}
+
+	in_report_ready = false;
+	usb_notify();
+
+	report_count += 1;
+	if ((trace != NULL) &&
+			!trace_write(trace, now / US_CYCLES, in_report)) {
+		fprintf(stderr, "Unable to write the trace\n");
+		exit(1);
+	}
+
+	if (memcmp(in_report, neutral_report, sizeof(neutral_report)) != 0) {
+		active_report_count += 1;
+	}
+
+	if (memcmp(in_report, last_report, REPORT_SIZE) != 0) {
+		memcpy(last_report, in_report, REPORT_SIZE);
+
+		if (hal_report_hook != NULL) {
+			hal_report_hook(now / US_CYCLES, in_report);
+		}
+
+		log_event("Report %02x %02x %02x %02x %02x %02x %02x %02x",
+			in_report[0], in_report[1], in_report[2], in_report[3],
+			in_report[4], in_report[5], in_report[6], in_report[7]);
+	}
+}
+
+
+/*
+ * Returns true if the button is pressed at the current time, according to the
+ * button script. A press group starts once its delay has elapsed, if the main
+ * µC started waiting for the button after the previous group (so the presses
+ * of consecutive groups are not counted together).
+ */
+bool button_pressed(void)
+{
+	const uint64_t press_cycles = (PRESS_HOLD_MS + PRESS_GAP_MS) * MS_CYCLES;
+
+	if ((last_button_read == NEVER) ||
+			(now - last_button_read >= BUTTON_WAIT_GAP_MS * MS_CYCLES)) {
+		button_wait_start = now;
+	}
+
+	last_button_read = now;
+
+	while (script_pos < script_length) {
+		const struct press_group* group = &script[script_pos];
+
+		if (!group_started) {
+			if ((now < group_arm_time) || ((script_pos > 0) &&
+					(button_wait_start < script_end_time))) {
+				return false;
+			}
+
+			group_started = true;
+			group_start = now;
+			log_event("Button pressed %u time(s)", group->count);
+		}
+
+		uint64_t elapsed = now - group_start;
+		if (elapsed < group->count * press_cycles) {
+			return (elapsed % press_cycles) < PRESS_HOLD_MS * MS_CYCLES;
+		}
+
+		script_end_time = group_start + group->count * press_cycles;
+		script_pos += 1;
+		group_started = false;
+
+		if (script_pos < script_length) {
+			group_arm_time = script_end_time + script[script_pos].delay_ms * MS_CYCLES;
+		}
+	}
+
+	uint64_t idle_start = (last_tx_time > script_end_time) ? last_tx_time : script_end_time;
+	if (now - idle_start >= SCRIPT_END_IDLE_MS * MS_CYCLES) {
+		finish("end of the button script", 0);
+	}
+
+	return false;
+}
+
+
+/*
+ * Returns the baud rate of a serial controller with the specified settings.
+ */
+uint32_t ubrr_baud(uint16_t ubrr, bool double_speed)
+{
+	return HAL_CPU_FREQ / (double_speed ? 8 : 16) / ((uint32_t)ubrr + 1);
+}
+
+
+/*
+ * Start sending a byte on a serial controller (which must not have two bytes
+ * being sent already).
+ */
+void usart_send(struct usart* usart, uint8_t value)
+{
+	uint64_t start = (usart->tx_count > 0) ? usart->tx[usart->tx_count - 1].end : now;
+
+	usart->tx[usart->tx_count].value = value;
+	usart->tx[usart->tx_count].baud = usart->baud;
+	usart->tx[usart->tx_count].end = start + 10 * HAL_CPU_FREQ / usart->baud;
+	usart->tx_count += 1;
+	usart->sent += 1;
+}
+
+
+/*
+ * Deliver the byte that a serial controller finished sending to its peer.
+ * The byte has a frame error if the baud rates differ by more than 2%.
+ */
+void usart_deliver(struct usart* usart, struct usart* peer)
+{
+	uint8_t value = usart->tx[0].value;
+	uint32_t baud = usart->tx[0].baud;
+
+	usart->tx[0] = usart->tx[1];
+	usart->tx_count -= 1;
+
+	if (usart == &main_usart) {
+		uint64_t index = main_bytes_handled;
+		main_bytes_handled += 1;
+
+		for (size_t idx = 0 ; idx < link_fault_count ; idx += 1) {
+			const struct link_fault* fault = &link_faults[idx];
+
+			if ((index < fault->first) || (index > fault->last)) {
+				continue;
+			}
+
+			if (fault->drop) {
+				log_event("Byte %llu sent by the main µC dropped",
+					(unsigned long long)index);
+				return;
+			}
+
+			log_event("Byte %llu sent by the main µC corrupted",
+				(unsigned long long)index);
+			value = ~value;
+		}
+	}
+
+	uint32_t diff = (baud > peer->baud) ? baud - peer->baud : peer->baud - baud;
+	bool error = (diff * 50 > peer->baud);
+
+	if (error) {
+		peer->frame_errors += 1;
+		log_event("Frame error on the serial link (%u baud sent, %u baud expected)",
+			(unsigned)baud, (unsigned)peer->baud);
+	}
+
+	if (peer->rx_count == 2) {
+		peer->overruns += 1;
+		log_event("Serial link receive overrun");
+		return;
+	}
+
+	peer->rx[peer->rx_count].value = value;
+	peer->rx[peer->rx_count].error = error;
+	peer->rx_count += 1;
+}
+
+
+/*
+ * Record the entry in a function of the main µC program, and the exit of it
+ * (the program and library objects except the transport layer are built with
+ * -finstrument-functions, see the Makefile).
+ */
+void __cyg_profile_func_enter(void* func, void* call_site)
+{
+	(void)call_site;
+
+	if (markers != NULL) {
+		fprintf(markers, "%llu E %p\n", (unsigned long long)(now / US_CYCLES), func);
+	}
+}
+
+
+void __cyg_profile_func_exit(void* func, void* call_site)
+{
+	(void)call_site;
+
+	if (markers != NULL) {
+		fprintf(markers, "%llu X %p\n", (unsigned long long)(now / US_CYCLES), func);
+	}
+}
+
+
+volatile uint16_t* hal_udr0(void)
+{
+	main_entry();
+
+	udr0_cell = 0x100;
+	if (main_usart.rx_count > 0) {
+		udr0_cell |= main_usart.rx[0].value;
+	}
+
+	udr0_accessed = true;
+
+	return &udr0_cell;
+}
+
+
+volatile uint8_t* hal_ucsr0a(void)
+{
+	main_entry();
+	spin(POLL_CYCLES);
+
+	/* Only the double speed mode bit is writable */
+	uint8_t value = ucsr0a_cell & (1 << 1);
+
+	if (main_usart.rx_count > 0) {
+		value |= (1 << 7);
+
+		if (main_usart.rx[0].error) {
+			value |= (1 << 4);
+		}
+	}
+
+	if (main_usart.tx_count == 0) {
+		value |= (1 << 6);
+	}
+
+	if (main_usart.tx_count < 2) {
+		value |= (1 << 5);
+	}
+
+	ucsr0a_cell = value;
+
+	return &ucsr0a_cell;
+}
+
+
+volatile uint8_t* hal_pinb(void)
+{
+	main_entry();
+	spin(POLL_CYCLES);
+
+	last_activity = now;
+
+	if (button_pressed()) {
+		pinb_cell = hal_regs.portb & ~PINB_BUTTON;
+	} else {
+		pinb_cell = hal_regs.portb | PINB_BUTTON;
+	}
+
+	return &pinb_cell;
+}
+
+
+volatile uint8_t* hal_ucsr1a(void)
+{
+	spin(POLL_CYCLES);
+
+	uint8_t value = 0;
+
+	if (usb_in_isr && usb_rx_error) {
+		value |= (1 << 4);
+	}
+
+	if (usb_usart.tx_count == 0) {
+		value |= (1 << 6);
+	}
+
+	if (usb_usart.tx_count < 2) {
+		value |= (1 << 5);
+	}
+
+	ucsr1a_cell = value;
+
+	return &ucsr1a_cell;
+}
+
+
+void hal_sei(void)
+{
+	sync_main();
+
+	if (!main_int_enabled) {
+		main_int_enabled = true;
+		sei_delay = true;
+	}
+}
+
+
+void hal_cli(void)
+{
+	main_entry();
+
+	main_int_enabled = false;
+}
+
+
+void hal_sleep_cpu(void)
+{
+	/* An interrupt that is pending when sei is executed right before sleeping
+	   wakes up the CPU immediately */
+	sync_main();
+	sei_delay = false;
+
+	uint64_t isr_count = main_isr_count;
+	dispatch_main_interrupts();
+
+	while (main_isr_count == isr_count) {
+		advance_to(next_event_time());
+	}
+}
+
+
+void hal_delay_us(double us)
+{
+	uint64_t cycles = us * US_CYCLES;
+
+	if (ctx == CTX_MAIN) {
+		main_entry();
+		watch_l_led();
+	}
+
+	spin(cycles);
+}
+
+
+uint64_t hal_time_us(void)
+{
+	if (ctx == CTX_MAIN) {
+		main_entry();
+	}
+
+	return now / US_CYCLES;
+}
+
+
+uint8_t hal_eeprom_read_byte(uintptr_t addr)
+{
+	return eeprom[addr % EEPROM_SIZE];
+}
+
+
+void hal_eeprom_write_byte(uintptr_t addr, uint8_t value)
+{
+	main_entry();
+	spin(EEPROM_WRITE_CYCLES);
+
+	eeprom[addr % EEPROM_SIZE] = value;
+}
+
+
+void hal_usb_serial_init(uint32_t baud, bool double_speed)
+{
+	/* Same computation as LUFA */
+	uint16_t ubrr;
+
+	if (double_speed) {
+		ubrr = ((HAL_CPU_FREQ / 8) + (baud / 2)) / baud - 1;
+	} else {
+		ubrr = ((HAL_CPU_FREQ / 16) + (baud / 2)) / baud - 1;
+	}
+
+	hal_regs.ubrr1 = ubrr;
+	hal_regs.ucsr1b = (1 << 4) | (1 << 3);
+	usb_usart.baud = ubrr_baud(ubrr, double_speed);
+}
+
+
+void hal_usb_serial_send(uint8_t byte)
+{
+	while (usb_usart.tx_count == 2) {
+		spin(POLL_CYCLES);
+	}
+
+	usart_send(&usb_usart, byte);
+}
+
+
+void hal_usb_interrupt_enable(void)
+{
+	usb_int_enabled = true;
+	dispatch_usb_interrupts();
+}
+
+
+bool hal_usb_in_ready(void)
+{
+	return !in_report_ready;
+}
+
+
+void hal_usb_in_write(const void* data, uint16_t size)
+{
+	memcpy(in_report, data, (size < REPORT_SIZE) ? size : REPORT_SIZE);
+}
+
+
+void hal_usb_in_commit(void)
+{
+	in_report_ready = true;
+}
+
+
+uint16_t hal_usb_frame_number(void)
+{
+	return (now / MS_CYCLES) & 0x7FF;
+}
+
+
+void hal_usb_task(void)
+{
+	dispatch_usb_interrupts();
+
+	/* Run another iteration soon if something happened during this one;
+	   otherwise, wait for something to happen. */
+	if (usb_kick) {
+		usb_wait(USB_LOOP_CYCLES);
+	} else {
+		usb_idle = true;
+		usb_wait(NEVER - now);
+		usb_idle = false;
+	}
+
+	usb_kick = false;
+}
+
+
+void hal_usb_set_leds(uint8_t leds)
+{
+	if (leds != usb_leds) {
+		usb_leds = leds;
+		log_event("USB µC LEDs: TX %s, RX %s", (leds & 0x01) ? "on" : "off",
+			(leds & 0x02) ? "on" : "off");
+	}
+}
@@ -0,0 +1,127 @@
+/*
+ * Hardware abstraction layer for the host build
+ *
+ * The host build runs an automation program (built for the main µC) and the
+ * USB interface program (built for the USB µC) on a computer, in the same
+ * process. The AVR and LUFA headers are replaced by the ones in
+ * src/host/include, which access the emulated hardware through the functions
+ * defined here.
+ *
+ * Both programs run on a virtual clock: time only passes when a program waits
+ * (delay, sleep, polling of a status register), and waiting jumps directly to
+ * the next event (serial link byte received, USB host poll…). Long automation
+ * sessions can then be run in a few seconds.
+ */
+
+#ifndef HAL_H
+#define HAL_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/* CPU frequency of both µCs */
+#define HAL_CPU_FREQ 16000000UL
+
+/* Emulated I/O registers that are plain memory (the others are accessed
+   through the hal_* functions below) */
+struct hal_regs {
+	/* Main µC serial link */
+	uint8_t ucsr0b;
+	uint8_t ucsr0c;
+	uint16_t ubrr0;
+
+	/* Main µC GPIO ports */
+	uint8_t ddrb;
+	uint8_t portb;
+	uint8_t ddrd;
+	uint8_t portd;
+	uint8_t pind;
+
+	/* USB µC serial link */
+	uint8_t udr1;
+	uint8_t ucsr1b;
+	uint8_t ucsr1c;
+	uint16_t ubrr1;
+
+	/* Reset status (both µCs) */
+	uint8_t mcusr;
+};
+
+extern volatile struct hal_regs hal_regs;
+
+/*
+ * Main µC serial data register. The received byte is returned with bit 8 set;
+ * a value written to the register has it cleared, which is how the write is
+ * detected.
+ */
+volatile uint16_t* hal_udr0(void);
+
+/* Main µC serial status register; polling it takes some time */
+volatile uint8_t* hal_ucsr0a(void);
+
+/* Main µC port B input (the push button is on bit 4); polling it takes some
+   time */
+volatile uint8_t* hal_pinb(void);
+
+/* USB µC serial status register; polling it takes some time */
+volatile uint8_t* hal_ucsr1a(void);
+
+/* Enable/disable the main µC interrupts */
+void hal_sei(void);
+void hal_cli(void);
+
+/* Sleep until an interrupt is handled (main µC) */
+void hal_sleep_cpu(void);
+
+/* Busy-wait for the specified time, in µs (both µCs) */
+void hal_delay_us(double us);
+
+/* Virtual time since the start of the run, in µs (both µCs) */
+uint64_t hal_time_us(void);
+
+/* Main µC EEPROM access; writing takes some time */
+uint8_t hal_eeprom_read_byte(uintptr_t addr);
+void hal_eeprom_write_byte(uintptr_t addr, uint8_t value);
+
+/* USB µC serial link */
+void hal_usb_serial_init(uint32_t baud, bool double_speed);
+void hal_usb_serial_send(uint8_t byte);
+
+/* USB µC interrupts enabled */
+void hal_usb_interrupt_enable(void);
+
+/* USB µC IN endpoint: true if the report buffer is free; the report to send
+   at the next host poll is written to it, then committed */
+bool hal_usb_in_ready(void);
+void hal_usb_in_write(const void* data, uint16_t size);
+void hal_usb_in_commit(void);
+
+/* Current USB frame number (incremented every ms) */
+uint16_t hal_usb_frame_number(void);
+
+/* End of a USB µC main loop iteration; the main µC runs meanwhile */
+void hal_usb_task(void);
+
+/* USB µC LED state (bit 0: TX, bit 1: RX) */
+void hal_usb_set_leds(uint8_t leds);
+
+/* Interrupt handlers, defined by the emulated programs */
+void hal_usart0_rx_vect(void);
+void hal_usart0_udre_vect(void);
+void hal_usart1_rx_vect(void);
+
+/* Command line arguments following the options, for the programs that take
+   some (the replayer, the tests) */
+extern int hal_argc;
+extern char** hal_argv;
+
+/* Function called with each report received by the USB host that differs
+   from the previous one, and the time of the poll in µs (NULL if none; set by
+   the tests) */
+extern void (*hal_report_hook)(uint64_t time_us, const uint8_t* report);
+
+/* Entry points of the emulated programs */
+int program_main(void);
+int usb_iface_main(void);
+
+#endif
@@ -0,0 +1,30 @@
+/*
+ * Host build replacement of the LUFA LED driver (Arduino UNO board)
+ */
+
+#ifndef LUFA_LEDS_H
+#define LUFA_LEDS_H
+
+#include <stdint.h>
+
+#include "hal.h"
+
+#define LEDS_LED1 0x01
+#define LEDS_LED2 0x02
+#define LEDS_ALL_LEDS (LEDS_LED1 | LEDS_LED2)
+#define LEDS_NO_LEDS 0
+
+#define LEDMASK_TX LEDS_LED1
+#define LEDMASK_RX LEDS_LED2
+
+static inline void LEDs_Init(void)
+{
+	hal_usb_set_leds(LEDS_NO_LEDS);
+}
+
+static inline void LEDs_SetAllLEDs(uint8_t leds)
+{
+	hal_usb_set_leds(leds);
+}
+
+#endif
@@ -0,0 +1,23 @@
+/*
+ * Host build replacement of the LUFA serial driver (USART1 of the USB µC)
+ */
+
+#ifndef LUFA_SERIAL_H
+#define LUFA_SERIAL_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "hal.h"
+
+static inline void Serial_Init(uint32_t baud, bool double_speed)
+{
+	hal_usb_serial_init(baud, double_speed);
+}
+
+static inline void Serial_SendByte(uint8_t byte)
+{
+	hal_usb_serial_send(byte);
+}
+
+#endif
@@ -0,0 +1,115 @@
+/*
+ * Host build replacement of the LUFA USB driver: the parts used by the USB
+ * interface program, with a virtual USB host that polls the IN endpoint.
+ */
+
+#ifndef LUFA_USB_H
+#define LUFA_USB_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "hal.h"
+#include <util/delay.h>
+
+/* Descriptor types (only used as structure members) */
+typedef uint8_t USB_Descriptor_Configuration_Header_t;
+typedef uint8_t USB_Descriptor_Interface_t;
+typedef uint8_t USB_HID_Descriptor_HID_t;
+typedef uint8_t USB_Descriptor_Endpoint_t;
+
+#define ENDPOINT_DIR_OUT 0x00
+#define ENDPOINT_DIR_IN 0x80
+
+#define EP_TYPE_INTERRUPT 0x03
+
+#define ENDPOINT_RWSTREAM_NoError 0
+
+enum USB_Device_States_t {
+	DEVICE_STATE_Unattached = 0,
+	DEVICE_STATE_Configured = 4,
+};
+
+/* The virtual USB host configures the device right away */
+#define USB_DeviceState DEVICE_STATE_Configured
+
+/* Endpoint selected by Endpoint_SelectEndpoint */
+extern uint8_t hal_usb_endpoint;
+
+static inline void USB_Init(void)
+{
+}
+
+static inline void USB_USBTask(void)
+{
+	hal_usb_task();
+}
+
+static inline bool Endpoint_ConfigureEndpoint(uint8_t address, uint8_t type,
+	uint16_t size, uint8_t banks)
+{
+	(void)address;
+	(void)type;
+	(void)size;
+	(void)banks;
+	return true;
+}
+
+static inline void Endpoint_SelectEndpoint(uint8_t address)
+{
+	hal_usb_endpoint = address;
+}
+
+/* The virtual USB host does not send OUT data */
+static inline bool Endpoint_IsOUTReceived(void)
+{
+	return false;
+}
+
+static inline bool Endpoint_IsReadWriteAllowed(void)
+{
+	return true;
+}
+
+static inline uint8_t Endpoint_Read_Stream_LE(void* buffer, uint16_t length,
+	uint16_t* processed)
+{
+	(void)processed;
+	memset(buffer, 0, length);
+	return ENDPOINT_RWSTREAM_NoError;
+}
+
+static inline void Endpoint_ClearOUT(void)
+{
+}
+
+static inline bool Endpoint_IsINReady(void)
+{
+	return (hal_usb_endpoint & ENDPOINT_DIR_IN) && hal_usb_in_ready();
+}
+
+static inline uint8_t Endpoint_Write_Stream_LE(const void* buffer,
+	uint16_t length, uint16_t* processed)
+{
+	(void)processed;
+	hal_usb_in_write(buffer, length);
+	return ENDPOINT_RWSTREAM_NoError;
+}
+
+static inline void Endpoint_ClearIN(void)
+{
+	hal_usb_in_commit();
+}
+
+static inline uint16_t USB_Device_GetFrameNumber(void)
+{
+	return hal_usb_frame_number();
+}
+
+static inline void GlobalInterruptEnable(void)
+{
+	hal_usb_interrupt_enable();
+}
+
+#endif
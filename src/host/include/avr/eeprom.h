@@ -0,0 +1,40 @@
+/*
+ * Host build replacement of <avr/eeprom.h>
+ */
+
+#ifndef AVR_EEPROM_H
+#define AVR_EEPROM_H
+
+#include <stdint.h>
+
+#include "hal.h"
+
+static inline uint8_t eeprom_read_byte(const uint8_t* addr)
+{
+	return hal_eeprom_read_byte((uintptr_t)addr);
+}
+
+static inline void eeprom_write_byte(uint8_t* addr, uint8_t value)
+{
+	hal_eeprom_write_byte((uintptr_t)addr, value);
+}
+
+static inline uint32_t eeprom_read_dword(const uint32_t* addr)
+{
+	uint32_t value = 0;
+
+	for (uint8_t idx = 0 ; idx < 4 ; idx += 1) {
+		value |= (uint32_t)hal_eeprom_read_byte((uintptr_t)addr + idx) << (8 * idx);
+	}
+
+	return value;
+}
+
+static inline void eeprom_write_dword(uint32_t* addr, uint32_t value)
+{
+	for (uint8_t idx = 0 ; idx < 4 ; idx += 1) {
+		hal_eeprom_write_byte((uintptr_t)addr + idx, value >> (8 * idx));
+	}
+}
+
+#endif
@@ -0,0 +1,20 @@
+/*
+ * Host build replacement of <avr/interrupt.h>. The interrupt handlers are
+ * called by the HAL.
+ */
+
+#ifndef AVR_INTERRUPT_H
+#define AVR_INTERRUPT_H
+
+#include "hal.h"
+
+#define USART_RX_vect hal_usart0_rx_vect
+#define USART_UDRE_vect hal_usart0_udre_vect
+#define USART1_RX_vect hal_usart1_rx_vect
+
+#define ISR(VECTOR) void VECTOR(void)
+
+#define sei() hal_sei()
+#define cli() hal_cli()
+
+#endif
@@ -0,0 +1,77 @@
+/*
+ * Host build replacement of <avr/io.h>: registers of the main µC (ATmega328P)
+ * and of the USB µC (ATmega16U2) used by the programs, mapped to the emulated
+ * hardware.
+ */
+
+#ifndef AVR_IO_H
+#define AVR_IO_H
+
+#include <stdint.h>
+
+#include "hal.h"
+#include "avr/sfr_defs.h"
+
+/* Main µC serial link */
+#define UDR0 (*hal_udr0())
+#define UCSR0A (*hal_ucsr0a())
+#define UCSR0B (hal_regs.ucsr0b)
+#define UCSR0C (hal_regs.ucsr0c)
+#define UBRR0 (hal_regs.ubrr0)
+#define UBRR0L (((volatile uint8_t*)&hal_regs.ubrr0)[0])
+#define UBRR0H (((volatile uint8_t*)&hal_regs.ubrr0)[1])
+
+#define RXC0 7
+#define TXC0 6
+#define UDRE0 5
+#define FE0 4
+#define DOR0 3
+#define UPE0 2
+#define U2X0 1
+#define MPCM0 0
+
+#define RXCIE0 7
+#define TXCIE0 6
+#define UDRIE0 5
+#define RXEN0 4
+#define TXEN0 3
+#define UCSZ02 2
+
+#define UCSZ01 2
+#define UCSZ00 1
+
+/* Main µC GPIO ports */
+#define DDRB (hal_regs.ddrb)
+#define PORTB (hal_regs.portb)
+#define PINB (*hal_pinb())
+#define DDRD (hal_regs.ddrd)
+#define PORTD (hal_regs.portd)
+#define PIND (hal_regs.pind)
+
+/* USB µC serial link */
+#define UDR1 (hal_regs.udr1)
+#define UCSR1A (*hal_ucsr1a())
+#define UCSR1B (hal_regs.ucsr1b)
+#define UCSR1C (hal_regs.ucsr1c)
+#define UBRR1 (hal_regs.ubrr1)
+
+#define RXC1 7
+#define TXC1 6
+#define UDRE1 5
+#define FE1 4
+#define U2X1 1
+
+#define RXCIE1 7
+#define TXCIE1 6
+#define UDRIE1 5
+#define RXEN1 4
+#define TXEN1 3
+
+#define UCSZ11 2
+#define UCSZ10 1
+
+/* Reset status */
+#define MCUSR (hal_regs.mcusr)
+#define WDRF 3
+
+#endif
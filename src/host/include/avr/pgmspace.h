@@ -0,0 +1,21 @@
+/*
+ * Host build replacement of <avr/pgmspace.h>; the program memory is the
+ * regular memory.
+ */
+
+#ifndef AVR_PGMSPACE_H
+#define AVR_PGMSPACE_H
+
+#include <stdint.h>
+#include <string.h>
+
+#define PROGMEM
+
+#define pgm_read_byte(ADDR) (*(const uint8_t*)(ADDR))
+#define pgm_read_word(ADDR) (*(const uint16_t*)(ADDR))
+#define pgm_read_dword(ADDR) (*(const uint32_t*)(ADDR))
+#define pgm_read_ptr(ADDR) (*(void* const*)(ADDR))
+
+#define memcpy_P memcpy
+
+#endif
@@ -0,0 +1,16 @@
+/*
+ * Host build replacement of <avr/sfr_defs.h>
+ */
+
+#ifndef AVR_SFR_DEFS_H
+#define AVR_SFR_DEFS_H
+
+#define _BV(BIT) (1 << (BIT))
+
+#define bit_is_set(SFR, BIT) ((SFR) & _BV(BIT))
+#define bit_is_clear(SFR, BIT) (!((SFR) & _BV(BIT)))
+
+#define loop_until_bit_is_set(SFR, BIT) do { } while (bit_is_clear(SFR, BIT))
+#define loop_until_bit_is_clear(SFR, BIT) do { } while (bit_is_set(SFR, BIT))
+
+#endif
@@ -0,0 +1,17 @@
+/*
+ * Host build replacement of <avr/sleep.h>
+ */
+
+#ifndef AVR_SLEEP_H
+#define AVR_SLEEP_H
+
+#include "hal.h"
+
+#define SLEEP_MODE_IDLE 0
+
+#define set_sleep_mode(MODE) do { } while (0)
+#define sleep_enable() do { } while (0)
+#define sleep_disable() do { } while (0)
+#define sleep_cpu() hal_sleep_cpu()
+
+#endif
@@ -0,0 +1,10 @@
+/*
+ * Host build replacement of <avr/wdt.h>
+ */
+
+#ifndef AVR_WDT_H
+#define AVR_WDT_H
+
+#define wdt_disable() do { } while (0)
+
+#endif
@@ -0,0 +1,26 @@
+/*
+ * Host build replacement of <util/crc16.h>
+ */
+
+#ifndef UTIL_CRC16_H
+#define UTIL_CRC16_H
+
+#include <stdint.h>
+
+/* CRC-8 with the CCITT polynomial (0x07) */
+static inline uint8_t _crc8_ccitt_update(uint8_t crc, uint8_t data)
+{
+	crc ^= data;
+
+	for (uint8_t bit = 0 ; bit < 8 ; bit += 1) {
+		if (crc & 0x80) {
+			crc = (crc << 1) ^ 0x07;
+		} else {
+			crc <<= 1;
+		}
+	}
+
+	return crc;
+}
+
+#endif
@@ -0,0 +1,20 @@
+/*
+ * Host build replacement of <util/delay.h>; the delays use the virtual clock.
+ */
+
+#ifndef UTIL_DELAY_H
+#define UTIL_DELAY_H
+
+#include "hal.h"
+
+static inline void _delay_us(double us)
+{
+	hal_delay_us(us);
+}
+
+static inline void _delay_ms(double ms)
+{
+	hal_delay_us(ms * 1000);
+}
+
+#endif
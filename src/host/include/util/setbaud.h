@@ -0,0 +1,24 @@
+/*
+ * Host build replacement of <util/setbaud.h>: computes the UBRR value for
+ * BAUD, using the double speed mode if the error is more than 2% otherwise.
+ */
+
+#ifndef UTIL_SETBAUD_H
+#define UTIL_SETBAUD_H
+
+#define UBRR_VALUE_1X (((F_CPU) + 8UL * (BAUD)) / (16UL * (BAUD)) - 1UL)
+#define UBRR_VALUE_2X (((F_CPU) + 4UL * (BAUD)) / (8UL * (BAUD)) - 1UL)
+
+#if (100 * (F_CPU) > (16 * (UBRR_VALUE_1X + 1)) * (100 * (BAUD) + (BAUD) * 2)) || \
+	(100 * (F_CPU) < (16 * (UBRR_VALUE_1X + 1)) * (100 * (BAUD) - (BAUD) * 2))
+#define USE_2X 1
+#define UBRR_VALUE UBRR_VALUE_2X
+#else
+#define USE_2X 0
+#define UBRR_VALUE UBRR_VALUE_1X
+#endif
+
+#define UBRRL_VALUE (UBRR_VALUE & 0xFF)
+#define UBRRH_VALUE (UBRR_VALUE >> 8)
+
+#endif
@@ -0,0 +1,125 @@
+/*
+ * Trace replayer (host build only)
+ *
+ * This program runs in place of an automation program, and sends the reports
+ * of a trace file (see trace.h) to the USB interface, which outputs them with
+ * the same timings as in the recorded run. The cycle length is set to one
+ * report interval, so the timings are kept within 8 ms; the reports that
+ * lasted less than that (with a fast poll rate) are skipped.
+ *
+ * The USB interface outputs neutral data until the first update, so the
+ * replay starts at the first report that is not the initial neutral one: it
+ * is sent shortly before the poll where it was recorded, and each report is
+ * then output for the cycles up to the next one. A replayed trace then has
+ * the same reports at the same times, unless its first report change happens
+ * before the end of the initialization of the link (the replay then starts
+ * late, with a warning).
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "automation.h"
+#include "hal.h"
+#include "trace.h"
+
+/* Duration of a cycle, in µs */
+#define CYCLE_US 8000
+
+/* Maximum number of cycles of a send_update_hold call */
+#define MAX_HOLD_CYCLES 32767
+
+/* Time between sending the first report and the poll where it is output, in
+   µs: the USB interface prepares each report one poll ahead, so the update
+   must reach it between one and two cycles before */
+#define FIRST_REPORT_LEAD_US (CYCLE_US * 3 / 2)
+
+/* Report output by the USB interface before the first update */
+static const uint8_t neutral_report[TRACE_REPORT_SIZE] = {
+	0, 0, DP_NEUTRAL, 128, 128, 128, 128, 0,
+};
+
+/* Static functions */
+static void replay_report(const uint8_t report[TRACE_REPORT_SIZE],
+	uint32_t cycles);
+
+
+int main(void)
+{
+	struct trace trace;
+
+	if (hal_argc != 1) {
+		fprintf(stderr, "The trace file to replay must be specified\n");
+		return 2;
+	}
+
+	if (!trace_open(&trace, hal_argv[0])) {
+		return 1;
+	}
+
+	/* The neutral update makes the USB interface switch to the new cycle
+	   length before the replay starts */
+	init_automation();
+	set_cycle_length(1);
+	pause_automation();
+
+	/* The replay starts at the first report that is not the initial neutral
+	   one; each report is output until the cycle closest to the time of the
+	   next one */
+	const struct trace_header* header = trace.header;
+	uint64_t first = 0;
+
+	if ((header->record_count > 1) && (memcmp(trace.records[0].report,
+			neutral_report, TRACE_REPORT_SIZE) == 0)) {
+		first = 1;
+	}
+
+	uint64_t start_us = (header->record_count > 0) ?
+		trace.records[first].time_us : 0;
+	uint64_t now_us = hal_time_us();
+	uint64_t cycle = 0;
+
+	if (now_us + FIRST_REPORT_LEAD_US <= start_us) {
+		hal_delay_us(start_us - FIRST_REPORT_LEAD_US - now_us);
+	} else if (header->record_count > 0) {
+		fprintf(stderr, "The replay starts %llu µs late\n",
+			(unsigned long long)(now_us + FIRST_REPORT_LEAD_US - start_us));
+	}
+
+	for (uint64_t idx = first ; idx < header->record_count ; idx += 1) {
+		uint64_t end_us = (idx + 1 < header->record_count) ?
+			trace.records[idx + 1].time_us : header->duration_us;
+		uint64_t end_cycle = (end_us - start_us + CYCLE_US / 2) / CYCLE_US;
+
+		if (end_cycle > cycle) {
+			replay_report(trace.records[idx].report, end_cycle - cycle);
+			cycle = end_cycle;
+		}
+	}
+
+	pause_automation();
+	trace_close(&trace);
+
+	return 0;
+}
+
+
+/*
+ * Send a report to be output for the specified number of cycles.
+ */
+void replay_report(const uint8_t report[TRACE_REPORT_SIZE],
+	uint32_t cycles)
+{
+	enum button_state buttons = report[0] | (report[1] << 8);
+	enum d_pad_state d_pad = report[2];
+	struct stick_coord l_stick = S_COORD(report[3], report[4]);
+	struct stick_coord r_stick = S_COORD(report[5], report[6]);
+
+	while (cycles > 0) {
+		uint16_t hold_cycles = (cycles > MAX_HOLD_CYCLES) ? MAX_HOLD_CYCLES :
+			cycles;
+
+		send_update_hold(buttons, d_pad, l_stick, r_stick, hold_cycles);
+		cycles -= hold_cycles;
+	}
+}
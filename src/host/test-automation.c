@@ -0,0 +1,591 @@
+/*
+ * Tests of the automation library (host build only)
+ *
+ * This program runs in place of an automation program, and runs the test
+ * given as its argument (tools/test_host.py runs all of them). The tests send
+ * updates and button sequences, and check the reports received by the USB
+ * host; the program returns 0 if the test passes.
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include <util/delay.h>
+
+#include "automation.h"
+#include "script.h"
+#include "hal.h"
+
+/* Maximum number of report changes recorded */
+#define MAX_CHANGES 4096
+
+/* Duration of a cycle, with the default cycle length and USB host poll
+   interval, in µs */
+#define CYCLE_US 40000
+
+/* Report change received by the USB host */
+struct report_change {
+	uint64_t time_us;
+	uint8_t report[8];
+};
+
+/* Expected report change: buttons, D-pad, and number of cycles until the next
+   change (0 to not check it) */
+struct expected_change {
+	enum button_state buttons;
+	enum d_pad_state d_pad;
+	uint32_t cycles;
+};
+
+/* Test, and its name on the command line */
+struct test {
+	const char* name;
+	bool (*run)(void);
+};
+
+/* Sub-sequences of the tests calling them */
+enum test_subsequence {
+	PRESS_B,
+	PRESS_X_B_Y,
+	RECURSE,
+	UNTERMINATED_LOOP,
+};
+
+static const struct button_d_pad_state PROGMEM press_b_P[] = {
+	{ BT_B, DP_NEUTRAL, SEQ_HOLD, 1 },
+	{ BT_NONE, DP_NEUTRAL, SEQ_HOLD, 1 },
+};
+
+static const struct button_d_pad_state PROGMEM press_x_b_y_P[] = {
+	{ BT_X, DP_NEUTRAL, SEQ_HOLD, 1 },
+	SEQ_CALL(PRESS_B),
+	{ BT_Y, DP_NEUTRAL, SEQ_HOLD, 1 },
+};
+
+static const struct button_d_pad_state PROGMEM recurse_P[] = {
+	{ BT_A, DP_NEUTRAL, SEQ_HOLD, 1 },
+	SEQ_CALL(RECURSE),
+};
+
+static const struct button_d_pad_state PROGMEM unterminated_loop_P[] = {
+	SEQ_LOOP(2),
+	{ BT_A, DP_NEUTRAL, SEQ_HOLD, 1 },
+};
+
+static const struct subsequence PROGMEM test_subsequences_P[] = {
+	[PRESS_B] = SUBSEQUENCE(press_b_P),
+	[PRESS_X_B_Y] = SUBSEQUENCE(press_x_b_y_P),
+	[RECURSE] = SUBSEQUENCE(recurse_P),
+	[UNTERMINATED_LOOP] = SUBSEQUENCE(unterminated_loop_P),
+};
+
+/* Scripts called by the script tests */
+static const uint8_t PROGMEM press_b_script[] = {
+	SC_PRESS(BT_B, DP_NEUTRAL),
+	SC_END,
+};
+
+static const uint8_t* const PROGMEM test_subscripts[] = {
+	press_b_script,
+};
+
+/* Report changes received since the start of the test */
+static struct report_change changes[MAX_CHANGES];
+static size_t change_count;
+
+/* Static functions */
+static void record_report(uint64_t time_us, const uint8_t* report);
+static void stop_output(void);
+static bool check_changes(size_t first, const struct expected_change expected[],
+	size_t expected_count);
+static bool compare_changes(size_t first, size_t other_first, size_t count);
+static bool send_alternating_steps(size_t count);
+static bool test_queue_many_messages(void);
+static bool test_retransmit(void);
+static bool test_link_lost(void);
+static bool test_play_sequence(void);
+static bool test_play_control_step(void);
+static bool test_sequence_nested_loops(void);
+static bool test_sequence_empty_loop(void);
+static bool test_sequence_calls(void);
+static bool test_sequence_stack_overflow(void);
+static bool test_sequence_bad_call(void);
+static bool test_sequence_unterminated_loop(void);
+static bool test_script_bad_call(void);
+static bool test_script_bad_d_pad(void);
+
+/* Available tests */
+static const struct test tests[] = {
+	{ "queue-many-messages", test_queue_many_messages },
+	{ "retransmit", test_retransmit },
+	{ "link-lost", test_link_lost },
+	{ "play-sequence", test_play_sequence },
+	{ "play-control-step", test_play_control_step },
+	{ "sequence-nested-loops", test_sequence_nested_loops },
+	{ "sequence-empty-loop", test_sequence_empty_loop },
+	{ "sequence-calls", test_sequence_calls },
+	{ "sequence-stack-overflow", test_sequence_stack_overflow },
+	{ "sequence-bad-call", test_sequence_bad_call },
+	{ "sequence-unterminated-loop", test_sequence_unterminated_loop },
+	{ "script-bad-call", test_script_bad_call },
+	{ "script-bad-d-pad", test_script_bad_d_pad },
+};
+
+
+int main(void)
+{
+	if (hal_argc != 1) {
+		fprintf(stderr, "The test to run must be specified\n");
+		return 2;
+	}
+
+	for (size_t idx = 0 ; idx < sizeof(tests) / sizeof(tests[0]) ; idx += 1) {
+		if (strcmp(hal_argv[0], tests[idx].name) == 0) {
+			hal_report_hook = record_report;
+			init_automation();
+
+			bool passed = tests[idx].run();
+			printf("Test %s: %s\n", tests[idx].name, passed ? "passed" : "FAILED");
+
+			return passed ? 0 : 1;
+		}
+	}
+
+	fprintf(stderr, "Unknown test %s\n", hal_argv[0]);
+	return 2;
+}
+
+
+/*
+ * Record a report change received by the USB host.
+ */
+void record_report(uint64_t time_us, const uint8_t* report)
+{
+	if (change_count < MAX_CHANGES) {
+		changes[change_count].time_us = time_us;
+		memcpy(changes[change_count].report, report, sizeof(changes[0].report));
+	}
+
+	change_count += 1;
+}
+
+
+/*
+ * Send neutral data, and wait until the USB host receives it.
+ */
+void stop_output(void)
+{
+	pause_automation();
+	_delay_ms(CYCLE_US / 1000);
+}
+
+
+/*
+ * Check the buttons, the D-pad and the duration of the report changes
+ * received from the specified one. Prints the first difference, if any.
+ */
+bool check_changes(size_t first, const struct expected_change expected[],
+	size_t expected_count)
+{
+	if ((change_count - first != expected_count) || (change_count > MAX_CHANGES)) {
+		printf("%zu report changes received, %zu expected\n",
+			change_count - first, expected_count);
+		return false;
+	}
+
+	for (size_t idx = 0 ; idx < expected_count ; idx += 1) {
+		const struct report_change* change = &changes[first + idx];
+		enum button_state buttons = change->report[0] | (change->report[1] << 8);
+
+		if ((buttons != expected[idx].buttons) ||
+				(change->report[2] != expected[idx].d_pad)) {
+			printf("Report change %zu: buttons %04x, D-pad %u; expected %04x, %u\n",
+				idx, buttons, change->report[2], expected[idx].buttons,
+				expected[idx].d_pad);
+			return false;
+		}
+
+		if ((expected[idx].cycles != 0) && ((idx + 1 == expected_count) ||
+				(change[1].time_us - change->time_us !=
+				expected[idx].cycles * CYCLE_US))) {
+			printf("Report change %zu: lasted %llu µs; expected %lu cycles\n", idx,
+				(idx + 1 < expected_count) ?
+				(unsigned long long)(change[1].time_us - change->time_us) : 0ULL,
+				(unsigned long)expected[idx].cycles);
+			return false;
+		}
+	}
+
+	return true;
+}
+
+
+/*
+ * Check that the report changes received from the specified ones are the same,
+ * with the same durations. Prints the first difference, if any.
+ */
+bool compare_changes(size_t first, size_t other_first, size_t count)
+{
+	if (change_count > MAX_CHANGES) {
+		printf("Too many report changes received\n");
+		return false;
+	}
+
+	for (size_t idx = 0 ; idx < count ; idx += 1) {
+		const struct report_change* change = &changes[first + idx];
+		const struct report_change* other = &changes[other_first + idx];
+
+		if (memcmp(change->report, other->report, sizeof(change->report)) != 0) {
+			printf("Report change %zu: buttons %02x%02x, D-pad %u; expected %02x%02x, %u\n",
+				idx, change->report[1], change->report[0], change->report[2],
+				other->report[1], other->report[0], other->report[2]);
+			return false;
+		}
+
+		if ((idx + 1 < count) && (change[1].time_us - change->time_us !=
+				other[1].time_us - other->time_us)) {
+			printf("Report change %zu: lasted %llu µs; expected %llu µs\n", idx,
+				(unsigned long long)(change[1].time_us - change->time_us),
+				(unsigned long long)(other[1].time_us - other->time_us));
+			return false;
+		}
+	}
+
+	return true;
+}
+
+
+/*
+ * Send a sequence of steps alternating between A and B, held for 1 to 3
+ * cycles, and check the reports.
+ */
+bool send_alternating_steps(size_t count)
+{
+	struct button_d_pad_state sequence[count];
+	struct expected_change expected[count + 1];
+
+	for (size_t idx = 0 ; idx < count ; idx += 1) {
+		enum button_state buttons = (idx % 2 == 0) ? BT_A : BT_B;
+
+		sequence[idx] = (struct button_d_pad_state){ buttons, DP_NEUTRAL, SEQ_HOLD,
+			(idx % 3) + 1 };
+		expected[idx] = (struct expected_change){ buttons, DP_NEUTRAL, (idx % 3) + 1 };
+	}
+	expected[count] = (struct expected_change){ BT_NONE, DP_NEUTRAL, 0 };
+
+	size_t first = change_count;
+	send_button_sequence(sequence, count);
+	stop_output();
+
+	return check_changes(first, expected, count + 1);
+}
+
+
+/*
+ * Queue more messages than the transmit buffer can hold at once: a sequence
+ * of identical steps, which only take a few bytes each.
+ */
+bool test_queue_many_messages(void)
+{
+	struct button_d_pad_state sequence[102];
+
+	sequence[0] = (struct button_d_pad_state){ BT_A, DP_NEUTRAL, SEQ_HOLD, 1 };
+	for (size_t idx = 1 ; idx <= 100 ; idx += 1) {
+		sequence[idx] = (struct button_d_pad_state){ BT_NONE, DP_NEUTRAL, SEQ_HOLD, 1 };
+	}
+	sequence[101] = (struct button_d_pad_state){ BT_B, DP_NEUTRAL, SEQ_HOLD, 1 };
+
+	size_t first = change_count;
+	send_button_sequence(sequence, 102);
+	stop_output();
+
+	static const struct expected_change expected[] = {
+		{ BT_A, DP_NEUTRAL, 1 },
+		{ BT_NONE, DP_NEUTRAL, 100 },
+		{ BT_B, DP_NEUTRAL, 1 },
+		{ BT_NONE, DP_NEUTRAL, 0 },
+	};
+
+	return check_changes(first, expected, sizeof(expected) / sizeof(expected[0]));
+}
+
+
+/*
+ * Send updates while bytes are corrupted or dropped on the serial link (see
+ * tools/test_host.py): the messages are sent again without changing the
+ * reports.
+ */
+bool test_retransmit(void)
+{
+	if (!send_alternating_steps(60)) {
+		return false;
+	}
+
+	struct link_stats stats = get_link_stats();
+	printf("Link errors: %u NAKs, %u invalid bytes received, %u retransmits\n",
+		stats.naks, stats.rx_errors, stats.retransmits);
+
+	return (stats.naks > 0) && (stats.retransmits > 0);
+}
+
+
+/*
+ * Send updates while the serial link stops working after an error (see
+ * tools/test_host.py): the main µC waits forever for the USB µC, which
+ * outputs neutral data after a while.
+ */
+bool test_link_lost(void)
+{
+	send_alternating_steps(60);
+
+	printf("The link error was not detected\n");
+	return false;
+}
+
+
+/*
+ * Play a button sequence on the USB µC, over several chunks, and check that
+ * the reports are the same as when the main µC sends it: held, mashed and
+ * skipped steps, D-pad states, and holds needing the high bits of the
+ * repeat count.
+ */
+bool test_play_sequence(void)
+{
+	struct button_d_pad_state sequence[40];
+
+	for (size_t idx = 0 ; idx < 40 ; idx += 1) {
+		sequence[idx] = (struct button_d_pad_state){
+			(idx % 2 == 0) ? BT_A : BT_NONE,
+			(idx % 5 == 0) ? (enum d_pad_state)(idx % 8) : DP_NEUTRAL,
+			(idx % 7 == 3) ? SEQ_MASH : SEQ_HOLD,
+			(idx % 4) + 1 };
+	}
+	sequence[10].repeat_count = 0;
+	sequence[17] = (struct button_d_pad_state){ BT_X | BT_Y, DP_LEFT, SEQ_MASH, 300 };
+	sequence[25].repeat_count = 2047;
+	sequence[32].repeat_count = 1000;
+
+	size_t sent_first = change_count;
+	send_button_sequence(sequence, 40);
+	stop_output();
+
+	size_t played_first = change_count;
+	play_button_sequence(sequence, 40);
+	stop_output();
+
+	size_t played_count = change_count - played_first;
+	if (played_count != played_first - sent_first) {
+		printf("%zu report changes received, %zu expected\n", played_count,
+			played_first - sent_first);
+		return false;
+	}
+
+	return compare_changes(played_first, sent_first, played_count);
+}
+
+
+/*
+ * Play a button sequence containing a control step on the USB µC: the main µC
+ * enters panic mode (see tools/test_host.py).
+ */
+bool test_play_control_step(void)
+{
+	struct button_d_pad_state sequence[] = {
+		{ BT_A, DP_NEUTRAL, SEQ_HOLD, 1 },
+		SEQ_LOOP(2),
+		{ BT_B, DP_NEUTRAL, SEQ_HOLD, 1 },
+		SEQ_END_LOOP,
+	};
+
+	play_button_sequence(sequence, sizeof(sequence) / sizeof(sequence[0]));
+
+	printf("The control step was not rejected\n");
+	return false;
+}
+
+
+/*
+ * Send a sequence with nested loops.
+ */
+bool test_sequence_nested_loops(void)
+{
+	size_t first = change_count;
+	SEND_BUTTON_SEQUENCE(
+		{ BT_A, DP_NEUTRAL, SEQ_HOLD, 1 },
+		SEQ_LOOP(2),
+			{ BT_B, DP_NEUTRAL, SEQ_HOLD, 1 },
+			SEQ_LOOP(3),
+				{ BT_X, DP_NEUTRAL, SEQ_HOLD, 1 },
+				{ BT_NONE, DP_NEUTRAL, SEQ_HOLD, 1 },
+			SEQ_END_LOOP,
+		SEQ_END_LOOP,
+		{ BT_Y, DP_NEUTRAL, SEQ_HOLD, 2 },
+	);
+	stop_output();
+
+	static const struct expected_change expected[] = {
+		{ BT_A, DP_NEUTRAL, 1 },
+		{ BT_B, DP_NEUTRAL, 1 },
+		{ BT_X, DP_NEUTRAL, 1 }, { BT_NONE, DP_NEUTRAL, 1 },
+		{ BT_X, DP_NEUTRAL, 1 }, { BT_NONE, DP_NEUTRAL, 1 },
+		{ BT_X, DP_NEUTRAL, 1 }, { BT_NONE, DP_NEUTRAL, 1 },
+		{ BT_B, DP_NEUTRAL, 1 },
+		{ BT_X, DP_NEUTRAL, 1 }, { BT_NONE, DP_NEUTRAL, 1 },
+		{ BT_X, DP_NEUTRAL, 1 }, { BT_NONE, DP_NEUTRAL, 1 },
+		{ BT_X, DP_NEUTRAL, 1 }, { BT_NONE, DP_NEUTRAL, 1 },
+		{ BT_Y, DP_NEUTRAL, 2 },
+		{ BT_NONE, DP_NEUTRAL, 0 },
+	};
+
+	return check_changes(first, expected, sizeof(expected) / sizeof(expected[0]));
+}
+
+
+/*
+ * Send a sequence with a loop repeated 0 times, containing a nested loop: it
+ * is skipped.
+ */
+bool test_sequence_empty_loop(void)
+{
+	size_t first = change_count;
+	SEND_BUTTON_SEQUENCE(
+		{ BT_A, DP_NEUTRAL, SEQ_HOLD, 1 },
+		SEQ_LOOP(0),
+			{ BT_B, DP_NEUTRAL, SEQ_HOLD, 1 },
+			SEQ_LOOP(2),
+				{ BT_X, DP_NEUTRAL, SEQ_HOLD, 1 },
+			SEQ_END_LOOP,
+		SEQ_END_LOOP,
+		{ BT_Y, DP_NEUTRAL, SEQ_HOLD, 1 },
+	);
+	stop_output();
+
+	static const struct expected_change expected[] = {
+		{ BT_A, DP_NEUTRAL, 1 },
+		{ BT_Y, DP_NEUTRAL, 1 },
+		{ BT_NONE, DP_NEUTRAL, 0 },
+	};
+
+	return check_changes(first, expected, sizeof(expected) / sizeof(expected[0]));
+}
+
+
+/*
+ * Send a sequence calling sub-sequences, from a loop and from another
+ * sub-sequence.
+ */
+bool test_sequence_calls(void)
+{
+	size_t first = change_count;
+	SEND_BUTTON_SEQUENCE_CALLS(test_subsequences_P,
+		{ BT_A, DP_NEUTRAL, SEQ_HOLD, 1 },
+		SEQ_LOOP(2),
+			SEQ_CALL(PRESS_X_B_Y),
+		SEQ_END_LOOP,
+		SEQ_CALL(PRESS_B),
+		{ BT_A, DP_NEUTRAL, SEQ_HOLD, 1 },
+	);
+	stop_output();
+
+	static const struct expected_change expected[] = {
+		{ BT_A, DP_NEUTRAL, 1 },
+		{ BT_X, DP_NEUTRAL, 1 }, { BT_B, DP_NEUTRAL, 1 },
+		{ BT_NONE, DP_NEUTRAL, 1 }, { BT_Y, DP_NEUTRAL, 1 },
+		{ BT_X, DP_NEUTRAL, 1 }, { BT_B, DP_NEUTRAL, 1 },
+		{ BT_NONE, DP_NEUTRAL, 1 }, { BT_Y, DP_NEUTRAL, 1 },
+		{ BT_B, DP_NEUTRAL, 1 }, { BT_NONE, DP_NEUTRAL, 1 },
+		{ BT_A, DP_NEUTRAL, 1 },
+		{ BT_NONE, DP_NEUTRAL, 0 },
+	};
+
+	return check_changes(first, expected, sizeof(expected) / sizeof(expected[0]));
+}
+
+
+/*
+ * Send a sequence nesting more loops and calls than SEQ_STACK_SIZE: the main
+ * µC enters panic mode (see tools/test_host.py).
+ */
+bool test_sequence_stack_overflow(void)
+{
+	SEND_BUTTON_SEQUENCE_CALLS(test_subsequences_P,
+		SEQ_LOOP(2),
+			SEQ_CALL(RECURSE),
+		SEQ_END_LOOP,
+	);
+
+	printf("The stack overflow was not detected\n");
+	return false;
+}
+
+
+/*
+ * Send a sequence calling a sub-sequence outside of the table: the main µC
+ * enters panic mode (see tools/test_host.py).
+ */
+bool test_sequence_bad_call(void)
+{
+	SEND_BUTTON_SEQUENCE_CALLS(test_subsequences_P,
+		{ BT_A, DP_NEUTRAL, SEQ_HOLD, 1 },
+		SEQ_CALL(UNTERMINATED_LOOP + 1),
+	);
+
+	printf("The call outside of the table was not detected\n");
+	return false;
+}
+
+
+/*
+ * Send a sequence calling a sub-sequence that ends inside a loop: the main µC
+ * enters panic mode (see tools/test_host.py).
+ */
+bool test_sequence_unterminated_loop(void)
+{
+	SEND_BUTTON_SEQUENCE_CALLS(test_subsequences_P,
+		SEQ_CALL(UNTERMINATED_LOOP),
+		{ BT_B, DP_NEUTRAL, SEQ_HOLD, 1 },
+		SEQ_END_LOOP,
+	);
+
+	printf("The unterminated loop was not detected\n");
+	return false;
+}
+
+
+/*
+ * Run a script calling a script outside of the table: the main µC enters
+ * panic mode (see tools/test_host.py).
+ */
+bool test_script_bad_call(void)
+{
+	static const uint8_t PROGMEM script[] = {
+		SC_CALL(0),
+		SC_CALL(1),
+		SC_END,
+	};
+
+	run_script(script, test_subscripts,
+		sizeof(test_subscripts) / sizeof(*test_subscripts), 0);
+
+	printf("The call outside of the table was not detected\n");
+	return false;
+}
+
+
+/*
+ * Run a script pressing a button with an invalid D-pad direction: the main µC
+ * enters panic mode (see tools/test_host.py).
+ */
+bool test_script_bad_d_pad(void)
+{
+	static const uint8_t PROGMEM script[] = {
+		SC_PRESS(BT_A, DP_NEUTRAL),
+		SC_PRESS(BT_A, DP_NEUTRAL + 1),
+		SC_END,
+	};
+
+	run_script(script, NULL, 0, 0);
+
+	printf("The invalid D-pad direction was not detected\n");
+	return false;
+}
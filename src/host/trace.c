@@ -0,0 +1,248 @@
+/*
+ * USB report trace files: writing, and reading through a memory mapping.
+ * The host build only supports little-endian computers, which is checked at
+ * compile time.
+ */
+
+#define _XOPEN_SOURCE 700
+
+#include "trace.h"
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+_Static_assert(__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__,
+	"Trace files are little-endian");
+_Static_assert(sizeof(struct trace_header) == 48, "Unexpected header size");
+_Static_assert(sizeof(struct trace_record) == 16, "Unexpected record size");
+
+
+/* Trace being written */
+struct trace_writer {
+	FILE* file;
+	const char* path;
+	struct trace_header header;
+
+	/* Last recorded report (valid if header.record_count > 0) */
+	uint8_t last_report[TRACE_REPORT_SIZE];
+
+	/* Seek index, and its allocated size */
+	uint64_t* index;
+	uint32_t index_capacity;
+};
+
+
+/* Static functions */
+static bool extend_index(struct trace_writer* writer, uint64_t time_us);
+
+
+struct trace_writer* trace_create(const char* path, uint32_t poll_interval_us)
+{
+	struct trace_writer* writer = calloc(1, sizeof(*writer));
+	if (writer == NULL) {
+		return NULL;
+	}
+
+	writer->file = fopen(path, "wb");
+	if (writer->file == NULL) {
+		fprintf(stderr, "Unable to create the trace file %s\n", path);
+		free(writer);
+		return NULL;
+	}
+
+	writer->path = path;
+	memcpy(writer->header.magic, TRACE_MAGIC, sizeof(writer->header.magic));
+	writer->header.version = TRACE_VERSION;
+	writer->header.record_size = sizeof(struct trace_record);
+	writer->header.poll_interval_us = poll_interval_us;
+	writer->header.index_interval_us = TRACE_INDEX_INTERVAL_US;
+
+	/* The header is written again once complete */
+	if (fwrite(&writer->header, sizeof(writer->header), 1, writer->file) != 1) {
+		fprintf(stderr, "Unable to write the trace file %s\n", path);
+		fclose(writer->file);
+		free(writer);
+		return NULL;
+	}
+
+	return writer;
+}
+
+
+bool trace_write(struct trace_writer* writer, uint64_t time_us,
+	const uint8_t report[TRACE_REPORT_SIZE])
+{
+	if ((writer->header.record_count > 0) &&
+			(memcmp(report, writer->last_report, TRACE_REPORT_SIZE) == 0)) {
+		return true;
+	}
+
+	if (!extend_index(writer, time_us)) {
+		return false;
+	}
+
+	struct trace_record record;
+	memset(&record, 0, sizeof(record));
+	record.time_us = time_us;
+	memcpy(record.report, report, TRACE_REPORT_SIZE);
+
+	if (fwrite(&record, sizeof(record), 1, writer->file) != 1) {
+		return false;
+	}
+
+	memcpy(writer->last_report, report, TRACE_REPORT_SIZE);
+	writer->header.record_count += 1;
+	return true;
+}
+
+
+bool trace_finish(struct trace_writer* writer, uint64_t duration_us)
+{
+	bool success = extend_index(writer, duration_us);
+
+	writer->header.duration_us = duration_us;
+	writer->header.index_offset = sizeof(writer->header) +
+		writer->header.record_count * sizeof(struct trace_record);
+
+	success = success && (fwrite(writer->index, sizeof(uint64_t),
+		writer->header.index_count, writer->file) ==
+		writer->header.index_count);
+	success = success && (fseek(writer->file, 0, SEEK_SET) == 0);
+	success = success &&
+		(fwrite(&writer->header, sizeof(writer->header), 1, writer->file) == 1);
+
+	if (fclose(writer->file) != 0) {
+		success = false;
+	}
+
+	if (!success) {
+		fprintf(stderr, "Unable to write the trace file %s\n", writer->path);
+	}
+
+	free(writer->index);
+	free(writer);
+	return success;
+}
+
+
+bool trace_open(struct trace* trace, const char* path)
+{
+	memset(trace, 0, sizeof(*trace));
+
+	int fd = open(path, O_RDONLY);
+	if (fd < 0) {
+		fprintf(stderr, "Unable to open the trace file %s\n", path);
+		return false;
+	}
+
+	struct stat st;
+	if ((fstat(fd, &st) != 0) ||
+			((size_t)st.st_size < sizeof(struct trace_header))) {
+		fprintf(stderr, "Invalid trace file %s\n", path);
+		close(fd);
+		return false;
+	}
+
+	trace->map_size = st.st_size;
+	trace->map = mmap(NULL, trace->map_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+
+	if (trace->map == MAP_FAILED) {
+		fprintf(stderr, "Unable to map the trace file %s\n", path);
+		return false;
+	}
+
+	/* The counts are checked against the file size before computing the
+	   sizes, which cannot overflow then */
+	const struct trace_header* header = trace->map;
+	if ((memcmp(header->magic, TRACE_MAGIC, sizeof(header->magic)) != 0) ||
+			(header->version != TRACE_VERSION) ||
+			(header->record_size != sizeof(struct trace_record)) ||
+			(header->index_interval_us == 0) ||
+			(header->record_count > (trace->map_size - sizeof(*header)) /
+				sizeof(struct trace_record)) ||
+			(header->index_offset < sizeof(*header) +
+				header->record_count * sizeof(struct trace_record)) ||
+			(header->index_offset > trace->map_size) ||
+			(header->index_offset % sizeof(uint64_t) != 0) ||
+			(header->index_count > (trace->map_size - header->index_offset) /
+				sizeof(uint64_t)) ||
+			(header->index_count <=
+				header->duration_us / header->index_interval_us)) {
+		fprintf(stderr, "Invalid trace file %s\n", path);
+		trace_close(trace);
+		return false;
+	}
+
+	trace->header = header;
+	trace->records = (const struct trace_record*)(header + 1);
+	trace->index = (const uint64_t*)((const uint8_t*)trace->map +
+		header->index_offset);
+	return true;
+}
+
+
+void trace_close(struct trace* trace)
+{
+	if ((trace->map != NULL) && (trace->map != MAP_FAILED)) {
+		munmap(trace->map, trace->map_size);
+	}
+
+	memset(trace, 0, sizeof(*trace));
+}
+
+
+uint64_t trace_seek(const struct trace* trace, uint64_t time_us)
+{
+	const struct trace_header* header = trace->header;
+	uint64_t slot = time_us / header->index_interval_us;
+
+	if (slot >= header->index_count) {
+		slot = header->index_count - 1;
+	}
+
+	/* The index gives the records before the start of the interval; the
+	   following ones within the interval are scanned */
+	uint64_t next = trace->index[slot];
+	while ((next < header->record_count) &&
+			(trace->records[next].time_us <= time_us)) {
+		next += 1;
+	}
+
+	return (next > 0) ? next - 1 : header->record_count;
+}
+
+
+/*
+ * Add the seek index entries up to the specified time (included), which is
+ * the time of the next record or the end of the run.
+ */
+bool extend_index(struct trace_writer* writer, uint64_t time_us)
+{
+	struct trace_header* header = &writer->header;
+
+	while ((uint64_t)header->index_count * header->index_interval_us <=
+			time_us) {
+		if (header->index_count == writer->index_capacity) {
+			uint32_t capacity = writer->index_capacity ?
+				2 * writer->index_capacity : 4096;
+			uint64_t* index = realloc(writer->index, capacity * sizeof(*index));
+			if (index == NULL) {
+				return false;
+			}
+
+			writer->index = index;
+			writer->index_capacity = capacity;
+		}
+
+		writer->index[header->index_count] = header->record_count;
+		header->index_count += 1;
+	}
+
+	return true;
+}
@@ -0,0 +1,104 @@
+/*
+ * USB report trace files
+ *
+ * A trace contains the USB reports received by the virtual host during a run
+ * of the host build. It is made of a header, followed by fixed-size records
+ * (one for each poll whose report differs from the previous one), followed by
+ * a seek index. All values are little-endian, and every part is aligned, so
+ * the file can be mapped in memory and used directly:
+ *
+ *  - header (struct trace_header, 48 bytes);
+ *  - header.record_count records (struct trace_record, 16 bytes each): time of
+ *    the poll in µs since the start of the run, then the 8-byte report;
+ *  - header.index_count index entries (uint64_t) at header.index_offset:
+ *    entry N is the number of records whose time is before
+ *    N * header.index_interval_us.
+ *
+ * The report at any time is then found by reading the index entry of that
+ * time, and scanning the records of one index interval at most.
+ */
+
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+/* Magic value at the start of a trace file, and format version */
+#define TRACE_MAGIC "HIDTRACE"
+#define TRACE_VERSION 1
+
+/* Size of a USB report */
+#define TRACE_REPORT_SIZE 8
+
+/* Interval between the seek index entries, in µs */
+#define TRACE_INDEX_INTERVAL_US 1000000
+
+/* Trace file header */
+struct trace_header {
+	char magic[8]; /* TRACE_MAGIC, without the terminating null character */
+	uint16_t version; /* TRACE_VERSION */
+	uint16_t record_size; /* Size of a record */
+	uint32_t poll_interval_us; /* Interval between the host polls */
+	uint64_t record_count; /* Number of records */
+	uint64_t duration_us; /* Duration of the run */
+	uint64_t index_offset; /* Offset of the seek index in the file */
+	uint32_t index_interval_us; /* Interval between the index entries */
+	uint32_t index_count; /* Number of index entries */
+};
+
+/* Trace record: a report, and the time it was first received */
+struct trace_record {
+	uint64_t time_us;
+	uint8_t report[TRACE_REPORT_SIZE];
+};
+
+/* Trace being written */
+struct trace_writer;
+
+/* Trace file mapped in memory */
+struct trace {
+	const struct trace_header* header;
+	const struct trace_record* records;
+	const uint64_t* index;
+	void* map;
+	size_t map_size;
+};
+
+/*
+ * Create a trace file. Returns NULL (after printing an error) if it cannot be
+ * created.
+ */
+struct trace_writer* trace_create(const char* path, uint32_t poll_interval_us);
+
+/*
+ * Add a report received at the specified time (not before the previous one);
+ * it is only recorded if it differs from the previous report. Returns false
+ * on a write error.
+ */
+bool trace_write(struct trace_writer* writer, uint64_t time_us,
+	const uint8_t report[TRACE_REPORT_SIZE]);
+
+/*
+ * Complete the trace file (the run lasted for the specified time), and close
+ * it. Returns false on a write error.
+ */
+bool trace_finish(struct trace_writer* writer, uint64_t duration_us);
+
+/*
+ * Map a trace file in memory. Returns false (after printing an error) if it
+ * cannot be read or is invalid.
+ */
+bool trace_open(struct trace* trace, const char* path);
+
+/* Unmap a trace file */
+void trace_close(struct trace* trace);
+
+/*
+ * Returns the index of the record of the report at the specified time, or
+ * header->record_count if it is before the first record.
+ */
+uint64_t trace_seek(const struct trace* trace, uint64_t time_us);
+
+#endif
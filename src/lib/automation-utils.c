@@ -3,16 +3,39 @@
  */
 
 #include "automation-utils.h"
+#include "automation-utils.seq.h"
+
+
+/* Sub-sequences of the clock settings */
+enum clock_subsequence {
+	OPEN_DATE_TIME_SETTINGS,
+};
+
+/* Open the Date and Time settings, from the main menu */
+static const struct button_d_pad_state PROGMEM date_time_settings_P[] = {
+	{ BT_NONE,		DP_BOTTOM,	SEQ_HOLD,	1  },	/* Switch Online button or News button (< v11) */
+	{ BT_NONE,		DP_RIGHT,	SEQ_MASH,	6  },	/* Sleep button */
+	{ BT_NONE,		DP_LEFT,	SEQ_MASH,	1  },	/* Settings button */
+	{ BT_A,			DP_NEUTRAL,	SEQ_HOLD,	1  },	/* Enter settings */
+	{ BT_NONE,		DP_NEUTRAL,	SEQ_HOLD,	20 },	/* Wait for settings */
+	{ BT_NONE,		DP_BOTTOM,	SEQ_MASH,	14 },	/* Console settings */
+	{ BT_NONE,		DP_RIGHT,	SEQ_MASH,	1  },	/* Update console button */
+	{ BT_NONE,		DP_NEUTRAL,	SEQ_HOLD,	5  },	/* Wait for cursor */
+	{ BT_NONE,		DP_BOTTOM,	SEQ_MASH,	4  },	/* Date/time */
+	{ BT_A,			DP_NEUTRAL,	SEQ_HOLD,	1  },	/* Enter date/time */
+	{ BT_NONE,		DP_NEUTRAL,	SEQ_HOLD,	5  },	/* Wait date/time menu */
+};
+
+static const struct subsequence PROGMEM clock_subsequences_P[] = {
+	[OPEN_DATE_TIME_SETTINGS] = SUBSEQUENCE(date_time_settings_P),
+};
 
 
 /* Perform controller switching */
 void switch_controller(enum switch_mode mode)
 {
 	if (mode == REAL_TO_VIRT) {
-		SEND_BUTTON_SEQUENCE(
-			{ BT_L,			DP_NEUTRAL,	SEQ_HOLD,	1  },	/* Reconnect the controller */
-			{ BT_NONE,		DP_NEUTRAL,	SEQ_HOLD,	10 },	/* Wait for reconnection */
-		);
+		SEND_RECONNECT_CONTROLLER();
 	} else {
 		go_to_main_menu();
 	}
@@ -20,27 +43,10 @@ void switch_controller(enum switch_mode mode)
 	/* In both cases, the controller is now connected, the main menu is shown, and the
 	   cursor is on the game icon */
 
-	SEND_BUTTON_SEQUENCE(
-		{ BT_NONE,		DP_BOTTOM,	SEQ_HOLD,	1  },	/* Switch Online button or News button (< v11) */
-		{ BT_NONE,		DP_RIGHT,	SEQ_MASH,	6  },	/* Sleep button */
-		{ BT_NONE,		DP_LEFT,	SEQ_MASH,	2  },	/* Controllers button */
-		{ BT_A,			DP_NEUTRAL,	SEQ_HOLD,	1  },	/* Enter controllers settings */
-		{ BT_NONE,		DP_NEUTRAL,	SEQ_HOLD,	10 },	/* Wait for settings */
-
-		/* Enter change style/order, validating any “interrupt local comm” message */
-		{ BT_A,			DP_NEUTRAL,	SEQ_MASH,	16 },
-		{ BT_NONE,		DP_NEUTRAL,	SEQ_HOLD,	50 },	/* Wait for “Press L/R” menu */
-	);
+	SEND_OPEN_CHANGE_GRIP_ORDER();
 
 	if (mode == REAL_TO_VIRT) {
-		SEND_BUTTON_SEQUENCE(
-			{ BT_A,			DP_NEUTRAL,	SEQ_HOLD,	1  },	/* Register as controller 1 */
-			{ BT_NONE,		DP_NEUTRAL,	SEQ_HOLD,	15 },	/* Wait for registration */
-
-			{ BT_H,			DP_NEUTRAL,	SEQ_HOLD,	2  },	/* Return to the main menu */
-			{ BT_NONE,		DP_NEUTRAL,	SEQ_HOLD,	25 },	/* Wait for the main menu */
-		);
-
+		SEND_REGISTER_CONTROLLER();
 		go_to_game();
 	}
 }
@@ -49,20 +55,14 @@ void switch_controller(enum switch_mode mode)
 /* Go to the main menu, from the currently playing game or menu. */
 void go_to_main_menu(void)
 {
-	SEND_BUTTON_SEQUENCE(
-		{ BT_H,			DP_NEUTRAL,	SEQ_HOLD,	2  },	/* Go to main menu */
-		{ BT_NONE,		DP_NEUTRAL,	SEQ_HOLD,	25 },	/* Wait for the main menu */
-	);
+	SEND_GO_TO_MAIN_MENU();
 }
 
 
 /* Go back to the game, from the main menu. */
 void go_to_game(void)
 {
-	SEND_BUTTON_SEQUENCE(
-		{ BT_H,			DP_NEUTRAL,	SEQ_HOLD,	2  },	/* Go back to the game */
-		{ BT_NONE,		DP_NEUTRAL,	SEQ_HOLD,	40 },	/* Wait for the game */
-	);
+	SEND_GO_TO_GAME();
 }
 
 
@@ -73,18 +73,8 @@ void set_clock_to_manual_from_any(bool in_game)
 		go_to_main_menu();
 	}
 
-	SEND_BUTTON_SEQUENCE(
-		{ BT_NONE,		DP_BOTTOM,	SEQ_HOLD,	1  },	/* Switch Online button or News button (< v11) */
-		{ BT_NONE,		DP_RIGHT,	SEQ_MASH,	6  },	/* Sleep button */
-		{ BT_NONE,		DP_LEFT,	SEQ_MASH,	1  },	/* Settings button */
-		{ BT_A,			DP_NEUTRAL,	SEQ_HOLD,	1  },	/* Enter settings */
-		{ BT_NONE,		DP_NEUTRAL,	SEQ_HOLD,	20 },	/* Wait for settings */
-		{ BT_NONE,		DP_BOTTOM,	SEQ_MASH,	14 },	/* Console settings */
-		{ BT_NONE,		DP_RIGHT,	SEQ_MASH,	1  },	/* Update console button */
-		{ BT_NONE,		DP_NEUTRAL,	SEQ_HOLD,	5  },	/* Wait for cursor */
-		{ BT_NONE,		DP_BOTTOM,	SEQ_MASH,	4  },	/* Date/time */
-		{ BT_A,			DP_NEUTRAL,	SEQ_HOLD,	1  },	/* Enter date/time */
-		{ BT_NONE,		DP_NEUTRAL,	SEQ_HOLD,	5  },	/* Wait date/time menu */
+	SEND_BUTTON_SEQUENCE_CALLS(clock_subsequences_P,
+		SEQ_CALL(OPEN_DATE_TIME_SETTINGS),
 		{ BT_NONE,		DP_BOTTOM,	SEQ_MASH,	2  },	/* TZ if auto/time set if man */
 		{ BT_NONE,		DP_TOP,		SEQ_MASH,	1  },	/* auto/man if auto, TZ if man */
 		{ BT_A,			DP_NEUTRAL,	SEQ_MASH,	1  },	/* Set man if auto, else enter TZ */
@@ -107,18 +97,8 @@ void set_clock_to_auto_from_manual(bool in_game)
 		go_to_main_menu();
 	}
 
-	SEND_BUTTON_SEQUENCE(
-		{ BT_NONE,		DP_BOTTOM,	SEQ_HOLD,	1  },	/* Switch Online button or News button (< v11) */
-		{ BT_NONE,		DP_RIGHT,	SEQ_MASH,	6  },	/* Sleep button */
-		{ BT_NONE,		DP_LEFT,	SEQ_MASH,	1  },	/* Settings button */
-		{ BT_A,			DP_NEUTRAL,	SEQ_HOLD,	1  },	/* Enter settings */
-		{ BT_NONE,		DP_NEUTRAL,	SEQ_HOLD,	20 },	/* Wait for settings */
-		{ BT_NONE,		DP_BOTTOM,	SEQ_MASH,	14 },	/* Console settings */
-		{ BT_NONE,		DP_RIGHT,	SEQ_MASH,	1  },	/* Update console button */
-		{ BT_NONE,		DP_NEUTRAL,	SEQ_HOLD,	5  },	/* Wait for cursor */
-		{ BT_NONE,		DP_BOTTOM,	SEQ_MASH,	4  },	/* Date/time */
-		{ BT_A,			DP_NEUTRAL,	SEQ_HOLD,	1  },	/* Enter date/time */
-		{ BT_NONE,		DP_NEUTRAL,	SEQ_HOLD,	5  },	/* Wait date/time menu */
+	SEND_BUTTON_SEQUENCE_CALLS(clock_subsequences_P,
+		SEQ_CALL(OPEN_DATE_TIME_SETTINGS),
 		{ BT_A,			DP_NEUTRAL,	SEQ_MASH,	1  },	/* Set to automatic */
 	);
 
@@ -150,24 +130,20 @@ void change_clock_year(bool in_game, int8_t offset)
 		go_to_main_menu();
 	}
 
-	SEND_BUTTON_SEQUENCE(
-		{ BT_NONE,		DP_BOTTOM,	SEQ_HOLD,	1  },	/* Switch Online button or News button (< v11) */
-		{ BT_NONE,		DP_RIGHT,	SEQ_MASH,	6  },	/* Sleep button */
-		{ BT_NONE,		DP_LEFT,	SEQ_MASH,	1  },	/* Settings button */
-		{ BT_A,			DP_NEUTRAL,	SEQ_HOLD,	1  },	/* Enter settings */
-		{ BT_NONE,		DP_NEUTRAL,	SEQ_HOLD,	20 },	/* Wait for settings */
-		{ BT_NONE,		DP_BOTTOM,	SEQ_MASH,	14 },	/* Console settings */
-		{ BT_NONE,		DP_RIGHT,	SEQ_MASH,	1  },	/* Update console button */
-		{ BT_NONE,		DP_NEUTRAL,	SEQ_HOLD,	5  },	/* Wait for cursor */
-		{ BT_NONE,		DP_BOTTOM,	SEQ_MASH,	4  },	/* Date/time */
-		{ BT_A,			DP_NEUTRAL,	SEQ_HOLD,	1  },	/* Enter date/time */
-		{ BT_NONE,		DP_NEUTRAL,	SEQ_HOLD,	5  },	/* Wait date/time menu */
+	SEND_BUTTON_SEQUENCE_CALLS(clock_subsequences_P,
+		SEQ_CALL(OPEN_DATE_TIME_SETTINGS),
 		{ BT_NONE,		DP_BOTTOM,	SEQ_MASH,	2  },	/* Time set */
 		{ BT_A,			DP_NEUTRAL,	SEQ_MASH,	1  },	/* Enter time set */
 		{ BT_NONE,		DP_NEUTRAL,	SEQ_HOLD,	2  },	/* Wait for menu */
 		{ BT_NONE,		DP_RIGHT,	SEQ_MASH,	2  },	/* Go to year */
 		{ BT_NONE,		DP_NEUTRAL,	SEQ_HOLD,	2  },	/* Wait for cursor */
+	);
+
+	SEND_BUTTON_SEQUENCE_RAM(
 		{ BT_NONE,		button,		SEQ_MASH,	num },	/* Change year */
+	);
+
+	SEND_BUTTON_SEQUENCE(
 		{ BT_A,			DP_NEUTRAL,	SEQ_MASH,	4  },	/* Go to OK and click it */
 		{ BT_NONE,		DP_NEUTRAL,	SEQ_HOLD,	2  },	/* Wait for menu */
 	);
@@ -1,10 +1,33 @@
 #include "automation.h"
 
 #include "common.h" /* Must be included before setbaud.h (defines BAUD) */
+#include "bench.h"
+
+#include <string.h>
 
 #include <avr/io.h>
+#include <avr/interrupt.h>
+#include <avr/sleep.h>
+#include <avr/pgmspace.h>
 #include <util/setbaud.h>
 #include <util/delay.h>
+#include <util/crc16.h>
+
+
+/* Size of the serial link transmit ring buffer (power of 2, at most 256); it
+   must be able to hold two sequence chunk messages, and the other messages
+   the USB µC can queue. One byte is always left free, so a full buffer is
+   not mistaken for an empty one. */
+#define TX_BUFFER_SIZE 256
+
+/* Maximum number of retransmit queries sent while recovering from a
+   transmission error; the USB µC may need to receive the rest of a sequence
+   chunk before it responds. */
+#define MAX_RETRANSMIT_QUERIES 80
+
+/* Number of consecutive recoveries without any message accepted by the USB µC
+   after which the link is considered broken */
+#define MAX_FAILED_RECOVERIES 8
 
 
 /* Data to send to the USB µC */
@@ -17,6 +40,83 @@ static struct {
 } sent_data;
 _Static_assert(sizeof(sent_data) == DATA_SIZE, "Incorrect sent data size");
 
+/* Data of the last message queued for the USB µC; the next message only
+   contains the controller data fields that changed since then */
+static uint8_t prev_sent_data[DATA_SIZE];
+
+/* Offsets of the controller data fields in sent_data, in the order of their
+   UPDATE_* header bits; the last entry is the end of the last field. */
+static const uint8_t field_offsets[] = { 0, 2, 3, 5, 7 };
+
+/* Transmit ring buffer; contains complete messages (with their trailer), each
+   preceded by its size. The messages that were sent are kept until they are
+   known to be accepted by the USB µC, so they can be sent again after a
+   transmission error. The indexes are free-running and masked on access. */
+static volatile uint8_t tx_buffer[TX_BUFFER_SIZE];
+static volatile uint8_t tx_head; /* Write index, updated by queue_raw_message */
+static volatile uint8_t tx_tail; /* Read index, updated by the UDRE ISR */
+static volatile uint8_t tx_ack_tail; /* Oldest message not known as accepted */
+
+/* Sequence number of the message at tx_ack_tail, and of the next message to
+   be queued */
+static volatile uint8_t tx_ack_seq;
+static uint8_t tx_next_seq;
+
+/* Number of messages sent and not known as accepted (between tx_ack_tail and
+   tx_tail) */
+static volatile uint8_t tx_unconfirmed;
+
+/* Number of data updates the USB µC is ready to accept (received 'R'). Once
+   all sent updates are output by the USB µC, it is FRAME_QUEUE_SIZE. */
+static volatile uint8_t tx_credits;
+
+/* Number of sequence chunks the USB µC is ready to accept (received 'C') */
+static volatile uint8_t seq_credits;
+
+/* Remaining bytes of the message currently being sent */
+static volatile uint8_t tx_frame_remaining;
+
+/* True if a transmission error was detected and the link must be recovered */
+static volatile bool link_error;
+
+/* Number of consecutive recoveries without any message accepted */
+static uint8_t failed_recoveries;
+
+/* Transmission error counters */
+static struct link_stats link_stats;
+
+/* Last host poll interval measurements reported by the USB µC */
+static volatile struct host_poll_stats host_poll_stats;
+
+/* Nested loop or call of a sequence: loop start and remaining iterations, or
+   return position (remaining is 0), with the end of the enclosing sequence */
+struct sequence_frame {
+	const uint8_t* pos;
+	const uint8_t* end;
+	uint16_t remaining;
+};
+
+/* Static functions */
+static void sleep_until_interrupt(void);
+static void re_sync(void);
+static void negotiate_link_speed(void);
+static uint8_t send_sync_query(uint8_t query_byte);
+static void queue_message(uint16_t repeat);
+static void queue_raw_message(const uint8_t* message, uint8_t size);
+static void recover_link(void);
+static void start_link_recovery(void);
+static void confirm_oldest_message(void);
+static bool is_poll_report(uint8_t received);
+static void send_sequence(const void* sequence, size_t sequence_length,
+	const struct subsequence subsequences[], uint8_t subsequence_count,
+	bool with_sticks, bool in_flash);
+static const uint8_t* skip_loop(const uint8_t* pos, const uint8_t* end,
+	uint8_t step_size, bool in_flash);
+static void play_sequence(const struct button_d_pad_state sequence[],
+	size_t sequence_length, bool in_flash);
+static void load_step(void* step, const void* src, size_t size,
+	bool in_flash);
+
 /*
  * Init the automation: sets up the serial link to the USB µC,
  * and initializes the controller state with default data.
@@ -47,51 +147,149 @@ bool init_automation(void)
 	sent_data.r_stick = S_NEUTRAL;
 	sent_data.magic_and_leds = MAGIC_VALUE;
 
+	/* The USB µC starts with the same data after a sync */
+	memcpy(prev_sent_data, &sent_data, DATA_SIZE);
+
 	/* Wait 12 ms for initial ready signal */
+	bool initial_sync = false;
+
 	_delay_ms(12);
 	if (bit_is_set(UCSR0A, RXC0)) {
-		/* Retrieve ready signal byte */
+		/* Retrieve ready signal byte. A frame error may happen if the USB µC
+		   is still using a faster link speed negotiated before the reset. */
+		bool frame_error = bit_is_set(UCSR0A, FE0);
 		uint8_t received = UDR0;
+
 		if (received == INIT_SYNC_CHAR) {
 			/* Initial sync done */
-			return true;
-		}
+			initial_sync = true;
 
-		if (received != READY_FOR_DATA_CHAR) {
+		} else if (!frame_error && (received != READY_FOR_DATA_CHAR) &&
+				(received != NAK_CHAR) && !is_poll_report(received)) {
 			/* Invalid character received */
 			panic(1);
 		}
 
-		/* READY_FOR_DATA_CHAR has been received; this may happen depending on
-		   the timing. Continue with the resync procedure. */
+		/* READY_FOR_DATA_CHAR, NAK_CHAR or a poll interval report may be
+		   received depending on the timing. The resync procedure will be
+		   performed in that case. */
+	}
+
+	if (!initial_sync) {
+		re_sync();
+	}
+
+	/* The link is now synchronized at the initial speed; switch to a faster
+	   one if possible. */
+	negotiate_link_speed();
+
+	/* From now on, the serial link is handled by interrupts */
+	set_sleep_mode(SLEEP_MODE_IDLE);
+	UCSR0B |= _BV(RXCIE0);
+	sei();
+
+	return initial_sync;
+}
+
+
+/*
+ * Perform the resync procedure with the USB µC, at the current link speed.
+ */
+void re_sync(void)
+{
+	uint8_t received = send_sync_query(RE_SYNC_QUERY_BYTE);
+
+	if (received == RE_SYNC_CHAR) {
+		/* Re-sync done */
+		return;
+	}
+
+	if (received != 0) {
+		/* Invalid character received */
+		panic(2);
+	}
+
+	/* Failed to resync, the USB µC is probably hung up */
+	panic(3);
+}
+
+
+/*
+ * Negotiate a faster link speed with the USB µC. The link must be
+ * synchronized. If the USB µC does not support any faster speed, the link
+ * stays at the initial speed.
+ */
+void negotiate_link_speed(void)
+{
+	for (int8_t speed = LINK_SPEED_PREFERRED ; speed >= 0 ; speed -= 1) {
+		uint8_t received = send_sync_query(LINK_SPEED_QUERY_BYTE | speed);
+
+		if (received == LINK_SPEED_ACK_CHAR) {
+			/* The USB µC has switched to the new speed; do the same */
+			UBRR0 = (F_CPU / 8 / LINK_SPEED_BAUD(speed)) - 1;
+			UCSR0A |= _BV(U2X0);
+			return;
+		}
+
+		if (received != RE_SYNC_CHAR) {
+			/* The USB µC does not understand speed change queries, and
+			   probably entered panic mode after receiving one. Re-sync with it
+			   (which exits panic mode) and keep the initial speed. */
+			re_sync();
+			return;
+		}
+
+		/* The USB µC refused the speed; try the next slower one */
 	}
+}
+
+
+/*
+ * Repetitively send a sync query byte to the USB µC, until it responds or
+ * enough bytes were sent to complete the message it may be receiving.
+ * Returns the received response, or 0 if the USB µC did not respond.
+ */
+uint8_t send_sync_query(uint8_t query_byte)
+{
+	/* The query bytes may complete a message, which will then be invalid; the
+	   USB µC then needs several query bytes to re-sync. If it was using a
+	   faster link speed, the first query bytes are also lost while it goes
+	   back to the initial speed, which is handled the same way. */
+	const uint8_t max_tries = MAX_MESSAGE_SIZE + MESSAGE_TRAILER_SIZE +
+		ERROR_RE_SYNC_QUERY_COUNT;
 
-	for (uint8_t tries = 0 ; tries < DATA_SIZE ; tries += 1) {
-		/* Send resync request */
+	for (uint8_t tries = 0 ; tries < max_tries ; tries += 1) {
+		/* Send query */
 		loop_until_bit_is_set(UCSR0A, UDRE0);
-		UDR0 = RE_SYNC_QUERY_BYTE;
+		UDR0 = query_byte;
 
-		/* Wait for response */
-		_delay_ms(5);
+		/* Wait up to 5 ms for response. The wait is done in small steps, so
+		   the link speed can be changed right after the USB µC acknowledges
+		   it, before it sends anything at the new speed. */
+		for (uint16_t wait = 0 ; wait < 500 ; wait += 1) {
+			if (bit_is_set(UCSR0A, RXC0)) {
+				/* The USB µC may signal it is ready for data before handling
+				   the query, signal an invalid message, report the host poll
+				   interval, or send garbage before going back to the initial
+				   link speed; ignore it */
+				bool frame_error = bit_is_set(UCSR0A, FE0);
+				uint8_t received = UDR0;
 
-		if (bit_is_set(UCSR0A, RXC0)) {
-			/* Retrieve resync signal byte */
-			uint8_t received = UDR0;
-			if (received == RE_SYNC_CHAR) {
-				/* Re-sync done */
-				return false;
+				if (!frame_error && (received != READY_FOR_DATA_CHAR) &&
+						(received != SEQUENCE_READY_CHAR) &&
+						(received != NAK_CHAR) && !is_poll_report(received)) {
+					return received;
+				}
 			}
 
-			/* Invalid character received */
-			panic(2);
+			_delay_us(10);
 		}
 
 		/* No response yet, the USB µC receive buffer may be not full yet;
-		   continue resync */
+		   continue sending the query */
 	}
 
-	/* Failed to resync, the USB µC is probably hung up */
-	panic(3);
+	return 0;
 }
 
 
@@ -125,15 +323,79 @@ void send_update(enum button_state buttons, enum d_pad_state d_pad,
 }
 
 
+/* Send an update with new button/controller state, held for several cycles */
+void send_update_hold(enum button_state buttons, enum d_pad_state d_pad,
+	struct stick_coord l_stick, struct stick_coord r_stick, uint16_t cycles)
+{
+	if (cycles == 0) {
+		return;
+	}
+
+	if (cycles > UPDATE_REPEAT_MAX) {
+		cycles = UPDATE_REPEAT_MAX;
+	}
+
+	sent_data.buttons = buttons;
+	sent_data.d_pad = d_pad;
+	sent_data.l_stick = l_stick;
+	sent_data.r_stick = r_stick;
+
+	queue_message(cycles);
+	wait_send_completed();
+}
+
+
+/* Queue an update with new button/controller state, held or mashed */
+void queue_update(enum button_state buttons, enum d_pad_state d_pad,
+	struct stick_coord l_stick, struct stick_coord r_stick, uint16_t cycles,
+	enum seq_mode mode)
+{
+	if (cycles == 0) {
+		return;
+	}
+
+	if (cycles > UPDATE_REPEAT_MAX) {
+		cycles = UPDATE_REPEAT_MAX;
+	}
+
+	sent_data.buttons = buttons;
+	sent_data.d_pad = d_pad;
+	sent_data.l_stick = l_stick;
+	sent_data.r_stick = r_stick;
+
+	if (mode == SEQ_MASH) {
+		queue_message(cycles | UPDATE_REPEAT_MASH);
+
+		/* Keep the state that will be output at the end */
+		sent_data.buttons = BT_NONE;
+		sent_data.d_pad = DP_NEUTRAL;
+	} else {
+		queue_message(cycles);
+	}
+}
+
+
 /* Send button press followed by a release. */
 void send_buttons(enum button_state buttons, enum d_pad_state d_pad,
 	uint8_t repeat_count)
 {
-	while (repeat_count > 0) {
-		send_update(buttons, d_pad, S_NEUTRAL, S_NEUTRAL);
-		send_update(BT_NONE, DP_NEUTRAL, S_NEUTRAL, S_NEUTRAL);
-		repeat_count -= 1;
+	if (repeat_count == 0) {
+		return;
 	}
+
+	/* The USB µC does the press/release alternation on its own */
+	sent_data.buttons = buttons;
+	sent_data.d_pad = d_pad;
+	sent_data.l_stick = S_NEUTRAL;
+	sent_data.r_stick = S_NEUTRAL;
+
+	queue_message(repeat_count | UPDATE_REPEAT_MASH);
+
+	/* Keep the state that will be output at the end */
+	sent_data.buttons = BT_NONE;
+	sent_data.d_pad = DP_NEUTRAL;
+
+	wait_updates_output();
 }
 
 
@@ -141,51 +403,494 @@ void send_buttons(enum button_state buttons, enum d_pad_state d_pad,
 void send_button_sequence(const struct button_d_pad_state sequence[],
 	size_t sequence_length)
 {
-	for (size_t pos = 0 ; pos < sequence_length ; pos += 1) {
-		const struct button_d_pad_state* cur = &sequence[pos];
+	send_sequence(sequence, sequence_length, NULL, 0, false, false);
+}
+
+
+/* Send a button sequence stored in program memory */
+void send_button_sequence_P(const struct button_d_pad_state sequence[],
+	size_t sequence_length)
+{
+	send_sequence(sequence, sequence_length, NULL, 0, false, true);
+}
 
-		uint16_t repeat_count = cur->repeat_count;
-		enum seq_mode mode = cur->mode;
 
-		while (repeat_count > 0) {
-			sent_data.buttons = cur->buttons;
-			sent_data.d_pad = cur->d_pad;
+/* Send a button sequence stored in program memory, calling sub-sequences */
+void send_button_sequence_calls_P(const struct button_d_pad_state sequence[],
+	size_t sequence_length, const struct subsequence subsequences[],
+	uint8_t subsequence_count)
+{
+	send_sequence(sequence, sequence_length, subsequences, subsequence_count,
+		false, true);
+}
 
-			send_current();
 
-			if (mode == SEQ_MASH) {
-				sent_data.buttons = BT_NONE;
-				sent_data.d_pad = DP_NEUTRAL;
-				send_current();
-			}
+/* Send a button sequence moving the sticks */
+void send_sticks_sequence(const struct button_sticks_state sequence[],
+	size_t sequence_length)
+{
+	send_sequence(sequence, sequence_length, NULL, 0, true, false);
+}
 
-			repeat_count -= 1;
-		}
+
+/* Send a button sequence moving the sticks stored in program memory */
+void send_sticks_sequence_P(const struct button_sticks_state sequence[],
+	size_t sequence_length)
+{
+	send_sequence(sequence, sequence_length, NULL, 0, true, true);
+}
+
+
+/* Upload a button sequence to the USB µC, which plays it on its own */
+void play_button_sequence(const struct button_d_pad_state sequence[],
+	size_t sequence_length)
+{
+	play_sequence(sequence, sequence_length, false);
+}
+
+
+/* Upload a button sequence stored in program memory to the USB µC */
+void play_button_sequence_P(const struct button_d_pad_state sequence[],
+	size_t sequence_length)
+{
+	play_sequence(sequence, sequence_length, true);
+}
+
+
+/* Set the number of USB reports per cycle for the next updates */
+void set_cycle_length(uint8_t length)
+{
+	if (length == 0) {
+		length = DEFAULT_CYCLE_LENGTH;
+	} else if (length > MAX_CYCLE_LENGTH) {
+		length = MAX_CYCLE_LENGTH;
 	}
+
+	const uint8_t message[] = {
+		CYCLE_LENGTH_HEADER | (length - 1),
+		sent_data.magic_and_leds,
+	};
+
+	queue_raw_message(message, sizeof(message));
 }
 
 
 /* Send an update with the current state */
 void send_current(void)
 {
-	/* Wait for ready signal for USB µC */
-	loop_until_bit_is_set(UCSR0A, RXC0);
+	send_current_async();
+	wait_send_completed();
+}
 
-	/* Retrieve ready signal byte */
-	uint8_t received = UDR0;
-	if (received != READY_FOR_DATA_CHAR) {
+
+/* Queue an update with the current state, without waiting for it to be sent */
+void send_current_async(void)
+{
+	queue_message(1);
+}
+
+
+/*
+ * Queue a message with the current state, which the USB µC will output for
+ * the specified number of cycles (possibly with the UPDATE_REPEAT_MASH flag).
+ */
+void queue_message(uint16_t repeat)
+{
+	/* Build the message, with only the fields that changed */
+	const uint8_t* cur_sent_data = (const uint8_t*)&sent_data;
+	uint8_t message[MAX_MESSAGE_SIZE];
+	uint8_t header = UPDATE_HEADER;
+	uint8_t size = 1;
+
+	for (uint8_t field = 0 ; field < sizeof(field_offsets) - 1 ; field += 1) {
+		uint8_t offset = field_offsets[field];
+		uint8_t field_size = field_offsets[field + 1] - offset;
+
+		if (memcmp(cur_sent_data + offset, prev_sent_data + offset, field_size) != 0) {
+			header |= (1 << field);
+			memcpy(message + size, cur_sent_data + offset, field_size);
+			size += field_size;
+		}
+	}
+
+	if (repeat != 1) {
+		header |= UPDATE_REPEAT;
+		message[size] = repeat & 0xFF;
+		message[size + 1] = repeat >> 8;
+		size += 2;
+	}
+
+	if (header == UPDATE_HEADER) {
+		/* Nothing changed; the magic value alone repeats the previous data */
+		size = 0;
+	} else {
+		message[0] = header;
+	}
+
+	message[size] = sent_data.magic_and_leds;
+	size += 1;
+
+	memcpy(prev_sent_data, cur_sent_data, DATA_SIZE);
+
+	queue_raw_message(message, size);
+}
+
+
+/* Queue a message for sending to the USB µC, adding its trailer */
+void queue_raw_message(const uint8_t* message, uint8_t size)
+{
+	/* Wait for room in the transmit buffer for the message, its trailer and
+	   its size, leaving one byte free */
+	for (;;) {
+		cli();
+		if (TX_BUFFER_SIZE - (uint8_t)(tx_head - tx_ack_tail) >
+				size + MESSAGE_TRAILER_SIZE + 1) {
+			break;
+		}
+
+		sleep_until_interrupt();
+	}
+
+	sei();
+
+	/* Copy the message after the write index; the ISR will only see it once
+	   the write index is updated. */
+	uint8_t head = tx_head;
+	uint8_t crc = 0;
+
+	tx_buffer[head & (TX_BUFFER_SIZE - 1)] = size + MESSAGE_TRAILER_SIZE;
+	head += 1;
+
+	for (uint8_t idx = 0 ; idx < size ; idx += 1) {
+		tx_buffer[head & (TX_BUFFER_SIZE - 1)] = message[idx];
+		crc = _crc8_ccitt_update(crc, message[idx]);
+		head += 1;
+	}
+
+	tx_buffer[head & (TX_BUFFER_SIZE - 1)] = tx_next_seq;
+	crc = _crc8_ccitt_update(crc, tx_next_seq);
+	head += 1;
+
+	tx_buffer[head & (TX_BUFFER_SIZE - 1)] = crc;
+	head += 1;
+
+	tx_next_seq = (tx_next_seq + 1) & MESSAGE_SEQUENCE_MASK;
+	tx_head = head;
+
+	/* Start sending if the USB µC is ready (and no transmission error is
+	   waiting to be recovered) */
+	cli();
+	if (!link_error) {
+		UCSR0B |= _BV(UDRIE0);
+	}
+	sei();
+}
+
+
+/* Returns true once all queued updates have been sent */
+bool send_completed(void)
+{
+	return (tx_head == tx_tail) && (tx_frame_remaining == 0);
+}
+
+
+/* Wait for all queued updates to be sent */
+void wait_send_completed(void)
+{
+	for (;;) {
+		cli();
+		if (send_completed()) {
+			break;
+		}
+
+		sleep_until_interrupt();
+	}
+
+	sei();
+}
+
+
+/* Wait for the USB µC to output all the sent updates */
+void wait_updates_output(void)
+{
+	for (;;) {
+		cli();
+		if (send_completed() && (tx_credits == FRAME_QUEUE_SIZE)) {
+			break;
+		}
+
+		sleep_until_interrupt();
+	}
+
+	sei();
+}
+
+
+/* Returns the last host poll interval measurements */
+struct host_poll_stats get_host_poll_stats(void)
+{
+	cli();
+	struct host_poll_stats stats = host_poll_stats;
+	sei();
+
+	return stats;
+}
+
+
+/* Returns the transmission error counters */
+struct link_stats get_link_stats(void)
+{
+	cli();
+	struct link_stats stats = link_stats;
+	sei();
+
+	return stats;
+}
+
+
+/*
+ * Put the CPU to sleep until an interrupt is handled. Must be called with
+ * interrupts disabled, after checking the wake-up condition; interrupts are
+ * enabled when this function returns. If a transmission error was detected,
+ * the link is recovered instead; the wake-up condition must then be checked
+ * again.
+ */
+void sleep_until_interrupt(void)
+{
+	if (link_error) {
+		recover_link();
+		sei();
+		return;
+	}
+
+	sleep_enable();
+
+	/* The instruction following sei is always executed before any pending
+	   interrupt, so an interrupt happening after the wake-up condition was
+	   checked will wake up the CPU. */
+	sei();
+	sleep_cpu();
+
+	sleep_disable();
+}
+
+
+/*
+ * Recover from a transmission error: ask the USB µC for the sequence number of
+ * the next message it expects, and send the messages again from that one.
+ * Must be called with interrupts disabled. The serial link is handled by
+ * polling during the recovery.
+ */
+void recover_link(void)
+{
+	UCSR0B &= ~(_BV(RXCIE0) | _BV(UDRIE0));
+	link_error = false;
+
+	/* Send retransmit queries until the USB µC acknowledges one. If it did not
+	   detect the error yet, it will first consider the queries as the rest of
+	   the message being received, which will be invalid. Each acknowledge
+	   revokes the ready signals received before it; after the first one, wait
+	   5 ms for the acknowledges of the queries that were still being sent. */
+	uint8_t ack = 0;
+	uint8_t queries = 0;
+	uint16_t wait = 0;
+
+	while (wait < 500) {
+		if (bit_is_set(UCSR0A, RXC0)) {
+			bool frame_error = bit_is_set(UCSR0A, FE0);
+			uint8_t received = UDR0;
+
+			if (frame_error) {
+				link_stats.rx_errors += 1;
+
+			} else if (is_poll_report(received)) {
+				/* Not needed during the recovery */
+
+			} else if (received & RETRANSMIT_ACK) {
+				ack = received;
+				tx_credits = 0;
+				seq_credits = 0;
+				wait = 0;
+
+			} else if ((ack != 0) && (received == READY_FOR_DATA_CHAR)) {
+				tx_credits += 1;
+
+			} else if ((ack != 0) && (received == SEQUENCE_READY_CHAR)) {
+				seq_credits += 1;
+			}
+
+			continue;
+		}
+
+		if ((ack == 0) && (queries < MAX_RETRANSMIT_QUERIES)) {
+			loop_until_bit_is_set(UCSR0A, UDRE0);
+			UDR0 = RETRANSMIT_QUERY_BYTE;
+			queries += 1;
+		} else {
+			_delay_us(10);
+			wait += 1;
+		}
+	}
+
+	if (ack == 0) {
+		/* The USB µC is probably hung up */
+		panic(3);
+	}
+
+	/* The messages before the expected one were accepted */
+	uint8_t accepted = (ack - tx_ack_seq) & MESSAGE_SEQUENCE_MASK;
+	if (accepted > tx_unconfirmed) {
+		/* The USB µC expects a message that was not sent */
+		panic(2);
+	}
+
+	while (accepted > 0) {
+		confirm_oldest_message();
+		accepted -= 1;
+	}
+
+	if (tx_unconfirmed == 0) {
+		/* Nothing was lost */
+		failed_recoveries = 0;
+	} else if (failed_recoveries == MAX_FAILED_RECOVERIES) {
+		/* The same message keeps being rejected */
 		panic(2);
+	} else {
+		failed_recoveries += 1;
 	}
 
-	const char* cur_sent_data = (const char*)&sent_data;
+	/* Send the other messages again */
+	link_stats.retransmits += tx_unconfirmed;
+	tx_tail = tx_ack_tail;
+	tx_unconfirmed = 0;
+	tx_frame_remaining = 0;
 
-	for (uint8_t idx = 0 ; idx < sizeof(sent_data) ; idx += 1) {
-		loop_until_bit_is_set(UCSR0A, UDRE0);
-		UDR0 = cur_sent_data[idx];
+	UCSR0B |= _BV(RXCIE0) | _BV(UDRIE0);
+}
+
+
+/*
+ * Stop sending messages after a transmission error; the link will be recovered
+ * when the main program waits for the serial link.
+ */
+void start_link_recovery(void)
+{
+	link_error = true;
+	UCSR0B &= ~_BV(UDRIE0);
+}
+
+
+/*
+ * Free the oldest message of the transmit buffer, which is known to be
+ * accepted by the USB µC.
+ */
+void confirm_oldest_message(void)
+{
+	tx_ack_tail += tx_buffer[tx_ack_tail & (TX_BUFFER_SIZE - 1)] + 1;
+	tx_ack_seq = (tx_ack_seq + 1) & MESSAGE_SEQUENCE_MASK;
+	tx_unconfirmed -= 1;
+	failed_recoveries = 0;
+}
+
+
+/* Returns true if the received byte is a host poll interval report */
+bool is_poll_report(uint8_t received)
+{
+	return ((received & POLL_INTERVAL_REPORT_MASK) == POLL_INTERVAL_REPORT) ||
+		((received & MAX_POLL_INTERVAL_REPORT_MASK) == MAX_POLL_INTERVAL_REPORT);
+}
+
+
+/* Serial link byte received */
+ISR(USART_RX_vect)
+{
+	/* The frame error flag must be read before the received byte */
+	bool frame_error = bit_is_set(UCSR0A, FE0);
+	uint8_t received = UDR0;
+
+	if (frame_error) {
+		/* The byte is garbage; it may be a lost ready signal. Recovering the
+		   link will get new ones. */
+		link_stats.rx_errors += 1;
+		start_link_recovery();
+
+	} else if ((received & POLL_INTERVAL_REPORT_MASK) == POLL_INTERVAL_REPORT) {
+		host_poll_stats.avg_interval = received & ~POLL_INTERVAL_REPORT_MASK;
+
+	} else if ((received & MAX_POLL_INTERVAL_REPORT_MASK) == MAX_POLL_INTERVAL_REPORT) {
+		host_poll_stats.max_interval = received & ~MAX_POLL_INTERVAL_REPORT_MASK;
+
+	} else if (received == READY_FOR_DATA_CHAR) {
+		/* The USB µC can accept another update; start sending it if queued.
+		   Once the USB µC has granted all its frame queue slots, each ready
+		   signal also means that the oldest message sent was taken from its
+		   frame queue. */
+		tx_credits += 1;
+		if ((uint8_t)(tx_credits + tx_unconfirmed) > FRAME_QUEUE_SIZE) {
+			confirm_oldest_message();
+		}
+
+		if (!link_error) {
+			UCSR0B |= _BV(UDRIE0);
+		}
+
+	} else if (received == SEQUENCE_READY_CHAR) {
+		/* The USB µC can accept another sequence chunk */
+		seq_credits += 1;
+
+		if (!link_error) {
+			UCSR0B |= _BV(UDRIE0);
+		}
+
+	} else if (received == NAK_CHAR) {
+		/* The USB µC received an invalid message */
+		link_stats.naks += 1;
+		start_link_recovery();
+
+	} else {
+		/* Unexpected character; it may be a corrupted ready signal */
+		link_stats.rx_errors += 1;
+		start_link_recovery();
 	}
 }
 
 
+/* Serial link ready to accept a byte to send */
+ISR(USART_UDRE_vect)
+{
+	if (tx_frame_remaining == 0) {
+		/* Start sending the next message, if there is one and the USB µC is
+		   ready to accept it. A sequence chunk also needs a free chunk
+		   buffer. */
+		if ((tx_head == tx_tail) || (tx_credits == 0)) {
+			UCSR0B &= ~_BV(UDRIE0);
+			return;
+		}
+
+		uint8_t header = tx_buffer[(uint8_t)(tx_tail + 1) & (TX_BUFFER_SIZE - 1)];
+		bool chunk = (header & SEQUENCE_CHUNK_HEADER_MASK) == SEQUENCE_CHUNK_HEADER;
+
+		if (chunk) {
+			if (seq_credits == 0) {
+				UCSR0B &= ~_BV(UDRIE0);
+				return;
+			}
+
+			seq_credits -= 1;
+		}
+
+		tx_credits -= 1;
+		tx_unconfirmed += 1;
+		tx_frame_remaining = tx_buffer[tx_tail & (TX_BUFFER_SIZE - 1)];
+		tx_tail += 1;
+	}
+
+	UDR0 = tx_buffer[tx_tail & (TX_BUFFER_SIZE - 1)];
+	tx_tail += 1;
+	tx_frame_remaining -= 1;
+}
+
+
 /* Enter panic mode */
 void panic(uint8_t mode)
 {
@@ -208,3 +913,244 @@ void panic(uint8_t mode)
 		_delay_ms(1000);
 	}
 }
+
+
+/*
+ * Send a button sequence, with or without stick positions, stored in RAM or
+ * in program memory, running its control steps. The sub-sequences table
+ * (NULL if there is none, with subsequence_count 0) and the sub-sequences are
+ * stored like the sequence.
+ */
+void send_sequence(const void* sequence, size_t sequence_length,
+	const struct subsequence subsequences[], uint8_t subsequence_count,
+	bool with_sticks, bool in_flash)
+{
+	const uint8_t step_size = with_sticks ? sizeof(struct button_sticks_state) :
+		sizeof(struct button_d_pad_state);
+	const uint8_t* pos = sequence;
+	const uint8_t* end = pos + (sequence_length * step_size);
+	struct sequence_frame stack[SEQ_STACK_SIZE];
+	uint8_t depth = 0;
+
+	for (;;) {
+		if (pos == end) {
+			/* End of the sequence, or return from a sub-sequence */
+			if (depth == 0) {
+				break;
+			}
+
+			depth -= 1;
+			if (stack[depth].remaining != 0) {
+				/* Unterminated loop */
+				panic(SEQ_PANIC_MODE);
+			}
+
+			pos = stack[depth].pos;
+			end = stack[depth].end;
+			continue;
+		}
+
+		/* The button state is the first member of the steps with sticks */
+		struct button_sticks_state step;
+		load_step(&step, pos, step_size, in_flash);
+		pos += step_size;
+
+		switch ((uint8_t)step.state.d_pad) {
+			case SEQ_CONTROL_LOOP:
+				if (step.state.buttons == 0) {
+					pos = skip_loop(pos, end, step_size, in_flash);
+					continue;
+				}
+
+				if (depth == SEQ_STACK_SIZE) {
+					panic(SEQ_PANIC_MODE);
+				}
+
+				stack[depth].pos = pos;
+				stack[depth].end = end;
+				stack[depth].remaining = step.state.buttons;
+				depth += 1;
+				continue;
+
+			case SEQ_CONTROL_END_LOOP:
+				if ((depth == 0) || (stack[depth - 1].remaining == 0)) {
+					panic(SEQ_PANIC_MODE);
+				}
+
+				stack[depth - 1].remaining -= 1;
+				if (stack[depth - 1].remaining != 0) {
+					pos = stack[depth - 1].pos;
+				} else {
+					depth -= 1;
+				}
+				continue;
+
+			case SEQ_CONTROL_CALL: {
+				if ((depth == SEQ_STACK_SIZE) ||
+						(step.state.buttons >= subsequence_count)) {
+					panic(SEQ_PANIC_MODE);
+				}
+
+				stack[depth].pos = pos;
+				stack[depth].end = end;
+				stack[depth].remaining = 0;
+				depth += 1;
+
+				/* The sub-sequence runs up to its last step */
+				struct subsequence subsequence;
+				load_step(&subsequence, &subsequences[step.state.buttons],
+					sizeof(subsequence), in_flash);
+				pos = (const uint8_t*)subsequence.steps;
+				end = pos + (subsequence.length * step_size);
+				continue;
+			}
+
+			default:
+				if ((uint8_t)step.state.d_pad > DP_NEUTRAL) {
+					/* Invalid D-pad state or control step */
+					panic(SEQ_PANIC_MODE);
+				}
+		}
+
+		uint16_t repeat = step.state.repeat_count;
+
+		if (repeat == 0) {
+			continue;
+		}
+
+		BENCH_START(BENCH_SEQUENCE_STEP);
+
+		/* Each step is a single message; the USB µC holds (or mashes) the
+		   buttons for the required number of cycles on its own. */
+		sent_data.buttons = step.state.buttons;
+		sent_data.d_pad = step.state.d_pad;
+
+		if (with_sticks) {
+			sent_data.l_stick = step.l_stick;
+			sent_data.r_stick = step.r_stick;
+		}
+
+		if (step.state.mode == SEQ_MASH) {
+			queue_message(repeat | UPDATE_REPEAT_MASH);
+
+			/* Keep the state that will be output at the end of the step (the
+			   sticks are not released) */
+			sent_data.buttons = BT_NONE;
+			sent_data.d_pad = DP_NEUTRAL;
+		} else {
+			queue_message(repeat);
+		}
+
+		BENCH_END(BENCH_SEQUENCE_STEP);
+	}
+
+	/* Return when the last step is output, like if each cycle was sent
+	   separately */
+	wait_updates_output();
+}
+
+
+/*
+ * Returns the position of the step after the end of a loop, from the position
+ * of its first step.
+ */
+const uint8_t* skip_loop(const uint8_t* pos, const uint8_t* end,
+	uint8_t step_size, bool in_flash)
+{
+	uint16_t nesting = 0;
+
+	while (pos != end) {
+		struct button_d_pad_state step;
+		load_step(&step, pos, sizeof(step), in_flash);
+		pos += step_size;
+
+		if (step.d_pad == (enum d_pad_state)SEQ_CONTROL_LOOP) {
+			nesting += 1;
+		} else if (step.d_pad == (enum d_pad_state)SEQ_CONTROL_END_LOOP) {
+			if (nesting == 0) {
+				return pos;
+			}
+
+			nesting -= 1;
+		}
+	}
+
+	/* Unterminated loop */
+	panic(SEQ_PANIC_MODE);
+}
+
+
+/*
+ * Upload a button sequence, stored in RAM or in program memory, to the USB µC.
+ */
+void play_sequence(const struct button_d_pad_state sequence[],
+	size_t sequence_length, bool in_flash)
+{
+	size_t pos = 0;
+
+	for (;;) {
+		/* Build the next chunk, skipping the empty steps */
+		uint8_t message[1 + SEQUENCE_CHUNK_STEPS * SEQUENCE_STEP_SIZE + 1];
+		uint8_t steps = 0;
+		uint8_t size = 1;
+
+		while ((pos < sequence_length) && (steps < SEQUENCE_CHUNK_STEPS)) {
+			struct button_d_pad_state step;
+			load_step(&step, &sequence[pos], sizeof(step), in_flash);
+			pos += 1;
+
+			if ((uint8_t)step.d_pad > DP_NEUTRAL) {
+				/* Control step (SEQ_LOOP, SEQ_CALL...) or invalid D-pad state;
+				   the USB µC does not run the control steps, and the 4 bits of
+				   the D-pad field of the chunk steps have no room for them */
+				panic(SEQ_PANIC_MODE);
+			}
+
+			if (step.repeat_count == 0) {
+				continue;
+			}
+
+			message[size] = step.buttons & 0xFF;
+			message[size + 1] = step.buttons >> 8;
+			message[size + 2] = step.d_pad | ((step.repeat_count >> 8) << 5);
+			message[size + 3] = step.repeat_count & 0xFF;
+
+			if (step.mode == SEQ_MASH) {
+				message[size + 2] |= SEQUENCE_STEP_MASH;
+				sent_data.buttons = BT_NONE;
+				sent_data.d_pad = DP_NEUTRAL;
+			} else {
+				sent_data.buttons = step.buttons;
+				sent_data.d_pad = step.d_pad;
+			}
+
+			size += SEQUENCE_STEP_SIZE;
+			steps += 1;
+		}
+
+		if (steps == 0) {
+			break;
+		}
+
+		message[0] = SEQUENCE_CHUNK_HEADER | (steps - 1);
+		message[size] = sent_data.magic_and_leds;
+		size += 1;
+
+		/* The chunk is only sent once the USB µC has a free chunk buffer; it
+		   frees one when the chunk before the previous one is nearly played. */
+		queue_raw_message(message, size);
+	}
+}
+
+
+/*
+ * Copy a step of a button sequence stored in RAM or in program memory.
+ */
+void load_step(void* step, const void* src, size_t size, bool in_flash)
+{
+	if (in_flash) {
+		memcpy_P(step, src, size);
+	} else {
+		memcpy(step, src, size);
+	}
+}
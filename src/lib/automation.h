@@ -2,7 +2,8 @@
  * Switch controller automation features
  *
  * The USB interface emulating the Switch controller expects new data to be
- * sent to it on each “cycle” (5 USB reports, ~40 ms when plugged to a Switch).
+ * sent to it on each “cycle” (40 ms by default, which is 5 USB reports when
+ * plugged to a Switch; see set_cycle_length).
  * The functions defined in this state allows sending new controller data at
  * the correct rate. The sent controller data also includes the state of the
  * TX and RX LEDs on the Arduino board, which are controlled by the USB
@@ -10,11 +11,14 @@
  */
 
 #ifndef AUTOMATION_H
+#define AUTOMATION_H
 
 #include <stdint.h>
 #include <stddef.h>
 #include <stdbool.h>
 
+#include <avr/pgmspace.h>
+
 /*
  * Init the automation; must be called early at program start.
  * Returns true if the USB interface was just plugged in, false if the
@@ -40,20 +44,37 @@ struct stick_coord {
    initializer lists or function calls. */
 #define S_COORD(X, Y) ((struct stick_coord){(X), (Y)})
 
+/* Return stick coordinates from an X, Y pair (one of the S_XY_ macros) */
+#define S_COORD_XY(...) S_COORD(__VA_ARGS__)
+
+/* Predefined stick coordinates, as X, Y pairs; usable in byte arrays, like the
+   scripts (see script.h) */
+#define S_XY_TOP 128, 0
+#define S_XY_TOPRIGHT 219, 37
+#define S_XY_RIGHT 255, 128
+#define S_XY_BOTRIGHT 219, 219
+#define S_XY_BOTTOM 128, 255
+#define S_XY_BOTLEFT 37, 219
+#define S_XY_LEFT 0, 128
+#define S_XY_TOPLEFT 37, 37
+#define S_XY_NEUTRAL 128, 128
+
 /* Predefined stick coordinates */
-#define S_TOP S_COORD(128, 0)
-#define S_TOPRIGHT S_COORD(219, 37)
-#define S_RIGHT S_COORD(255, 128)
-#define S_BOTRIGHT S_COORD(219, 219)
-#define S_BOTTOM S_COORD(128, 255)
-#define S_BOTLEFT S_COORD(37, 219)
-#define S_LEFT S_COORD(0, 128)
-#define S_TOPLEFT S_COORD(37, 37)
-#define S_NEUTRAL S_COORD(128, 128)
-
-/* Internal macro for coordinate scaling */
-#define S_SCALE_XY(COORD, M, VAL) \
-	(uint8_t)((((int16_t)COORD.M - 128) * VAL) / 255 + 128)
+#define S_TOP S_COORD_XY(S_XY_TOP)
+#define S_TOPRIGHT S_COORD_XY(S_XY_TOPRIGHT)
+#define S_RIGHT S_COORD_XY(S_XY_RIGHT)
+#define S_BOTRIGHT S_COORD_XY(S_XY_BOTRIGHT)
+#define S_BOTTOM S_COORD_XY(S_XY_BOTTOM)
+#define S_BOTLEFT S_COORD_XY(S_XY_BOTLEFT)
+#define S_LEFT S_COORD_XY(S_XY_LEFT)
+#define S_TOPLEFT S_COORD_XY(S_XY_TOPLEFT)
+#define S_NEUTRAL S_COORD_XY(S_XY_NEUTRAL)
+
+/* Internal macros for coordinate scaling */
+#define S_SCALE_VALUE(V, VAL) \
+	(uint8_t)((((int16_t)(V) - 128) * VAL) / 255 + 128)
+#define S_SCALE_XY(COORD, M, VAL) S_SCALE_VALUE(COORD.M, VAL)
+#define S_XY_SCALE_PAIR(VAL, X, Y) S_SCALE_VALUE(X, VAL), S_SCALE_VALUE(Y, VAL)
 
 /* Scale down the inclination of the stick, on a scale from 0 (not inclined,
    neutral position) to 255 (original value). For instance, S_TOP is the
@@ -63,6 +84,9 @@ struct stick_coord {
 #define S_SCALED(COORD, VAL) \
 	S_COORD(S_SCALE_XY(COORD, x, VAL), S_SCALE_XY(COORD, y, VAL))
 
+/* Same as S_SCALED, for an X, Y pair (one of the S_XY_ macros) */
+#define S_XY_SCALED(XY, VAL) S_XY_SCALE_PAIR(VAL, XY)
+
 /* D-pad state */
 enum d_pad_state {
     DP_TOP = 0,
@@ -108,6 +132,53 @@ struct button_d_pad_state {
 	uint16_t repeat_count : 11; /* Number of cycles (max 2047) */
 };
 
+/* Button, D-pad and sticks state, for sequence runs moving the sticks; the
+   steps are twice larger than the ones without sticks */
+struct button_sticks_state {
+	struct button_d_pad_state state; /* Buttons, D-pad, mode and cycles */
+	struct stick_coord l_stick; /* Left stick */
+	struct stick_coord r_stick; /* Right stick */
+};
+
+/*
+ * Control steps of the sequences sent by the main µC, stored in the D-pad
+ * field (after the D-pad states). Use the SEQ_ macros below.
+ */
+enum seq_control {
+	SEQ_CONTROL_LOOP = 12, /* Loop start; the buttons field is the count */
+	SEQ_CONTROL_END_LOOP = 13, /* Loop end */
+	SEQ_CONTROL_CALL = 14, /* Call; the buttons field is the sub-sequence */
+};
+
+/* Repeat the steps up to the matching SEQ_END_LOOP the specified number of
+   times (0-65535); with the repeat counts limited to 2047 cycles, this also
+   allows long holds and waits. */
+#define SEQ_LOOP(COUNT) \
+	{ (enum button_state)(COUNT), (enum d_pad_state)SEQ_CONTROL_LOOP, SEQ_HOLD, 0 }
+#define SEQ_END_LOOP \
+	{ BT_NONE, (enum d_pad_state)SEQ_CONTROL_END_LOOP, SEQ_HOLD, 0 }
+
+/* Run the sub-sequence with the specified index in the table given to
+   send_button_sequence_calls_P, up to its last step. */
+#define SEQ_CALL(INDEX) \
+	{ (enum button_state)(INDEX), (enum d_pad_state)SEQ_CONTROL_CALL, SEQ_HOLD, 0 }
+
+/* Sub-sequence called by SEQ_CALL: its steps and their number */
+struct subsequence {
+	const struct button_d_pad_state* steps;
+	size_t length;
+};
+
+/* Element of a sub-sequences table, from an array of steps */
+#define SUBSEQUENCE(STEPS) \
+	{ STEPS, sizeof(STEPS) / sizeof(struct button_d_pad_state) }
+
+/* Maximum number of nested loops and calls in a sequence */
+#define SEQ_STACK_SIZE 4
+
+/* Mode of panic (see panic) when an invalid sequence is sent */
+#define SEQ_PANIC_MODE 5
+
 /* Set the LED state to be sent during the next update. */
 void set_leds(enum led_state leds);
 
@@ -115,6 +186,28 @@ void set_leds(enum led_state leds);
 void send_update(enum button_state buttons, enum d_pad_state d_pad,
 	struct stick_coord l_stick, struct stick_coord r_stick);
 
+/*
+ * Send an update with new button/controller state, that the USB interface
+ * will output on its own for the specified number of cycles (max 32767). This
+ * returns as soon as the update is sent, so other processing (user I/O,
+ * sleeping…) can be done during the cycles. Unless the state is neutral, the
+ * next update must be sent before the cycles have elapsed;
+ * wait_updates_output can be used to wait for the last cycle.
+ */
+void send_update_hold(enum button_state buttons, enum d_pad_state d_pad,
+	struct stick_coord l_stick, struct stick_coord r_stick, uint16_t cycles);
+
+/*
+ * Queue an update with new button/controller state, that the USB interface
+ * will output for the specified number of cycles (max 32767), or mash (see
+ * SEQ_MASH) the specified number of times, and return without waiting for
+ * it to be sent. This only blocks if several updates are already queued.
+ * This is the primitive of the script interpreter (see script.h).
+ */
+void queue_update(enum button_state buttons, enum d_pad_state d_pad,
+	struct stick_coord l_stick, struct stick_coord r_stick, uint16_t cycles,
+	enum seq_mode mode);
+
 /*
  * Send button press followed by a release.
  * The press/release sequence is repeated by the specified count.
@@ -126,30 +219,150 @@ void send_buttons(enum button_state buttons, enum d_pad_state d_pad,
  * Send a button sequence.
  * The first parameter is a pointer to an array of states to run in sequence.
  * The second parameter is the number of entries in the array.
+ * The sequence can contain loops (see SEQ_LOOP).
  */
 void send_button_sequence(const struct button_d_pad_state sequence[],
 	size_t sequence_length);
 
 /*
- * Macro to simplify the use of send_button_sequence.
+ * Send a button sequence stored in program memory (declared with PROGMEM).
+ * The parameters are the same as send_button_sequence.
+ */
+void send_button_sequence_P(const struct button_d_pad_state sequence[],
+	size_t sequence_length);
+
+/*
+ * Macro to simplify the use of send_button_sequence. The states must be
+ * constant: they are stored in program memory, so they do not use RAM (see
+ * SEND_BUTTON_SEQUENCE_RAM for states computed at run time).
  *
  * Example usage: SEND_BUTTON_SEQUENCE({ BUTTON_A, DP_NEUTRAL, SEQ_HOLD, 5},
  * { NO_BUTTONS, DP_TOP, SEQ_HOLD, 1 });
  */
 #define SEND_BUTTON_SEQUENCE(FIRST_STATE, ...) \
+	do { \
+		static const struct button_d_pad_state PROGMEM sequence_P[] = { \
+			FIRST_STATE, __VA_ARGS__ }; \
+		send_button_sequence_P(sequence_P, \
+			sizeof(sequence_P) / sizeof(struct button_d_pad_state)); \
+	} while (0)
+
+/*
+ * Send a button sequence stored in program memory, which can call the
+ * sub-sequences of the specified table (see SEQ_CALL), which has
+ * subsequence_count elements. The table and the sub-sequences are also stored
+ * in program memory.
+ */
+void send_button_sequence_calls_P(const struct button_d_pad_state sequence[],
+	size_t sequence_length, const struct subsequence subsequences[],
+	uint8_t subsequence_count);
+
+/*
+ * Same as SEND_BUTTON_SEQUENCE, for a sequence calling the sub-sequences of
+ * the specified table (an array, see send_button_sequence_calls_P).
+ *
+ * Example usage: SEND_BUTTON_SEQUENCE_CALLS(menu_subsequences_P,
+ * SEQ_CALL(OPEN_MENU), { BT_A, DP_NEUTRAL, SEQ_HOLD, 1 });
+ * with menu_subsequences_P declared as:
+ * static const struct subsequence PROGMEM menu_subsequences_P[] = {
+ *	[OPEN_MENU] = SUBSEQUENCE(open_menu_P),
+ * };
+ */
+#define SEND_BUTTON_SEQUENCE_CALLS(SUBSEQUENCES, FIRST_STATE, ...) \
+	do { \
+		static const struct button_d_pad_state PROGMEM sequence_P[] = { \
+			FIRST_STATE, __VA_ARGS__ }; \
+		send_button_sequence_calls_P(sequence_P, \
+			sizeof(sequence_P) / sizeof(struct button_d_pad_state), \
+			SUBSEQUENCES, sizeof(SUBSEQUENCES) / sizeof(struct subsequence)); \
+	} while (0)
+
+/*
+ * Same as SEND_BUTTON_SEQUENCE, for states computed at run time: they are
+ * stored in RAM, while the sequence runs.
+ */
+#define SEND_BUTTON_SEQUENCE_RAM(FIRST_STATE, ...) \
 	send_button_sequence((struct button_d_pad_state[]){ \
 		FIRST_STATE, __VA_ARGS__ }, sizeof((struct button_d_pad_state[]){ \
 		FIRST_STATE, __VA_ARGS__ }) / \
-		sizeof(struct button_d_pad_state));
+		sizeof(struct button_d_pad_state))
 
 /*
- * Send an update that reset the button/controller state to a neutral state
- * (no buttons pressed, sticks centered). This needs to be called if no updates
- * are going to be sent for a long period (more than a cycle length).
+ * Send a button sequence moving the sticks: each step also sets the position
+ * of the sticks, which are kept while the buttons are mashed (see
+ * SEQ_MASH). The second parameter is the number of entries in the array.
+ * The sequence can contain loops, as steps without stick positions (for
+ * instance { SEQ_LOOP(4) }).
  */
-__attribute__((always_inline)) inline void pause_automation(void) {
-	send_update(BT_NONE, DP_NEUTRAL, S_NEUTRAL, S_NEUTRAL);
-}
+void send_sticks_sequence(const struct button_sticks_state sequence[],
+	size_t sequence_length);
+
+/*
+ * Send a button sequence moving the sticks stored in program memory (declared
+ * with PROGMEM). The parameters are the same as send_sticks_sequence.
+ */
+void send_sticks_sequence_P(const struct button_sticks_state sequence[],
+	size_t sequence_length);
+
+/*
+ * Macro to simplify the use of send_sticks_sequence; the states must be
+ * constant (see SEND_BUTTON_SEQUENCE), with the stick positions given as
+ * S_XY_ pairs.
+ *
+ * Example usage: SEND_STICKS_SEQUENCE(
+ * { { BT_NONE, DP_NEUTRAL, SEQ_HOLD, 4 }, { S_XY_TOP }, { S_XY_NEUTRAL } },
+ * { { BT_B, DP_NEUTRAL, SEQ_MASH, 2 }, { S_XY_RIGHT }, { S_XY_NEUTRAL } });
+ */
+#define SEND_STICKS_SEQUENCE(FIRST_STATE, ...) \
+	do { \
+		static const struct button_sticks_state PROGMEM sequence_P[] = { \
+			FIRST_STATE, __VA_ARGS__ }; \
+		send_sticks_sequence_P(sequence_P, \
+			sizeof(sequence_P) / sizeof(struct button_sticks_state)); \
+	} while (0)
+
+/*
+ * Upload a button sequence to the USB interface, which plays it on its own with
+ * regular timings, without any communication with the main microcontroller.
+ * The parameters are the same as send_button_sequence; the sticks keep their
+ * current position. The sequence cannot contain control steps (see SEQ_LOOP),
+ * as the USB interface does not run them: the main microcontroller panics
+ * (SEQ_PANIC_MODE) on the first one, before sending its chunk.
+ * The sequence is sent in chunks; this returns once the last one is sent, while
+ * the USB interface may still be playing the sequence. wait_updates_output
+ * can be used to wait until its last cycle.
+ */
+void play_button_sequence(const struct button_d_pad_state sequence[],
+	size_t sequence_length);
+
+/*
+ * Upload a button sequence stored in program memory (declared with PROGMEM)
+ * to the USB interface (see play_button_sequence).
+ */
+void play_button_sequence_P(const struct button_d_pad_state sequence[],
+	size_t sequence_length);
+
+/*
+ * Macro to simplify the use of play_button_sequence; the states must be
+ * constant (see SEND_BUTTON_SEQUENCE).
+ */
+#define PLAY_BUTTON_SEQUENCE(FIRST_STATE, ...) \
+	do { \
+		static const struct button_d_pad_state PROGMEM sequence_P[] = { \
+			FIRST_STATE, __VA_ARGS__ }; \
+		play_button_sequence_P(sequence_P, \
+			sizeof(sequence_P) / sizeof(struct button_d_pad_state)); \
+	} while (0)
+
+/*
+ * Set the length of the cycles, in 8 ms units (1 to 16, which is the number of
+ * USB reports sent to a Switch during a cycle; 0 restores the default of 5,
+ * 40 ms). It applies to the updates sent after this call, including the button
+ * sequences, and can be changed before each update. Some games do not register
+ * inputs that last less than a few reports. Short cycles also need a fast
+ * serial link to the USB interface, which is negotiated at startup.
+ */
+void set_cycle_length(uint8_t length);
 
 /*
  * Send an update with the current state. This be used after a call to set_leds
@@ -157,9 +370,70 @@ __attribute__((always_inline)) inline void pause_automation(void) {
  */
 void send_current(void);
 
+/*
+ * Queue an update with the current state, and return without waiting for the
+ * USB interface to accept it; this allows doing other processing while the
+ * update is sent. This only blocks if several updates are already queued.
+ * send_completed or wait_send_completed can be used to know when the queued
+ * updates have been sent.
+ */
+void send_current_async(void);
+
+/* Returns true once all queued updates have been sent to the USB interface */
+bool send_completed(void);
+
+/* Wait for all queued updates to be sent to the USB interface */
+void wait_send_completed(void);
+
+/*
+ * Wait for the USB interface to output all the updates sent to it. The USB
+ * interface can queue a few updates, so the regular send functions return
+ * up to FRAME_QUEUE_SIZE cycles before the update is actually output.
+ */
+void wait_updates_output(void);
+
+/* Transmission error counters of the serial link to the USB interface (they
+   wrap around) */
+struct link_stats {
+	uint16_t naks; /* Messages rejected by the USB interface */
+	uint16_t rx_errors; /* Invalid bytes received from the USB interface */
+	uint16_t retransmits; /* Messages sent again after an error */
+};
+
+/*
+ * Returns the transmission error counters. The transmission errors are
+ * recovered from automatically; the counters can be used to check the quality
+ * of the link.
+ */
+struct link_stats get_link_stats(void);
+
+/* Host poll interval measurements, reported by the USB interface about every
+   second. The cycles are timed independently of the poll rate, but a slow
+   or irregular host may delay the start of some cycles. */
+struct host_poll_stats {
+	uint8_t avg_interval; /* Average interval between polls, in 1/4 ms (max 63;
+	                         0 if not reported yet) */
+	uint8_t max_interval; /* Maximum interval between polls, in ms (max 31) */
+};
+
+/* Returns the last host poll interval measurements */
+struct host_poll_stats get_host_poll_stats(void);
+
+/*
+ * Send an update that reset the button/controller state to a neutral state
+ * (no buttons pressed, sticks centered), and wait for the USB interface to
+ * output it. This needs to be called if no updates are going to be sent for a
+ * long period (more than a cycle length).
+ */
+__attribute__((always_inline)) inline void pause_automation(void) {
+	send_update(BT_NONE, DP_NEUTRAL, S_NEUTRAL, S_NEUTRAL);
+	wait_updates_output();
+}
+
 /* Enter panic mode; the L LED will repetitively blink the number of times
-   specified in the parameters. Values 0 to 3 are used internally by the
-   automation functions and should not be specified. Never returns. */
+   specified in the parameters. Values 0 to 5 are used internally by the
+   automation functions (0 to 3 for the link errors, SCRIPT_PANIC_MODE in
+   script.h and SEQ_PANIC_MODE) and should not be specified. Never returns. */
 void panic(uint8_t mode) __attribute__((noreturn));
 
 #endif
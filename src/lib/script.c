@@ -0,0 +1,285 @@
+/*
+ * Automation scripts interpreter
+ */
+
+#include "script.h"
+#include "user-io.h"
+#include "bench.h"
+
+#include <avr/pgmspace.h>
+#include <util/delay.h>
+
+/* Nested loop or call: loop start and remaining iterations, or return
+   address (remaining is 0) */
+struct script_frame {
+	const uint8_t* pc;
+	uint16_t remaining;
+};
+
+
+/* Static functions */
+static uint16_t read_u16(const uint8_t* pc);
+static uint8_t instruction_size(uint8_t opcode);
+static const uint8_t* skip_loop(const uint8_t* pc);
+
+
+/* Run a script stored in program memory */
+bool run_script(const uint8_t script[], const uint8_t* const subscripts[],
+	uint8_t subscript_count, uint16_t param)
+{
+	struct script_frame stack[SCRIPT_STACK_SIZE];
+	uint8_t depth = 0;
+	const uint8_t* pc = script;
+	struct stick_coord l_stick = S_NEUTRAL;
+	struct stick_coord r_stick = S_NEUTRAL;
+	bool stopped = false;
+
+	for (;;) {
+		uint8_t opcode = pgm_read_byte(pc);
+		uint16_t count;
+
+		BENCH_START(BENCH_SCRIPT_INSTRUCTION);
+
+		/* Button instructions */
+		if (opcode >= SC_OP_PRESS) {
+			enum button_state buttons = read_u16(pc + 1);
+			enum d_pad_state d_pad = opcode & 0x0F;
+
+			if (d_pad > DP_NEUTRAL) {
+				panic(SCRIPT_PANIC_MODE);
+			}
+
+			switch (opcode & 0xF0) {
+				case SC_OP_PRESS:
+					queue_update(buttons, d_pad, l_stick, r_stick, 1, SEQ_HOLD);
+					pc += 3;
+				break;
+
+				case SC_OP_HOLD:
+					queue_update(buttons, d_pad, l_stick, r_stick,
+						pgm_read_byte(pc + 3), SEQ_HOLD);
+					pc += 4;
+				break;
+
+				case SC_OP_MASH:
+					queue_update(buttons, d_pad, l_stick, r_stick,
+						pgm_read_byte(pc + 3), SEQ_MASH);
+					pc += 4;
+				break;
+
+				default:
+					panic(SCRIPT_PANIC_MODE);
+			}
+
+			BENCH_END(BENCH_SCRIPT_INSTRUCTION);
+			continue;
+		}
+
+		if ((opcode & ~BOTH_LEDS) == SC_OP_LEDS) {
+			set_leds(opcode & BOTH_LEDS);
+			pc += 1;
+
+			BENCH_END(BENCH_SCRIPT_INSTRUCTION);
+			continue;
+		}
+
+		switch (opcode) {
+			case SC_OP_END:
+				/* Return from a call, or end the script */
+				if (depth == 0) {
+					BENCH_END(BENCH_SCRIPT_INSTRUCTION);
+					goto end;
+				}
+
+				depth -= 1;
+				if (stack[depth].remaining != 0) {
+					/* Unterminated loop */
+					panic(SCRIPT_PANIC_MODE);
+				}
+
+				pc = stack[depth].pc;
+			break;
+
+			case SC_OP_WAIT:
+				queue_update(BT_NONE, DP_NEUTRAL, l_stick, r_stick, read_u16(pc + 1),
+					SEQ_HOLD);
+				pc += 3;
+			break;
+
+			case SC_OP_STICKS:
+				l_stick.x = pgm_read_byte(pc + 1);
+				l_stick.y = pgm_read_byte(pc + 2);
+				r_stick.x = pgm_read_byte(pc + 3);
+				r_stick.y = pgm_read_byte(pc + 4);
+				pc += 5;
+			break;
+
+			case SC_OP_LOOP:
+			case SC_OP_LOOP_PARAM:
+				if (opcode == SC_OP_LOOP) {
+					count = read_u16(pc + 1);
+					pc += 3;
+				} else {
+					count = param;
+					pc += 1;
+				}
+
+				if (count == 0) {
+					pc = skip_loop(pc);
+					break;
+				}
+
+				if (depth == SCRIPT_STACK_SIZE) {
+					panic(SCRIPT_PANIC_MODE);
+				}
+
+				stack[depth].pc = pc;
+				stack[depth].remaining = count;
+				depth += 1;
+			break;
+
+			case SC_OP_END_LOOP:
+				if ((depth == 0) || (stack[depth - 1].remaining == 0)) {
+					panic(SCRIPT_PANIC_MODE);
+				}
+
+				stack[depth - 1].remaining -= 1;
+				if (stack[depth - 1].remaining != 0) {
+					pc = stack[depth - 1].pc;
+				} else {
+					depth -= 1;
+					pc += 1;
+				}
+			break;
+
+			case SC_OP_CALL:
+				count = pgm_read_byte(pc + 1);
+				if ((depth == SCRIPT_STACK_SIZE) || (subscripts == NULL) ||
+					(count >= subscript_count)) {
+					panic(SCRIPT_PANIC_MODE);
+				}
+
+				stack[depth].pc = pc + 2;
+				stack[depth].remaining = 0;
+				depth += 1;
+
+				pc = pgm_read_ptr(&subscripts[count]);
+			break;
+
+			case SC_OP_DELAY:
+			case SC_OP_CHECK_BUTTON: {
+				uint16_t blink_ms = 0;
+
+				if (opcode == SC_OP_CHECK_BUTTON) {
+					blink_ms = pgm_read_byte(pc + 1) * 10;
+					pc += 1;
+				}
+
+				count = read_u16(pc + 1);
+				pc += 3;
+
+				BENCH_END(BENCH_SCRIPT_INSTRUCTION);
+
+				wait_updates_output();
+
+				if (opcode == SC_OP_DELAY) {
+					for (; count > 0 ; count -= 1) {
+						_delay_ms(1);
+					}
+				} else if (delay(blink_ms, blink_ms, count)) {
+					stopped = true;
+					goto end;
+				}
+			}
+			continue;
+
+			default:
+				panic(SCRIPT_PANIC_MODE);
+		}
+
+		BENCH_END(BENCH_SCRIPT_INSTRUCTION);
+	}
+
+end:
+	/* Return when the last update is output, like send_button_sequence */
+	wait_updates_output();
+	return stopped;
+}
+
+
+/*
+ * Returns a 16-bit instruction argument.
+ */
+uint16_t read_u16(const uint8_t* pc)
+{
+	return pgm_read_byte(pc) | (pgm_read_byte(pc + 1) << 8);
+}
+
+
+/*
+ * Returns the size of an instruction, or 0 if the opcode is invalid.
+ */
+uint8_t instruction_size(uint8_t opcode)
+{
+	static const uint8_t PROGMEM sizes[SC_OP_PRESS] = {
+		[SC_OP_END] = 1,
+		[SC_OP_WAIT] = 3,
+		[SC_OP_STICKS] = 5,
+		[SC_OP_LOOP] = 3,
+		[SC_OP_LOOP_PARAM] = 1,
+		[SC_OP_END_LOOP] = 1,
+		[SC_OP_CALL] = 2,
+		[SC_OP_DELAY] = 3,
+		[SC_OP_CHECK_BUTTON] = 4,
+		[SC_OP_LEDS | NO_LEDS] = 1,
+		[SC_OP_LEDS | TX_LED] = 1,
+		[SC_OP_LEDS | RX_LED] = 1,
+		[SC_OP_LEDS | BOTH_LEDS] = 1,
+	};
+
+	switch (opcode & 0xF0) {
+		case 0:
+			return pgm_read_byte(&sizes[opcode]);
+
+		case SC_OP_PRESS:
+			return 3;
+
+		case SC_OP_HOLD:
+		case SC_OP_MASH:
+			return 4;
+
+		default:
+			return 0;
+	}
+}
+
+
+/*
+ * Returns the address of the instruction after the end of a loop, from the
+ * address of its first instruction.
+ */
+const uint8_t* skip_loop(const uint8_t* pc)
+{
+	uint8_t nesting = 0;
+
+	for (;;) {
+		uint8_t opcode = pgm_read_byte(pc);
+		uint8_t size = instruction_size(opcode);
+
+		if ((size == 0) || (opcode == SC_OP_END)) {
+			panic(SCRIPT_PANIC_MODE);
+		}
+
+		pc += size;
+
+		if ((opcode == SC_OP_LOOP) || (opcode == SC_OP_LOOP_PARAM)) {
+			nesting += 1;
+		} else if (opcode == SC_OP_END_LOOP) {
+			if (nesting == 0) {
+				return pc;
+			}
+
+			nesting -= 1;
+		}
+	}
+}
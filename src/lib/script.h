@@ -0,0 +1,126 @@
+/*
+ * Automation scripts
+ *
+ * A script is a compact bytecode stored in program memory, which describes
+ * the controller updates to send (button presses, held or mashed buttons,
+ * stick moves, waits), with loops, calls of other scripts, LED changes and
+ * checks of the push button. It takes fewer bytes than the equivalent
+ * function calls or button sequences, and it is run by a single interpreter
+ * loop (run_script).
+ *
+ * Scripts are written as byte arrays with the SC_ macros, and must end with
+ * SC_END. For instance:
+ *
+ * static const uint8_t PROGMEM walk_script[] = {
+ *	SC_LEDS(TX_LED),
+ *	SC_STICKS(S_XY_TOP, S_XY_NEUTRAL),	// Walk up…
+ *	SC_LOOP_PARAM,						// …for the number of cycles given
+ *		SC_WAIT(1),						// to run_script, pressing B on
+ *		SC_PRESS(BT_B, DP_NEUTRAL),		// every other cycle
+ *	SC_END_LOOP,
+ *	SC_STICKS(S_XY_NEUTRAL, S_XY_NEUTRAL),
+ *	SC_WAIT(1),
+ *	SC_END,
+ * };
+ *
+ * The sticks are centered at the start of a script, and keep the position
+ * set by SC_STICKS during the following updates. Like send_button_sequence,
+ * run_script returns once the last update is output.
+ */
+
+#ifndef SCRIPT_H
+#define SCRIPT_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "automation.h"
+
+/* Maximum number of nested loops and calls */
+#define SCRIPT_STACK_SIZE 8
+
+/* Mode of panic (see automation.h) when an invalid script is run */
+#define SCRIPT_PANIC_MODE 4
+
+/*
+ * Instruction opcodes (use the SC_ macros instead). The instructions sending
+ * buttons have the D-pad state in the low 4 bits of their opcode, and the
+ * LED instruction has the LED state in its low 2 bits.
+ */
+enum script_opcode {
+	SC_OP_END = 0x00,
+	SC_OP_WAIT = 0x01, /* + cycles (16 bits) */
+	SC_OP_STICKS = 0x02, /* + left X, Y, right X, Y */
+	SC_OP_LOOP = 0x03, /* + count (16 bits) */
+	SC_OP_LOOP_PARAM = 0x04,
+	SC_OP_END_LOOP = 0x05,
+	SC_OP_CALL = 0x06, /* + script index */
+	SC_OP_DELAY = 0x07, /* + ms (16 bits) */
+	SC_OP_CHECK_BUTTON = 0x08, /* + blink time (10 ms), ms (16 bits) */
+	SC_OP_LEDS = 0x0C,
+	SC_OP_PRESS = 0x10, /* + buttons (16 bits) */
+	SC_OP_HOLD = 0x20, /* + buttons (16 bits), cycles */
+	SC_OP_MASH = 0x30, /* + buttons (16 bits), count */
+};
+
+/* 16-bit instruction argument */
+#define SC_U16(VALUE) ((VALUE) & 0xFF), (((VALUE) >> 8) & 0xFF)
+
+/* End of the script (or of a called script) */
+#define SC_END SC_OP_END
+
+/* Press the buttons and the D-pad for one cycle */
+#define SC_PRESS(BUTTONS, D_PAD) (SC_OP_PRESS | (D_PAD)), SC_U16(BUTTONS)
+
+/* Hold the buttons and the D-pad for the specified number of cycles (1-255) */
+#define SC_HOLD(BUTTONS, D_PAD, CYCLES) \
+	(SC_OP_HOLD | (D_PAD)), SC_U16(BUTTONS), (CYCLES)
+
+/* Press and release the buttons and the D-pad the specified number of times
+   (1-255), like SEQ_MASH */
+#define SC_MASH(BUTTONS, D_PAD, COUNT) \
+	(SC_OP_MASH | (D_PAD)), SC_U16(BUTTONS), (COUNT)
+
+/* Release the buttons and the D-pad for the specified number of cycles
+   (1-32767); the sticks keep their position */
+#define SC_WAIT(CYCLES) SC_OP_WAIT, SC_U16(CYCLES)
+
+/* Set the position of the sticks for the next updates, as S_XY_ pairs (see
+   automation.h and S_XY_SCALED) */
+#define SC_STICKS(L_STICK_XY, R_STICK_XY) SC_OP_STICKS, L_STICK_XY, R_STICK_XY
+
+/* Repeat the instructions up to the matching SC_END_LOOP the specified number
+   of times (0-65535), or the number of times given to run_script */
+#define SC_LOOP(COUNT) SC_OP_LOOP, SC_U16(COUNT)
+#define SC_LOOP_PARAM SC_OP_LOOP_PARAM
+#define SC_END_LOOP SC_OP_END_LOOP
+
+/* Run the script with the specified index in the table given to run_script
+   (panics if the index is not in the table) */
+#define SC_CALL(INDEX) SC_OP_CALL, (INDEX)
+
+/* Wait for the last update to be output, then wait the specified time in ms
+   (up to 65535) */
+#define SC_DELAY(MS) SC_OP_DELAY, SC_U16(MS)
+
+/* Same as SC_DELAY, blinking the LED (on and off for BLINK_MS each, in 10 ms
+   units up to 2550; 0 to keep it off); the script stops if the button is
+   pressed */
+#define SC_CHECK_BUTTON(MS, BLINK_MS) \
+	SC_OP_CHECK_BUTTON, ((BLINK_MS) / 10), SC_U16(MS)
+
+/* Set the LED state of the next updates (see set_leds) */
+#define SC_LEDS(LEDS) (SC_OP_LEDS | (LEDS))
+
+/*
+ * Run a script stored in program memory. subscripts is the table of the
+ * scripts that can be called with SC_CALL (in program memory, NULL if the
+ * script has no calls), subscript_count the number of entries of this table,
+ * and param the number of iterations of the SC_LOOP_PARAM loops.
+ * Returns true if the script was stopped by a button press (see
+ * SC_CHECK_BUTTON).
+ */
+bool run_script(const uint8_t script[], const uint8_t* const subscripts[],
+	uint8_t subscript_count, uint16_t param);
+
+#endif
@@ -6,6 +6,18 @@
 
 #include "automation-utils.h"
 #include "user-io.h"
+#include "script.h"
+
+/* Waits of reposition_player, in cycles: for the map to open, and for the
+   warp to complete. Like HATCH_TIME and EGG_WAIT_TIME (see auto_breeding),
+   they can be set at build time to tune them (see tools/sweep.py). */
+#ifndef MAP_WAIT_CYCLES
+#define MAP_WAIT_CYCLES 55
+#endif
+
+#ifndef WARP_WAIT_CYCLES
+#define WARP_WAIT_CYCLES 60
+#endif
 
 /* Static functions */
 static void temporary_control(void);
@@ -355,7 +367,7 @@ void set_text_speed(bool fast_speed, bool save)
 	}
 
 	/* Uses held A button to makes the text go faster. */
-	SEND_BUTTON_SEQUENCE(
+	SEND_BUTTON_SEQUENCE_RAM(
 		{ BT_X,		DP_NEUTRAL,	SEQ_HOLD,	1  },	/* Open menu */
 		{ BT_NONE,	DP_NEUTRAL, SEQ_HOLD,	25 },	/* Wait for menu */
 		{ BT_NONE,	DP_TOPLEFT, SEQ_HOLD,	25 },	/* Move to top/left position */
@@ -549,6 +561,16 @@ void auto_breeding(void)
 		delay(100, 200, 1500);
 	}
 
+	/* Spinning times set at build time, replacing the ones of the selected
+	   Egg cycles */
+	#ifdef HATCH_TIME
+	hatch_time = HATCH_TIME;
+	#endif
+
+	#ifdef EGG_WAIT_TIME
+	wait_time = EGG_WAIT_TIME;
+	#endif
+
 	/* FIXME: Find a way to ensure the player character is on their bike instead of just
 	   toggling the state. For now, just require the player to start on the bike. */
 	#ifdef PUT_PLAYER_ON_BIKE
@@ -596,47 +618,57 @@ void reposition_player(bool first_time)
 {
 	/* Uses held A button to makes the text go faster. */
 
-	set_leds(NO_LEDS);
+	static const uint8_t PROGMEM warp_script[] = {
+		SC_PRESS(BT_A,		DP_NEUTRAL),		/* Open map */
+		SC_WAIT(MAP_WAIT_CYCLES),				/* Wait for map */
+		SC_HOLD(BT_A,		DP_NEUTRAL, 15),	/* Warp? */
+		SC_WAIT(1),								/* Release A */
+		SC_PRESS(BT_A,		DP_NEUTRAL),		/* Accept */
+		SC_WAIT(WARP_WAIT_CYCLES),				/* Wait for warp to complete */
+		SC_END,
+	};
 
-	if (first_time) {
-		SEND_BUTTON_SEQUENCE(
-			{ BT_X,		DP_NEUTRAL,	SEQ_HOLD,	1  },	/* Open menu */
-			{ BT_NONE,	DP_NEUTRAL, SEQ_HOLD,	25 },	/* Wait for menu */
-			{ BT_NONE,	DP_TOPLEFT, SEQ_HOLD,	25 },	/* Move to top/left position */
-			{ BT_NONE,	DP_NEUTRAL, SEQ_HOLD,	1  },	/* Release the buttons */
+	static const uint8_t* const PROGMEM subscripts[] = {
+		warp_script,
+	};
 
-			{ BT_NONE,	DP_BOTTOM,	SEQ_MASH,	1 },	/* Move to Map position */
-			{ BT_NONE,	DP_LEFT,	SEQ_MASH,	1 },	/* Move to Parameters position */
+	static const uint8_t PROGMEM first_time_script[] = {
+		SC_LEDS(NO_LEDS),
+		SC_PRESS(BT_X,		DP_NEUTRAL),		/* Open menu */
+		SC_WAIT(25),							/* Wait for menu */
+		SC_HOLD(BT_NONE,	DP_TOPLEFT,	25),	/* Move to top/left position */
+		SC_WAIT(1),								/* Release the buttons */
 
-			{ BT_A,		DP_NEUTRAL,	SEQ_HOLD,	1 },	/* Enter Parameters */
-			{ BT_NONE,	DP_NEUTRAL, SEQ_HOLD,	26 },	/* Wait for menu */
+		SC_MASH(BT_NONE,	DP_BOTTOM,	1),		/* Move to Map position */
+		SC_MASH(BT_NONE,	DP_LEFT,	1),		/* Move to Parameters position */
 
-			{ BT_NONE,	DP_RIGHT,	SEQ_MASH,	2 },	/* Select speed */
+		SC_PRESS(BT_A,		DP_NEUTRAL),		/* Enter Parameters */
+		SC_WAIT(26),							/* Wait for menu */
 
-			{ BT_A,		DP_NEUTRAL,	SEQ_HOLD,	10 },	/* Validate parameters */
-			{ BT_NONE,	DP_NEUTRAL, SEQ_HOLD,	1 },	/* Release A to advance */
-			{ BT_A,		DP_NEUTRAL,	SEQ_HOLD,	10 },	/* Validate parameters */
-			{ BT_NONE,	DP_NEUTRAL, SEQ_HOLD,	1 },	/* Release A to advance */
-			{ BT_A,		DP_NEUTRAL,	SEQ_MASH,	1 },	/* Validate dialog */
-			{ BT_NONE,	DP_NEUTRAL, SEQ_HOLD,	25 },	/* Wait for menu */
+		SC_MASH(BT_NONE,	DP_RIGHT,	2),		/* Select speed */
 
-			{ BT_NONE,	DP_RIGHT,	SEQ_MASH,	1 },	/* Move to Map position */
-		);
-	} else {
-		SEND_BUTTON_SEQUENCE(
-			{ BT_X,		DP_NEUTRAL,	SEQ_HOLD,	1  },	/* Open menu */
-			{ BT_NONE,	DP_NEUTRAL, SEQ_HOLD,	25 },	/* Wait for menu */
-		);
-	}
+		SC_HOLD(BT_A,		DP_NEUTRAL,	10),	/* Validate parameters */
+		SC_WAIT(1),								/* Release A to advance */
+		SC_HOLD(BT_A,		DP_NEUTRAL,	10),	/* Validate parameters */
+		SC_WAIT(1),								/* Release A to advance */
+		SC_MASH(BT_A,		DP_NEUTRAL,	1),		/* Validate dialog */
+		SC_WAIT(25),							/* Wait for menu */
 
-	SEND_BUTTON_SEQUENCE(
-		{ BT_A,		DP_NEUTRAL,	SEQ_HOLD,	1  },	/* Open map */
-		{ BT_NONE,	DP_NEUTRAL, SEQ_HOLD,	55 },	/* Wait for map */
-		{ BT_A,		DP_NEUTRAL,	SEQ_HOLD,	15 },	/* Warp? */
-		{ BT_NONE,	DP_NEUTRAL, SEQ_HOLD,	1  },	/* Release A */
-		{ BT_A,		DP_NEUTRAL,	SEQ_HOLD,	1  },	/* Accept */
-		{ BT_NONE,	DP_NEUTRAL, SEQ_HOLD,	60 },	/* Wait for warp to complete */
-	);
+		SC_MASH(BT_NONE,	DP_RIGHT,	1),		/* Move to Map position */
+		SC_CALL(0),								/* Warp */
+		SC_END,
+	};
+
+	static const uint8_t PROGMEM script[] = {
+		SC_LEDS(NO_LEDS),
+		SC_PRESS(BT_X,		DP_NEUTRAL),		/* Open menu */
+		SC_WAIT(25),							/* Wait for menu */
+		SC_CALL(0),								/* Warp */
+		SC_END,
+	};
+
+	run_script(first_time ? first_time_script : script, subscripts,
+		sizeof(subscripts) / sizeof(*subscripts), 0);
 }
 
 
@@ -646,20 +678,23 @@ void reposition_player(bool first_time)
  */
 void go_to_nursery_helper(void)
 {
-	set_leds(TX_LED);
-
-	send_update(BT_NONE, DP_NEUTRAL, S_SCALED(S_BOTLEFT, 25), S_NEUTRAL);
-
-	for (uint8_t i = 0 ; i < 21 ; i += 1) {
-		send_update(BT_NONE, DP_NEUTRAL, S_BOTTOM, S_NEUTRAL);
-	}
-
-	send_update(BT_NONE, DP_NEUTRAL, S_RIGHT, S_NEUTRAL);
-	send_update(BT_NONE, DP_NEUTRAL, S_RIGHT, S_NEUTRAL);
+	static const uint8_t PROGMEM script[] = {
+		SC_LEDS(TX_LED),
+		SC_STICKS(S_XY_SCALED(S_XY_BOTLEFT, 25), S_XY_NEUTRAL),
+		SC_WAIT(1),
+		SC_STICKS(S_XY_BOTTOM, S_XY_NEUTRAL),
+		SC_WAIT(21),
+		SC_STICKS(S_XY_RIGHT, S_XY_NEUTRAL),
+		SC_WAIT(2),
+
+		/* Reset the sticks and wait for the player to be standing still */
+		SC_STICKS(S_XY_NEUTRAL, S_XY_NEUTRAL),
+		SC_WAIT(1),
+		SC_DELAY(400),
+		SC_END,
+	};
 
-	/* Reset the sticks and wait for the player to be standing still */
-	pause_automation();
-	_delay_ms(400);
+	run_script(script, NULL, 0, 0);
 }
 
 
@@ -669,26 +704,29 @@ void go_to_nursery_helper(void)
  */
 void get_egg(void)
 {
-	SEND_BUTTON_SEQUENCE(
-		{ BT_NONE,	DP_NEUTRAL,	SEQ_HOLD,	10 },	/* Wait after movement */
-		{ BT_A,		DP_NEUTRAL,	SEQ_HOLD,	15 },	/* Open “accept egg” dialog */
-		{ BT_NONE,	DP_NEUTRAL,	SEQ_HOLD,	1  },	/* Release A */
-		{ BT_A,		DP_NEUTRAL,	SEQ_HOLD,	1  },	/* Accept egg */
-		{ BT_NONE,	DP_NEUTRAL,	SEQ_HOLD,	75 },	/* Wait for dialog  */
-		{ BT_A,		DP_NEUTRAL,	SEQ_HOLD,	1  },	/* Open “what do you want” dialog */
-		{ BT_NONE,	DP_NEUTRAL,	SEQ_HOLD,	50 },	/* Wait for dialog */
-		{ BT_A,		DP_NEUTRAL,	SEQ_HOLD,	20 },	/* Choose “include in team” */
-		{ BT_NONE,	DP_NEUTRAL,	SEQ_HOLD,	1  },	/* Release A */
-		{ BT_A,		DP_NEUTRAL,	SEQ_HOLD,	1  },	/* Open team dialog */
-		{ BT_NONE,	DP_NEUTRAL,	SEQ_HOLD,	45 },	/* Wait for dialog */
-		{ BT_NONE,	DP_BOTTOM,	SEQ_MASH,	1  },	/* Go to second Pokémon */
-		{ BT_A,		DP_BOTTOM,	SEQ_HOLD,	65 },	/* Select second Pokémon */
-		{ BT_NONE,	DP_NEUTRAL,	SEQ_HOLD,	1  },	/* Release A */
-		{ BT_A,		DP_BOTTOM,	SEQ_HOLD,	35 },	/* Validate “… sent to box” dialog */
-		{ BT_NONE,	DP_NEUTRAL,	SEQ_HOLD,	1  },	/* Release A */
-		{ BT_A,		DP_BOTTOM,	SEQ_MASH,	1  },	/* Validate “Take care” dialog */
-		{ BT_NONE,	DP_NEUTRAL,	SEQ_HOLD,	25 },	/* Wait for dialog to close */
-	);
+	static const uint8_t PROGMEM script[] = {
+		SC_WAIT(10),							/* Wait after movement */
+		SC_HOLD(BT_A,		DP_NEUTRAL,	15),	/* Open “accept egg” dialog */
+		SC_WAIT(1),								/* Release A */
+		SC_PRESS(BT_A,		DP_NEUTRAL),		/* Accept egg */
+		SC_WAIT(75),							/* Wait for dialog  */
+		SC_PRESS(BT_A,		DP_NEUTRAL),		/* Open “what do you want” dialog */
+		SC_WAIT(50),							/* Wait for dialog */
+		SC_HOLD(BT_A,		DP_NEUTRAL,	20),	/* Choose “include in team” */
+		SC_WAIT(1),								/* Release A */
+		SC_PRESS(BT_A,		DP_NEUTRAL),		/* Open team dialog */
+		SC_WAIT(45),							/* Wait for dialog */
+		SC_MASH(BT_NONE,	DP_BOTTOM,	1),		/* Go to second Pokémon */
+		SC_HOLD(BT_A,		DP_BOTTOM,	65),	/* Select second Pokémon */
+		SC_WAIT(1),								/* Release A */
+		SC_HOLD(BT_A,		DP_BOTTOM,	35),	/* Validate “… sent to box” dialog */
+		SC_WAIT(1),								/* Release A */
+		SC_MASH(BT_A,		DP_BOTTOM,	1),		/* Validate “Take care” dialog */
+		SC_WAIT(25),							/* Wait for dialog to close */
+		SC_END,
+	};
+
+	run_script(script, NULL, 0, 0);
 }
 
 /*
@@ -697,28 +735,41 @@ void get_egg(void)
  */
 void move_in_circles(uint16_t cycles, bool go_up_first)
 {
-	set_leds(RX_LED);
-
-	if (go_up_first) {
-		send_update(BT_NONE, DP_NEUTRAL, S_SCALED(S_TOP, 25), S_NEUTRAL);
-
-		for (uint8_t i = 0 ; i < 10 ; i += 1) {
-			send_update(BT_NONE,	DP_NEUTRAL, S_TOP, S_NEUTRAL);
-			send_update(BT_B, 		DP_NEUTRAL, S_TOP, S_NEUTRAL);
-		}
+	static const uint8_t PROGMEM circles_script[] = {
+		SC_LEDS(RX_LED),
+		SC_STICKS(S_XY_RIGHT, S_XY_LEFT),
+		SC_LOOP_PARAM,
+			SC_WAIT(1),
+			SC_PRESS(BT_B,	DP_NEUTRAL),
+		SC_END_LOOP,
+
+		/* Reset sticks position */
+		SC_STICKS(S_XY_NEUTRAL, S_XY_NEUTRAL),
+		SC_WAIT(1),
+		SC_END,
+	};
 
-		for (uint8_t i = 0 ; i < 50 ; i += 1) {
-			send_update(BT_NONE, DP_NEUTRAL, S_TOPRIGHT, S_NEUTRAL);
-		}
-	}
+	static const uint8_t* const PROGMEM subscripts[] = {
+		circles_script,
+	};
 
-	for (uint16_t i = 0 ; i < (cycles / 2) ; i += 1) {
-		send_update(BT_NONE,	DP_NEUTRAL, S_RIGHT, S_LEFT);
-		send_update(BT_B,		DP_NEUTRAL, S_RIGHT, S_LEFT);
-	}
+	static const uint8_t PROGMEM go_up_script[] = {
+		SC_LEDS(RX_LED),
+		SC_STICKS(S_XY_SCALED(S_XY_TOP, 25), S_XY_NEUTRAL),
+		SC_WAIT(1),
+		SC_STICKS(S_XY_TOP, S_XY_NEUTRAL),
+		SC_LOOP(10),
+			SC_WAIT(1),
+			SC_PRESS(BT_B,	DP_NEUTRAL),
+		SC_END_LOOP,
+		SC_STICKS(S_XY_TOPRIGHT, S_XY_NEUTRAL),
+		SC_WAIT(50),
+		SC_CALL(0),
+		SC_END,
+	};
 
-	/* Reset sticks position */
-	pause_automation();
+	run_script(go_up_first ? go_up_script : circles_script, subscripts,
+		sizeof(subscripts) / sizeof(*subscripts), cycles / 2);
 }
 
 
@@ -728,25 +779,18 @@ void move_in_circles(uint16_t cycles, bool go_up_first)
  */
 bool hatch_egg(void)
 {
-	set_leds(BOTH_LEDS);
-
-	SEND_BUTTON_SEQUENCE(
-		{ BT_A,		DP_NEUTRAL,	SEQ_MASH,	1 },	/* Validate “What?” dialog */
-	)
-
-	/* Egg hatching animation */
-	if (delay(250, 250, 12500)) {
-		return true;
-	}
-
-	SEND_BUTTON_SEQUENCE(
-		{ BT_A,		DP_NEUTRAL,	SEQ_HOLD,	25 },	/* Speed up egg dialog text */
-		{ BT_NONE,	DP_NEUTRAL,	SEQ_HOLD,	1  },	/* Release A */
-		{ BT_A,		DP_NEUTRAL,	SEQ_HOLD,	1  },	/* Validate egg dialog */
-		{ BT_NONE,	DP_NEUTRAL,	SEQ_HOLD,	80 },	/* Wait for fadeout */
-	)
+	static const uint8_t PROGMEM script[] = {
+		SC_LEDS(BOTH_LEDS),
+		SC_MASH(BT_A,		DP_NEUTRAL,	1),		/* Validate “What?” dialog */
+		SC_CHECK_BUTTON(12500, 250),			/* Egg hatching animation */
+		SC_HOLD(BT_A,		DP_NEUTRAL,	25),	/* Speed up egg dialog text */
+		SC_WAIT(1),								/* Release A */
+		SC_PRESS(BT_A,		DP_NEUTRAL),		/* Validate egg dialog */
+		SC_WAIT(80),							/* Wait for fadeout */
+		SC_END,
+	};
 
-	return false;
+	return run_script(script, NULL, 0, 0);
 }
 
 
@@ -866,7 +910,7 @@ bool for_each_box_pos(bool top_left_start, bool (*callback)(void))
 				move_dir = DP_LEFT;
 			}
 
-			SEND_BUTTON_SEQUENCE(
+			SEND_BUTTON_SEQUENCE_RAM(
 				{ BT_NONE,	move_dir,	SEQ_MASH,	1 },
 			);
 		}
@@ -876,7 +920,7 @@ bool for_each_box_pos(bool top_left_start, bool (*callback)(void))
 		}
 
 		if (row < 4) {
-			SEND_BUTTON_SEQUENCE(
+			SEND_BUTTON_SEQUENCE_RAM(
 				{ BT_NONE,	change_row_dir,	SEQ_MASH,	1 },
 			);
 		}
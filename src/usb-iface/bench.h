@@ -0,0 +1,47 @@
+/*
+ * Benchmark markers, shared by the main µC and USB µC code
+ *
+ * When built with BENCH_MARKERS defined, BENCH_START(ID) and BENCH_END(ID)
+ * write the benchmark ID to the GPIOR0 register (2 CPU cycles), so the
+ * co-simulation (tools/cosim.c, -j option) can count the CPU cycles of the
+ * code between them. They are empty otherwise.
+ */
+
+#ifndef BENCH_H
+#define BENCH_H
+
+/* Flag ORed with the ID written at the end of a benchmarked section */
+#define BENCH_END_FLAG 0x80
+
+/* Benchmarked sections */
+enum bench_id {
+	BENCH_CALIBRATION = 0, /* Empty section, to measure the marker overhead */
+	BENCH_SEND_CURRENT, /* send_current, excluding the waits */
+	BENCH_SEQUENCE_STEP, /* send_button_sequence step, excluding the waits */
+	BENCH_S_SCALED, /* S_SCALED evaluation */
+	BENCH_HANDLE_RECV_BYTE, /* handle_recv_byte (USB µC) */
+	BENCH_REFRESH_CONTROLLER_DATA, /* refresh_controller_data (USB µC) */
+	BENCH_REFRESH_AND_SEND, /* refresh_and_send_controller_data (USB µC) */
+	BENCH_INIT_PERSIST, /* init_persist */
+	BENCH_PERSIST_SET_VALUE, /* persist_set_value */
+	BENCH_SCRIPT_INSTRUCTION, /* run_script instruction, excluding the waits */
+	BENCH_COUNT,
+};
+
+#ifdef BENCH_MARKERS
+#define BENCH_START(ID) do { \
+		__asm__ __volatile__ ("" ::: "memory"); \
+		GPIOR0 = (ID); \
+		__asm__ __volatile__ ("" ::: "memory"); \
+	} while (0)
+#define BENCH_END(ID) do { \
+		__asm__ __volatile__ ("" ::: "memory"); \
+		GPIOR0 = (ID) | BENCH_END_FLAG; \
+		__asm__ __volatile__ ("" ::: "memory"); \
+	} while (0)
+#else
+#define BENCH_START(ID) do {} while (0)
+#define BENCH_END(ID) do {} while (0)
+#endif
+
+#endif
@@ -5,16 +5,34 @@
 #ifndef COMMON_H
 #define COMMON_H
 
-/* Baud rate of the serial link */
+/* Baud rate of the serial link at startup, and after a re-sync */
 #define BAUD 9600
 
 /* Double speed mode (must be 0 or 1) */
 #define ENABLE_DOUBLESPEED 0
 
-/* Size of the messages transferred between the µC (which is also the size
-   of a message sent to the USB host) */
+/* Faster link speeds, which can be negotiated after the initial sync. Double
+   speed mode is always used for them; at 16 MHz, these baud rates are exact. */
+#define LINK_SPEED_250K 0 /* 250 kbaud */
+#define LINK_SPEED_500K 1 /* 500 kbaud */
+#define LINK_SPEED_1M 2 /* 1 Mbaud */
+
+/* Baud rate of a link speed */
+#define LINK_SPEED_BAUD(SPEED) (250000UL << (SPEED))
+
+/* Link speed requested by the main µC. If the USB µC refuses it, the slower
+   speeds are tried in turn. */
+#define LINK_SPEED_PREFERRED LINK_SPEED_1M
+
+/* Size of the controller data of a message, once decoded (which is also the
+   size of a message sent to the USB host) */
 #define DATA_SIZE 8
 
+/* Number of messages that the USB µC can queue, allowing the main µC to run
+   that many cycles ahead. Each one uses DATA_SIZE + 3 bytes of the USB µC
+   RAM. */
+#define FRAME_QUEUE_SIZE 4
+
 /* Byte index in the message with the magic value */
 #define MAGIC_INDEX (DATA_SIZE - 1)
 
@@ -30,16 +48,155 @@
 /* RX LED state in the magic value byte */
 #define MAGIC_RX_STATE 0x02
 
+/* Header of a message that changes some controller data fields (ORed with the
+   UPDATE_* values of the changed fields). The changed fields follow, then the
+   magic value byte. The fields that are not sent keep their previous value.
+   A message only made of the magic value byte repeats the previous controller
+   data. */
+#define UPDATE_HEADER 0xC0
+
+/* Mask of the bits containing UPDATE_HEADER in a message header */
+#define UPDATE_HEADER_MASK 0xE0
+
+/* Controller data fields in a message header, in the order they are sent */
+#define UPDATE_BUTTONS 0x01 /* Buttons (bytes 0-1 of the controller data) */
+#define UPDATE_D_PAD 0x02 /* D-pad (byte 2) */
+#define UPDATE_L_STICK 0x04 /* L stick X/Y (bytes 3-4) */
+#define UPDATE_R_STICK 0x08 /* R stick X/Y (bytes 5-6) */
+
+/* Message header bit indicating that the controller data is held for several
+   cycles. A 16-bit little-endian repeat value follows the changed fields; the
+   USB µC outputs the data for that many cycles on its own, and only signals
+   the main µC that it can accept another message when the last one starts. */
+#define UPDATE_REPEAT 0x10
+
+/* Flag in the repeat value: the controller data is mashed instead of held.
+   Each repeat then outputs the data for one cycle, followed by one cycle with
+   no buttons pressed and the D-pad neutral (the sticks are unchanged). */
+#define UPDATE_REPEAT_MASH 0x8000
+
+/* Maximum number of repeats in a repeat value */
+#define UPDATE_REPEAT_MAX 0x7FFF
+
+/* Maximum size of a message (header, all fields, repeat value, magic value),
+   excluding the trailer */
+#define MAX_MESSAGE_SIZE (DATA_SIZE + 3)
+
+/* Size of the trailer following the magic value byte of each message: the
+   message sequence number, then a CRC-8 (CCITT polynomial, initial value 0)
+   of all the message bytes, including the sequence number. */
+#define MESSAGE_TRAILER_SIZE 2
+
+/* Mask of the message sequence numbers; each message sent after a re-sync has
+   the next sequence number, starting from 0 */
+#define MESSAGE_SEQUENCE_MASK 0x7F
+
+/* Header of a sequence chunk message, ORed with the number of steps minus 1.
+   The steps follow, then the magic value byte. The USB µC stores the steps
+   in a chunk buffer, and plays them on its own (as a single data update) with
+   the stick positions of the previous output data. */
+#define SEQUENCE_CHUNK_HEADER 0xE0
+
+/* Mask of the bits containing SEQUENCE_CHUNK_HEADER in a message header */
+#define SEQUENCE_CHUNK_HEADER_MASK 0xF0
+
+/* Maximum number of steps in a sequence chunk (at most 16) */
+#define SEQUENCE_CHUNK_STEPS 16
+
+/* Number of chunk buffers in the USB µC, so a chunk can be received while
+   another one is played. Each one uses SEQUENCE_CHUNK_STEPS *
+   SEQUENCE_STEP_SIZE bytes of the USB µC RAM. */
+#define SEQUENCE_CHUNK_COUNT 2
+
+/* Size of a sequence step: buttons (2 bytes, little-endian), D-pad with the
+   SEQUENCE_STEP_MASH flag and the 3 high bits of the number of cycles (or
+   mashes), then the 8 low bits of the number of cycles. */
+#define SEQUENCE_STEP_SIZE 4
+
+/* Flag in the D-pad byte of a sequence step: the buttons are mashed instead
+   of held (see UPDATE_REPEAT_MASH) */
+#define SEQUENCE_STEP_MASH 0x10
+
+/* Nominal interval between USB reports, in ms (the Switch polls the
+   controller every 8 ms). The cycle lengths are multiples of it; the USB µC
+   measures them with the USB frame number (incremented every ms), so the
+   cycles have the same duration whatever the host poll rate is. */
+#define REPORT_INTERVAL_MS 8
+
+/* Length of a cycle in REPORT_INTERVAL_MS units, until changed by a cycle
+   length message (40 ms) */
+#define DEFAULT_CYCLE_LENGTH 5
+
+/* Maximum cycle length, in REPORT_INTERVAL_MS units */
+#define MAX_CYCLE_LENGTH 16
+
+/* Header of a cycle length message, ORed with the cycle length minus 1. The
+   magic value byte follows (its LED state is not used). The new cycle length
+   applies to the data updates (and sequence chunks) sent after this message;
+   it does not use a frame queue slot. */
+#define CYCLE_LENGTH_HEADER 0xF0
+
+/* Mask of the bits containing CYCLE_LENGTH_HEADER in a message header */
+#define CYCLE_LENGTH_HEADER_MASK 0xF0
+
 /* Character sent by the USB µC for initial sync */
 #define INIT_SYNC_CHAR 'I'
 
 /* Character sent by the USB µC for re-sync */
 #define RE_SYNC_CHAR 'S'
 
-/* Character sent by the USB µC when data can be sent by the main µC */
+/* Character sent by the USB µC when data can be sent by the main µC; each
+   one allows sending one message (credit-based flow control) */
 #define READY_FOR_DATA_CHAR 'R'
 
+/* Character sent by the USB µC when a sequence chunk buffer is available;
+   each one allows sending one sequence chunk message (which also needs a
+   ready signal) */
+#define SEQUENCE_READY_CHAR 'C'
+
+/* Character sent by the USB µC when a message was received with an error. The
+   received data is then ignored until a retransmit query is received. */
+#define NAK_CHAR 'N'
+
+/* Sent by the USB µC in response to a retransmit query, ORed with the
+   sequence number of the next message it expects. The ready signals that
+   were sent before are revoked; new ones are sent on the next cycle. */
+#define RETRANSMIT_ACK 0x80
+
+/* Sent by the USB µC every POLL_REPORT_PERIOD ms: average interval between
+   the host polls during that period, in 1/4 ms, in the bits outside of the
+   mask (63 if longer) */
+#define POLL_INTERVAL_REPORT 0x00
+#define POLL_INTERVAL_REPORT_MASK 0xC0
+
+/* Sent by the USB µC after POLL_INTERVAL_REPORT: maximum interval between the
+   host polls during the period, in ms, in the bits outside of the mask (31 if
+   longer) */
+#define MAX_POLL_INTERVAL_REPORT 0x60
+#define MAX_POLL_INTERVAL_REPORT_MASK 0xE0
+
+/* Period of the host poll interval reports, in ms */
+#define POLL_REPORT_PERIOD 1024
+
+/* Character sent by the USB µC to accept a link speed change */
+#define LINK_SPEED_ACK_CHAR 'B'
+
 /* Byte repetitively sent by the main µC to request re-sync */
 #define RE_SYNC_QUERY_BYTE 0x00
 
+/* Byte repetitively sent by the main µC to request a retransmission */
+#define RETRANSMIT_QUERY_BYTE 0x20
+
+/* Number of consecutive re-sync query bytes needed for a re-sync, after a
+   message was received with an error (the rest of the message may contain
+   such bytes) */
+#define ERROR_RE_SYNC_QUERY_COUNT 4
+
+/* Byte repetitively sent by the main µC to request a link speed change; the
+   requested link speed is in the bits outside of the mask */
+#define LINK_SPEED_QUERY_BYTE 0x10
+
+/* Mask of the bits containing LINK_SPEED_QUERY_BYTE in a link speed query */
+#define LINK_SPEED_QUERY_MASK 0xFC
+
 #endif
@@ -5,7 +5,9 @@
  */
 
 #include <avr/io.h>
+#include <avr/interrupt.h>
 #include <avr/wdt.h>
+#include <util/crc16.h>
 #include <LUFA/Drivers/USB/USB.h>
 
 #include <LUFA/Drivers/Board/LEDs.h>
@@ -13,14 +15,25 @@
 
 #include "usb-descriptors.h"
 #include "common.h"
+#include "bench.h"
 
 
 /* Static functions */
 static void process_hid_data(void);
 static void refresh_and_send_controller_data(void);
-static bool refresh_controller_data(void);
+static uint8_t refresh_controller_data(uint8_t* new_seq_credits);
+static void measure_poll_interval(uint16_t frame_number);
+static void start_output_hold(uint16_t repeat);
+static void play_sequence_step(void);
+static void init_serial(uint32_t baud, bool double_speed);
 static void handle_serial_comm(void);
 static void handle_recv_byte(uint8_t recv_byte);
+static void queue_recv_message(void);
+static void link_error(void);
+static void acknowledge_retransmit(void);
+static void reset_recv_state(void);
+static void reset_link_state(void);
+static void change_link_speed(uint8_t speed);
 static void panic(uint8_t mode);
 static void handle_panic_mode(void);
 
@@ -36,15 +49,151 @@ const uint8_t neutral_controller_data[DATA_SIZE] = {
 /* Output data that will be sent to the host */
 static uint8_t out_data[DATA_SIZE];
 
-/* Receive buffer from the main µC */
+/* Mask of the USB frame number */
+#define FRAME_NUMBER_MASK 0x7FF
+
+/* Number of consecutive frame errors after which the serial link goes back to
+   its initial speed */
+#define MAX_FRAME_ERRORS 4
+
+/* Controller data of the last valid message received from the main µC */
+static uint8_t last_recv_data[DATA_SIZE];
+
+/* Controller data of the message being received, decoded over
+   last_recv_data. It is only used once the message is checked. */
 static uint8_t recv_buffer[DATA_SIZE];
 
-/* Number of bytes in the receive buffer */
+/* Number of bytes of the message being received (0 if waiting for the next
+   message) */
 static uint8_t recv_buffer_count;
 
+/* Bytes of the controller data that are still to be received for the current
+   message (bit N set: byte N of recv_buffer) */
+static uint8_t recv_pending_bytes;
+
+/* Repeat value of the message being received, and number of its bytes that
+   are still to be received */
+static uint16_t recv_repeat;
+static uint8_t recv_pending_repeat;
+
+/* Number of trailer bytes of the message being received that are still to be
+   received, received sequence number, and CRC of the message bytes received
+   so far */
+static uint8_t recv_trailer_pending;
+static uint8_t recv_seq;
+static uint8_t recv_crc;
+
+/* Cycle length of the next data updates received, and new cycle length of the
+   message being received (0 if it is not a cycle length message) */
+static uint8_t recv_cycle_length;
+static uint8_t recv_new_cycle_length;
+
+/* Cycle length of the data update being output */
+static uint8_t out_cycle_length;
+
+/* Sequence number of the next message expected from the main µC */
+static uint8_t expected_seq;
+
+/* True if a message was received with an error, and the main µC did not ask
+   for a retransmission yet */
+static bool recv_error;
+
+/* True from a transmission error until the next valid message is received;
+   the output data is kept if there is no data update available, for up to
+   MAX_RECOVERY_CYCLES cycles */
+static bool link_recovering;
+
+/* Number of cycles since the transmission error, while link_recovering is
+   true */
+#define MAX_RECOVERY_CYCLES 50
+static uint8_t recovery_cycles;
+
+/* Data update received from the main µC */
+struct data_update {
+	uint8_t data[DATA_SIZE]; /* Controller data, with the magic value byte */
+	uint16_t repeat; /* Number of cycles, and UPDATE_REPEAT_MASH flag */
+	uint8_t cycle_length; /* Number of USB reports per cycle */
+};
+
+/* Queue of complete data updates received from the main µC, waiting to be
+   output. A repeat value of 0 indicates a sequence chunk. */
+static struct data_update frame_queue[FRAME_QUEUE_SIZE];
+_Static_assert(sizeof(frame_queue) <= 128, "Frame queue too large for the RAM");
+
+/* Index of the oldest data update in the frame queue */
+static uint8_t frame_queue_head;
+
+/* Number of data updates in the frame queue */
+static uint8_t frame_queue_count;
+
+/* Number of ready signals (credits) sent to the main µC for which no data
+   update was received yet. frame_queue_count + granted_credits (+ 1 if the
+   output data is held) never exceeds FRAME_QUEUE_SIZE. */
+static uint8_t granted_credits;
+
+/* Number of cycles for which the current output data is still held, after
+   the current one. While it is non-zero, the data update being output keeps
+   its frame queue slot. */
+static uint16_t out_hold_cycles;
+
+/* True if the current output data is mashed instead of held; the pressed
+   buttons and D-pad bytes are then kept in out_mash_data */
+static bool out_mash;
+static uint8_t out_mash_data[3];
+
+/* Sequence chunk buffers, used in turn. The chunks are played in the order
+   they were received, like the other data updates of the frame queue. */
+static uint8_t seq_chunks[SEQUENCE_CHUNK_COUNT][SEQUENCE_CHUNK_STEPS * SEQUENCE_STEP_SIZE];
+_Static_assert(sizeof(seq_chunks) <= 128, "Chunk buffers too large for the RAM");
+
+/* Number of steps in each sequence chunk buffer */
+static uint8_t seq_chunk_steps[SEQUENCE_CHUNK_COUNT];
+
+/* Index of the oldest sequence chunk (being played, or waiting in the frame
+   queue) */
+static uint8_t seq_chunk_head;
+
+/* Number of sequence chunks received and not completely played */
+static uint8_t seq_chunk_count;
+
+/* Number of sequence ready signals sent to the main µC for which no chunk was
+   received yet */
+static uint8_t granted_seq_credits;
+
+/* True if the oldest sequence chunk is being played, and index of its next
+   step */
+static bool playing_chunk;
+static uint8_t play_pos;
+
+/* True if the message being received is a sequence chunk; position of its next
+   step byte, and number of its step bytes that are still to be received */
+static bool recv_chunk;
+static uint8_t recv_chunk_pos;
+static uint8_t recv_chunk_remaining;
+
+/* Size of the serial link receive ring buffer (power of 2, at most 256). The
+   USART RX interrupt puts the received bytes in it, so they are not lost while
+   the main loop is busy with a long USB control transfer. */
+#define RX_BUFFER_SIZE 32
+
+/* Receive ring buffer, filled by the USART RX ISR. A bit is set in
+   rx_error_flags for each byte that was received with a frame error, or that
+   follows bytes lost because the buffer was full. The indexes are free-running
+   and masked on access. */
+static volatile uint8_t rx_buffer[RX_BUFFER_SIZE];
+static volatile uint8_t rx_error_flags[RX_BUFFER_SIZE / 8];
+static volatile uint8_t rx_head; /* Write index, updated by the RX ISR */
+static volatile uint8_t rx_tail; /* Read index, updated by handle_serial_comm */
+
+/* True if bytes were lost because the receive buffer was full */
+static volatile bool rx_overflow;
+
 /* Non-zero if in panic mode; indicate the number of LED blinks*/
 static uint8_t panic_mode = 0;
 
+/* True if the serial link runs at a negotiated speed instead of BAUD */
+static bool fast_link = false;
+
 
 /*
  * Entry point
@@ -57,7 +206,7 @@ int main(void)
 
 	/* Initialize the LEDs and the serial link */
 	LEDs_Init();
-	Serial_Init(BAUD, ENABLE_DOUBLESPEED);
+	init_serial(BAUD, ENABLE_DOUBLESPEED);
 
 	/* Send the initial sync byte to the main µC */
 	_delay_ms(11);
@@ -69,11 +218,9 @@ int main(void)
 	/* Enable interrupts */
 	GlobalInterruptEnable();
 
-	/* Start with a receive buffer full of neutral controller data, so it is
-	   taken into account for the first output message to the host, and
-	   the ready signal is sent to the main µC */
-	memcpy(recv_buffer, neutral_controller_data, sizeof(recv_buffer));
-	recv_buffer_count = DATA_SIZE;
+	/* Start with neutral controller data and an empty frame queue; the ready
+	   signals will be sent to the main µC on the first cycle */
+	reset_link_state();
 
 	for (;;) {
 		/* Handle serial reception */
@@ -125,7 +272,9 @@ void process_hid_data(void)
 	Endpoint_SelectEndpoint(JOYSTICK_IN_EPADDR);
 
 	if (Endpoint_IsINReady()) {
+		BENCH_START(BENCH_REFRESH_AND_SEND);
 		refresh_and_send_controller_data();
+		BENCH_END(BENCH_REFRESH_AND_SEND);
 	}
 }
 
@@ -137,13 +286,29 @@ void process_hid_data(void)
 void refresh_and_send_controller_data(void)
 {
 	uint8_t status;
-	static uint8_t send_count = 0;
-	bool notify_main_uc = false;
-
-	if (send_count == 0) {
-		/* Need to refresh the controller data on this cycle */
+	static uint16_t cycle_start = 0;
+	uint8_t new_credits = 0;
+	uint8_t new_seq_credits = 0;
+
+	/* The cycles are timed with the USB frame number; a new one starts on the
+	   first poll after the end of the current one. */
+	uint16_t frame_number = USB_Device_GetFrameNumber();
+	uint16_t cycle_duration = out_cycle_length * REPORT_INTERVAL_MS;
+	uint16_t elapsed = (frame_number - cycle_start) & FRAME_NUMBER_MASK;
+
+	if (elapsed >= cycle_duration) {
+		/* Need to refresh the controller data on this cycle. The next cycle
+		   is timed from the theoretical start of this one, unless the host
+		   stopped polling for a while. */
+		if (elapsed >= 2 * cycle_duration) {
+			cycle_start = frame_number;
+		} else {
+			cycle_start = (cycle_start + cycle_duration) & FRAME_NUMBER_MASK;
+		}
 
-		notify_main_uc = refresh_controller_data();
+		BENCH_START(BENCH_REFRESH_CONTROLLER_DATA);
+		new_credits = refresh_controller_data(&new_seq_credits);
+		BENCH_END(BENCH_REFRESH_CONTROLLER_DATA);
 	}
 
 	/* Send the data */
@@ -154,76 +319,158 @@ void refresh_and_send_controller_data(void)
 	/* Notify the IN data */
 	Endpoint_ClearIN();
 
-	if (notify_main_uc) {
+	while (new_credits > 0) {
 		Serial_SendByte(READY_FOR_DATA_CHAR);
+		new_credits -= 1;
+	}
+
+	while (new_seq_credits > 0) {
+		Serial_SendByte(SEQUENCE_READY_CHAR);
+		new_seq_credits -= 1;
+	}
+
+	measure_poll_interval(frame_number);
+}
+
+
+/*
+ * Measure the interval between the host polls, and report it to the main µC
+ * every POLL_REPORT_PERIOD ms. Called on each poll, with the current USB frame
+ * number.
+ */
+void measure_poll_interval(uint16_t frame_number)
+{
+	static uint16_t last_poll = 0;
+	static uint16_t period_start = 0;
+	static uint16_t poll_count = 0;
+	static uint16_t max_interval = 0;
+
+	uint16_t interval = (frame_number - last_poll) & FRAME_NUMBER_MASK;
+	last_poll = frame_number;
+	poll_count += 1;
+
+	if (interval > max_interval) {
+		max_interval = interval;
+	}
+
+	uint16_t elapsed = (frame_number - period_start) & FRAME_NUMBER_MASK;
+	if (elapsed < POLL_REPORT_PERIOD) {
+		return;
+	}
+
+	uint16_t average = (elapsed * 4) / poll_count;
+	if (average > (uint8_t)~POLL_INTERVAL_REPORT_MASK) {
+		average = (uint8_t)~POLL_INTERVAL_REPORT_MASK;
 	}
 
-	send_count += 1;
-	if (send_count == 5) {
-		send_count = 0;
+	if (max_interval > (uint8_t)~MAX_POLL_INTERVAL_REPORT_MASK) {
+		max_interval = (uint8_t)~MAX_POLL_INTERVAL_REPORT_MASK;
 	}
+
+	Serial_SendByte(POLL_INTERVAL_REPORT | average);
+	Serial_SendByte(MAX_POLL_INTERVAL_REPORT | max_interval);
+
+	period_start = frame_number;
+	poll_count = 0;
+	max_interval = 0;
 }
 
 
 /*
  * Refresh the controller data to be sent to the host.
- * Returns true if the main µC should be notified that it can send more data.
+ * Returns the number of ready signals to send to the main µC, one for each
+ * frame queue slot that became available; the number of sequence ready
+ * signals to send is stored in new_seq_credits.
  */
-bool refresh_controller_data(void)
+uint8_t refresh_controller_data(uint8_t* new_seq_credits)
 {
-	bool notify_main_uc = false;
 	static uint8_t prev_recv_count = 0;
 
 	if (panic_mode) {
-		return false;
+		return 0;
 	}
 
 	/* Refresh the controller data */
-	if (recv_buffer_count == DATA_SIZE) {
-		uint8_t magic_data = recv_buffer[MAGIC_INDEX];
+	if (out_hold_cycles > 0) {
+		/* The current data update is held for more cycles. If it is mashed,
+		   alternate between the pressed and the released buttons, ending with
+		   the released buttons. */
+		out_hold_cycles -= 1;
+
+		if (out_mash) {
+			if (out_hold_cycles & 1) {
+				memcpy(out_data, out_mash_data, sizeof(out_mash_data));
+			} else {
+				memcpy(out_data, neutral_controller_data, sizeof(out_mash_data));
+			}
+		}
 
-		if ((magic_data & MAGIC_MASK) == MAGIC_VALUE) {
-			/* Magic value OK, update LED state and controller data */
-			uint8_t new_led_state = 0;
+	} else if (playing_chunk) {
+		/* Play the next step of the current sequence chunk */
+		play_sequence_step();
 
-			if (magic_data & MAGIC_TX_STATE) {
-				new_led_state |= LEDMASK_TX;
-			}
+	} else if (frame_queue_count > 0) {
+		/* Output the oldest data update; its magic value was already checked
+		   when it was received. Update the LED state and controller data. */
+		const struct data_update* update = &frame_queue[frame_queue_head];
+		const uint8_t* frame = update->data;
+		uint8_t magic_data = frame[MAGIC_INDEX];
+		uint8_t new_led_state = 0;
 
-			if (magic_data & MAGIC_RX_STATE) {
-				new_led_state |= LEDMASK_RX;
-			}
+		if (magic_data & MAGIC_TX_STATE) {
+			new_led_state |= LEDMASK_TX;
+		}
 
-			LEDs_SetAllLEDs(new_led_state);
+		if (magic_data & MAGIC_RX_STATE) {
+			new_led_state |= LEDMASK_RX;
+		}
 
-			/* Don’t copy the magic byte to the controller data, leave it 0 */
-			memcpy(out_data, recv_buffer, DATA_SIZE - 1);
+		LEDs_SetAllLEDs(new_led_state);
 
-			/* Empty the receive buffer and notify the main µC */
-			memset(recv_buffer, 0, sizeof(recv_buffer));
-			recv_buffer_count = 0;
-			notify_main_uc = true;
+		out_cycle_length = update->cycle_length;
+
+		if (update->repeat == 0) {
+			/* Sequence chunk; start playing its first step */
+			playing_chunk = true;
+			play_pos = 0;
+			play_sequence_step();
 		} else {
-			/* Invalid data received */
-			panic(2);
+			/* Don’t copy the magic byte to the controller data, leave it 0 */
+			memcpy(out_data, frame, DATA_SIZE - 1);
+			start_output_hold(update->repeat);
+		}
+
+		frame_queue_head += 1;
+		if (frame_queue_head == FRAME_QUEUE_SIZE) {
+			frame_queue_head = 0;
 		}
 
+		frame_queue_count -= 1;
+
+	} else if (link_recovering && (recovery_cycles < MAX_RECOVERY_CYCLES)) {
+		/* The main µC has not sent the data updates again yet; keep the current
+		   output data. If the link does not recover in time, the empty queue is
+		   handled as usual below (panic if the output data is not neutral). */
+		recovery_cycles += 1;
+
 	} else if (memcmp(out_data, neutral_controller_data, DATA_SIZE - 1) != 0) {
-		/* The receive buffer was not full, and the output data is not neutral. */
+		/* The frame queue is empty, and the output data is not neutral. */
 		if (recv_buffer_count == 0) {
 			/* The main µC did not send any message on this cycle */
 			panic(2);
 		} else {
-			/* The main µC failed to send a message sufficiently quickly. Note that this
-			   is not an error if the current output data is neutral; after sending
-			   neutral data, the main µC is allowed to sleep for an arbitrary amount of
-			   time. When it starts sending data again, it’s not synchronized with
-			   the USB µC, so this function may be called while it’s sending data.
-
-			   When the main µC starts sending non-neutral controller data messages, it’s
-			   not supposed to sleep for long periods of time; this means it will stay
-			   roughly synchronized with the USB µC’s cycles, and received messages
-			   should always be complete when this function is called. */
+			/* The main µC failed to send a message sufficiently quickly. Note
+			   that this is not an error if the current output data is neutral;
+			   after sending neutral data, the main µC is allowed to sleep for
+			   an arbitrary amount of time. When it starts sending data again,
+			   it’s not synchronized with the USB µC, so this function may be
+			   called while it’s sending data.
+
+			   When the main µC starts sending non-neutral controller data
+			   messages, it’s not supposed to sleep for long periods of time;
+			   this means it will stay roughly synchronized with the USB µC’s
+			   cycles (or ahead of them, using the frame queue), and messages
+			   should always be queued when this function is called. */
 			panic(3);
 		}
 	} else if ((recv_buffer_count != 0) && (prev_recv_count == recv_buffer_count)) {
@@ -234,24 +481,140 @@ bool refresh_controller_data(void)
 
 	prev_recv_count = recv_buffer_count;
 
-	return notify_main_uc;
+	if (panic_mode) {
+		return 0;
+	}
+
+	/* A sequence chunk is finished on the last cycle of its last step; its
+	   buffer can then be reused */
+	if (playing_chunk && (out_hold_cycles == 0) &&
+			(play_pos == seq_chunk_steps[seq_chunk_head])) {
+		playing_chunk = false;
+
+		seq_chunk_head += 1;
+		if (seq_chunk_head == SEQUENCE_CHUNK_COUNT) {
+			seq_chunk_head = 0;
+		}
+
+		seq_chunk_count -= 1;
+	}
+
+	/* Grant a credit for each frame queue slot that is free and not already
+	   promised to the main µC. The slot of a held data update (or of a
+	   sequence chunk) is only freed on its last cycle, so the main µC knows
+	   when the hold is finished. */
+	uint8_t new_credits = FRAME_QUEUE_SIZE - frame_queue_count - granted_credits;
+	if ((out_hold_cycles > 0) || playing_chunk) {
+		new_credits -= 1;
+	}
+
+	granted_credits += new_credits;
+
+	/* Same thing for the sequence chunk buffers */
+	*new_seq_credits = SEQUENCE_CHUNK_COUNT - seq_chunk_count -
+		granted_seq_credits;
+	granted_seq_credits += *new_seq_credits;
+
+	return new_credits;
+}
+
+
+/*
+ * Hold the controller data in the output buffer for the specified number of
+ * cycles (twice as many if mashed), including the current one. The repeat
+ * value must not be zero.
+ */
+void start_output_hold(uint16_t repeat)
+{
+	out_mash = repeat & UPDATE_REPEAT_MASH;
+	out_hold_cycles = repeat & UPDATE_REPEAT_MAX;
+	if (out_mash) {
+		memcpy(out_mash_data, out_data, sizeof(out_mash_data));
+		out_hold_cycles *= 2;
+	}
+
+	out_hold_cycles -= 1;
 }
 
 
 /*
- * Receive and process data from the main µC on the serial link.
+ * Put the next step of the sequence chunk being played in the output buffer.
+ * The sticks keep their current position; an invalid D-pad state (which the
+ * main µC never sends) is replaced by the neutral one, so the host never
+ * receives it.
+ */
+void play_sequence_step(void)
+{
+	const uint8_t* step = &seq_chunks[seq_chunk_head][play_pos * SEQUENCE_STEP_SIZE];
+	uint16_t repeat = ((uint16_t)(step[2] >> 5) << 8) | step[3];
+	uint8_t d_pad = step[2] & 0x0F;
+
+	if (step[2] & SEQUENCE_STEP_MASH) {
+		repeat |= UPDATE_REPEAT_MASH;
+	}
+
+	if (d_pad > neutral_controller_data[2]) {
+		d_pad = neutral_controller_data[2];
+	}
+
+	out_data[0] = step[0];
+	out_data[1] = step[1];
+	out_data[2] = d_pad;
+
+	play_pos += 1;
+
+	start_output_hold(repeat);
+}
+
+
+/*
+ * Initialize the serial link at the specified speed, with the receive
+ * interrupt enabled. The bytes that are still in the receive buffer are kept.
+ */
+void init_serial(uint32_t baud, bool double_speed)
+{
+	Serial_Init(baud, double_speed);
+	UCSR1B |= _BV(RXCIE1);
+}
+
+
+/*
+ * Process the data received from the main µC on the serial link.
  */
 void handle_serial_comm(void)
 {
-	int16_t recv_val;
+	static uint8_t frame_error_count = 0;
+
+	while (rx_tail != rx_head) {
+		/* The ISR only writes after rx_head, so this entry is stable */
+		uint8_t pos = rx_tail & (RX_BUFFER_SIZE - 1);
+		uint8_t recv_byte = rx_buffer[pos];
+		bool frame_error = rx_error_flags[pos / 8] & (1 << (pos % 8));
+
+		rx_tail += 1;
+
+		if (frame_error) {
+			/* The byte is garbage, so the message being received is lost.
+			   If a faster link speed was negotiated and frame errors keep
+			   happening, the main µC is probably sending at the initial speed
+			   after being reset; go back to it so its re-sync query can be
+			   understood. */
+			link_error();
+
+			frame_error_count += 1;
+			if (fast_link && (frame_error_count >= MAX_FRAME_ERRORS)) {
+				init_serial(BAUD, ENABLE_DOUBLESPEED);
+				fast_link = false;
+			}
 
-	for (;;) {
-		recv_val = Serial_ReceiveByte();
-		if (recv_val < 0) {
-			return;
+			continue;
 		}
 
-		handle_recv_byte((uint8_t)recv_val);
+		frame_error_count = 0;
+
+		BENCH_START(BENCH_HANDLE_RECV_BYTE);
+		handle_recv_byte(recv_byte);
+		BENCH_END(BENCH_HANDLE_RECV_BYTE);
 	}
 }
 
@@ -261,26 +624,377 @@ void handle_serial_comm(void)
  */
 void handle_recv_byte(uint8_t recv_byte)
 {
-	if ((recv_buffer_count >= (DATA_SIZE) - 1) && (recv_byte == RE_SYNC_QUERY_BYTE)) {
+	static uint8_t re_sync_query_count = 0;
+
+	if (recv_error) {
+		/* A message was received with an error; ignore the data until the
+		   main µC asks for a retransmission. The rest of the message may
+		   contain re-sync query bytes, so several ones are needed. */
+		if (recv_byte == RETRANSMIT_QUERY_BYTE) {
+			acknowledge_retransmit();
+
+		} else if (recv_byte == RE_SYNC_QUERY_BYTE) {
+			re_sync_query_count += 1;
+			if (re_sync_query_count == ERROR_RE_SYNC_QUERY_COUNT) {
+				Serial_SendByte(RE_SYNC_CHAR);
+				reset_link_state();
+			}
+
+		} else {
+			re_sync_query_count = 0;
+		}
+
+		return;
+	}
+
+	re_sync_query_count = 0;
+
+	/* Update the CRC of the message, which covers all its bytes but the last */
+	if (recv_buffer_count == 0) {
+		recv_crc = 0;
+	}
+
+	if (recv_trailer_pending != 1) {
+		recv_crc = _crc8_ccitt_update(recv_crc, recv_byte);
+	}
+
+	if (recv_trailer_pending == 2) {
+		/* Message sequence number */
+		recv_seq = recv_byte;
+		recv_trailer_pending = 1;
+		recv_buffer_count += 1;
+
+	} else if (recv_trailer_pending == 1) {
+		/* CRC; the message is complete */
+		recv_trailer_pending = 0;
+		recv_buffer_count = 0;
+
+		if ((recv_byte != recv_crc) || (recv_seq != expected_seq)) {
+			/* The message was corrupted, or a previous one was lost */
+			link_error();
+
+		} else if (granted_credits == 0) {
+			/* Data received while the frame queue was full */
+			panic(4);
+
+		} else {
+			queue_recv_message();
+		}
+
+	} else if (recv_pending_bytes != 0) {
+		/* Controller data field byte; put it at the lowest pending position */
+		uint8_t index = 0;
+		while (!(recv_pending_bytes & (1 << index))) {
+			index += 1;
+		}
+
+		recv_buffer[index] = recv_byte;
+		recv_pending_bytes &= ~(1 << index);
+		recv_buffer_count += 1;
+
+	} else if (recv_chunk_remaining != 0) {
+		/* Sequence step byte; the number of cycles of each step (at the end)
+		   must not be zero */
+		uint8_t chunk = seq_chunk_head + seq_chunk_count;
+		if (chunk >= SEQUENCE_CHUNK_COUNT) {
+			chunk -= SEQUENCE_CHUNK_COUNT;
+		}
+
+		uint8_t* step_byte = &seq_chunks[chunk][recv_chunk_pos];
+		*step_byte = recv_byte;
+
+		if (((recv_chunk_pos % SEQUENCE_STEP_SIZE) == SEQUENCE_STEP_SIZE - 1) &&
+				((step_byte[-1] >> 5) == 0) && (recv_byte == 0)) {
+			link_error();
+			return;
+		}
+
+		recv_chunk_pos += 1;
+		recv_chunk_remaining -= 1;
+		recv_buffer_count += 1;
+
+	} else if (recv_pending_repeat != 0) {
+		/* Repeat value byte, least significant byte first */
+		recv_repeat = (recv_repeat >> 8) | ((uint16_t)recv_byte << 8);
+		recv_pending_repeat -= 1;
+		recv_buffer_count += 1;
+
+	/* The next cases happen at the start or at the end of a message */
+	} else if (recv_byte == RE_SYNC_QUERY_BYTE) {
 		/* Re-sync query received from the main µC; acknowledge it and
-		   reset controller data. The main µC will receive a new data
-		   query on the next cycle. */
+		   reset controller data. The main µC will receive new ready
+		   signals on the next cycle. */
 		Serial_SendByte(RE_SYNC_CHAR);
 
-		panic_mode = 0;
+		reset_link_state();
 
-		memcpy(recv_buffer, neutral_controller_data, sizeof(recv_buffer));
-		recv_buffer_count = DATA_SIZE;
+	} else if ((recv_byte & LINK_SPEED_QUERY_MASK) == LINK_SPEED_QUERY_BYTE) {
+		/* Link speed change query; this also acts as a re-sync query. */
+		change_link_speed(recv_byte & ~LINK_SPEED_QUERY_MASK);
+
+		reset_link_state();
+
+	} else if (recv_byte == RETRANSMIT_QUERY_BYTE) {
+		/* Retransmit query received while no error was detected; the main µC
+		   may have received a corrupted signal */
+		acknowledge_retransmit();
+
+	} else if ((recv_buffer_count == 0) &&
+			((recv_byte & UPDATE_HEADER_MASK) == UPDATE_HEADER)) {
+		/* Message header; the message is decoded over the previous controller
+		   data. Determine which bytes will be received. */
+		memcpy(recv_buffer, last_recv_data, DATA_SIZE);
+
+		if (recv_byte & UPDATE_BUTTONS) {
+			recv_pending_bytes |= 0x03;
+		}
+
+		if (recv_byte & UPDATE_D_PAD) {
+			recv_pending_bytes |= 0x04;
+		}
+
+		if (recv_byte & UPDATE_L_STICK) {
+			recv_pending_bytes |= 0x18;
+		}
+
+		if (recv_byte & UPDATE_R_STICK) {
+			recv_pending_bytes |= 0x60;
+		}
+
+		if (recv_byte & UPDATE_REPEAT) {
+			recv_pending_repeat = 2;
+		}
 
-	} else if (recv_buffer_count < DATA_SIZE) {
-		/* Normal data received */
-		recv_buffer[recv_buffer_count] = recv_byte;
+		recv_repeat = 1;
+		recv_buffer_count = 1;
+
+	} else if ((recv_buffer_count == 0) &&
+			((recv_byte & SEQUENCE_CHUNK_HEADER_MASK) == SEQUENCE_CHUNK_HEADER)) {
+		/* Sequence chunk header; the steps are received directly in the next
+		   chunk buffer */
+		if (granted_seq_credits == 0) {
+			/* Chunk sent while all chunk buffers were used; this may be a
+			   corrupted message header */
+			link_error();
+			return;
+		}
+
+		uint8_t chunk = seq_chunk_head + seq_chunk_count;
+		if (chunk >= SEQUENCE_CHUNK_COUNT) {
+			chunk -= SEQUENCE_CHUNK_COUNT;
+		}
+
+		seq_chunk_steps[chunk] = (recv_byte & ~SEQUENCE_CHUNK_HEADER_MASK) + 1;
+		recv_chunk = true;
+		recv_chunk_pos = 0;
+		recv_chunk_remaining = seq_chunk_steps[chunk] * SEQUENCE_STEP_SIZE;
+		recv_buffer_count = 1;
+
+	} else if ((recv_buffer_count == 0) &&
+			((recv_byte & CYCLE_LENGTH_HEADER_MASK) == CYCLE_LENGTH_HEADER)) {
+		/* Cycle length message header */
+		recv_new_cycle_length = (recv_byte & ~CYCLE_LENGTH_HEADER_MASK) + 1;
+		recv_buffer_count = 1;
+
+	} else if (((recv_byte & MAGIC_MASK) != MAGIC_VALUE) ||
+			((recv_repeat & UPDATE_REPEAT_MAX) == 0)) {
+		/* Invalid data received */
+		link_error();
+
+	} else {
+		/* End of the message (or single magic value byte, repeating the
+		   previous controller data); the trailer follows */
+		if (recv_buffer_count == 0) {
+			memcpy(recv_buffer, last_recv_data, DATA_SIZE);
+		}
+
+		recv_buffer[MAGIC_INDEX] = recv_byte;
+		recv_trailer_pending = 2;
 		recv_buffer_count += 1;
+	}
+}
+
+
+/*
+ * Add the message that was just received, and checked, to the frame queue (or
+ * apply it, for a cycle length message).
+ */
+void queue_recv_message(void)
+{
+	uint8_t tail = frame_queue_head + frame_queue_count;
+	if (tail >= FRAME_QUEUE_SIZE) {
+		tail -= FRAME_QUEUE_SIZE;
+	}
+
+	expected_seq = (expected_seq + 1) & MESSAGE_SEQUENCE_MASK;
+	link_recovering = false;
+
+	if (recv_new_cycle_length != 0) {
+		/* Cycle length message; it used a ready signal, but no frame queue
+		   slot. A new ready signal will be sent on the next cycle. */
+		recv_cycle_length = recv_new_cycle_length;
+		recv_new_cycle_length = 0;
+		granted_credits -= 1;
+		return;
+	}
+
+	frame_queue[tail].cycle_length = recv_cycle_length;
+
+	if (recv_chunk) {
+		/* The sequence chunk is already in its buffer; the frame queue entry
+		   only holds the LED state. The previous controller data is not
+		   changed. */
+		frame_queue[tail].data[MAGIC_INDEX] = recv_buffer[MAGIC_INDEX];
+		frame_queue[tail].repeat = 0;
+		recv_chunk = false;
 
+		seq_chunk_count += 1;
+		granted_seq_credits -= 1;
 	} else {
-		/* Data received while the buffer was full */
-		panic(4);
+		memcpy(last_recv_data, recv_buffer, DATA_SIZE);
+		memcpy(frame_queue[tail].data, recv_buffer, DATA_SIZE);
+		frame_queue[tail].repeat = recv_repeat;
+	}
+
+	recv_repeat = 1;
+
+	frame_queue_count += 1;
+	granted_credits -= 1;
+}
+
+
+/*
+ * Handle a transmission error: signal it to the main µC (once), and ignore the
+ * received data until it asks for a retransmission.
+ */
+void link_error(void)
+{
+	if (!recv_error) {
+		Serial_SendByte(NAK_CHAR);
+		recv_error = true;
+		link_recovering = true;
+		recovery_cycles = 0;
 	}
+
+	reset_recv_state();
+}
+
+
+/*
+ * Respond to a retransmit query from the main µC, with the sequence number of
+ * the next message to send. The ready signals not used yet are revoked; the
+ * main µC will receive new ones on the next cycle.
+ */
+void acknowledge_retransmit(void)
+{
+	Serial_SendByte(RETRANSMIT_ACK | expected_seq);
+
+	recv_error = false;
+	reset_recv_state();
+
+	granted_credits = 0;
+	granted_seq_credits = 0;
+}
+
+
+/*
+ * Forget the message being received.
+ */
+void reset_recv_state(void)
+{
+	recv_buffer_count = 0;
+	recv_pending_bytes = 0;
+	recv_repeat = 1;
+	recv_pending_repeat = 0;
+	recv_chunk = false;
+	recv_chunk_remaining = 0;
+	recv_new_cycle_length = 0;
+	recv_trailer_pending = 0;
+}
+
+
+/*
+ * Reset the controller data to neutral (including the reference data for the
+ * next message), empty the frame queue, and leave panic mode. The main µC will
+ * receive new ready signals on the next cycle.
+ */
+void reset_link_state(void)
+{
+	panic_mode = 0;
+
+	memcpy(out_data, neutral_controller_data, DATA_SIZE - 1);
+	LEDs_SetAllLEDs(LEDS_NO_LEDS);
+
+	memcpy(last_recv_data, neutral_controller_data, DATA_SIZE);
+	reset_recv_state();
+	recv_error = false;
+	link_recovering = false;
+	expected_seq = 0;
+	recv_cycle_length = DEFAULT_CYCLE_LENGTH;
+	out_cycle_length = DEFAULT_CYCLE_LENGTH;
+	frame_queue_head = 0;
+	frame_queue_count = 0;
+	granted_credits = 0;
+	out_hold_cycles = 0;
+	seq_chunk_head = 0;
+	seq_chunk_count = 0;
+	granted_seq_credits = 0;
+	playing_chunk = false;
+}
+
+
+/*
+ * Switch the serial link to the specified speed (LINK_SPEED_*), after
+ * acknowledging the change to the main µC. If the speed is not supported, the
+ * change is refused by sending a re-sync character instead, and the link stays
+ * at its current speed.
+ */
+void change_link_speed(uint8_t speed)
+{
+	if (speed > LINK_SPEED_1M) {
+		Serial_SendByte(RE_SYNC_CHAR);
+		return;
+	}
+
+	/* The acknowledge must be fully sent before the speed changes. The TX
+	   complete flag is cleared by writing it to 1. */
+	UCSR1A |= _BV(TXC1);
+	Serial_SendByte(LINK_SPEED_ACK_CHAR);
+	loop_until_bit_is_set(UCSR1A, TXC1);
+
+	init_serial(LINK_SPEED_BAUD(speed), true);
+	fast_link = true;
+}
+
+
+/* Serial link byte received */
+ISR(USART1_RX_vect)
+{
+	/* The frame error flag must be read before the received byte */
+	bool frame_error = bit_is_set(UCSR1A, FE1);
+	uint8_t recv_byte = UDR1;
+
+	uint8_t head = rx_head;
+	if ((uint8_t)(head - rx_tail) == RX_BUFFER_SIZE) {
+		/* No room for the byte; the message it belongs to is lost */
+		rx_overflow = true;
+		return;
+	}
+
+	/* Lost bytes are signaled like a frame error on the next byte, so the
+	   message being received is rejected */
+	uint8_t pos = head & (RX_BUFFER_SIZE - 1);
+	uint8_t mask = 1 << (pos % 8);
+
+	rx_buffer[pos] = recv_byte;
+	if (frame_error || rx_overflow) {
+		rx_error_flags[pos / 8] |= mask;
+	} else {
+		rx_error_flags[pos / 8] &= ~mask;
+	}
+
+	rx_overflow = false;
+	rx_head = head + 1;
 }
 
 
@@ -0,0 +1,903 @@
+/*
+ * Co-simulation of the two µCs of the Arduino UNO with simavr.
+ *
+ * The USB interface program (ATmega16U2) and an automation program
+ * (ATmega328P) run in two simulated µCs, cycle by cycle, with their serial
+ * links connected. A virtual USB host enumerates the USB µC, then polls its
+ * IN endpoint at a regular interval. The push button of the main µC can be
+ * pressed at given times.
+ *
+ * At the end of the run, the link and timing statistics are printed:
+ *  - the time taken to transfer each message from the main µC, and the time
+ *    between a ready signal of the USB µC and the start of the next message;
+ *  - the host polls and the report changes;
+ *  - the part of the time the main µC is awake (computing or busy-waiting)
+ *    instead of sleeping.
+ *
+ * With programs built with the benchmark markers (see bench.h), the CPU
+ * cycles of the benchmarked sections are also measured (excluding the time
+ * spent sleeping, and the marker overhead), written as JSON, and optionally
+ * compared with a previous result. The run then ends when the main µC
+ * program signals the end of its benchmarks.
+ *
+ * Usage: cosim [-p POLL_MS] [-t SECONDS] [-b PRESSES] [-j JSON_FILE]
+ *              [-c BASELINE_FILE] [-T PERCENT] USB_IFACE_ELF MAIN_ELF
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <sim_avr.h>
+#include <sim_elf.h>
+#include <sim_time.h>
+#include <sim_cycle_timers.h>
+#include <avr_uart.h>
+#include <avr_ioport.h>
+#include <avr_usb.h>
+
+#include "common.h"
+#include "bench.h"
+
+
+/* CPU frequency of both µCs */
+#define CPU_FREQ 16000000
+
+/* USB frame number registers of the USB µC. The frame number is maintained
+   by the harness, since it depends on the virtual host. */
+#define UDFNUML_ADDR 0xE4
+#define UDFNUMH_ADDR 0xE5
+
+/* Benchmark marker register (GPIOR0) of both µCs, in the data space */
+#define GPIOR0_ADDR 0x3E
+
+/* Interval between the steps of the USB host enumeration, in µs */
+#define ENUM_STEP_US 125
+
+/* IN endpoint of the controller reports (JOYSTICK_IN_EPADDR), and its size */
+#define REPORT_PIPE 1
+#define REPORT_EP_SIZE 64
+
+/* Push button pin of the main µC (digital pin 12, port B bit 4), time it is
+   held and released between presses (ms) */
+#define BUTTON_PIN 4
+#define PRESS_HOLD_MS 100
+#define PRESS_GAP_MS 150
+
+/* Maximum number of press groups */
+#define MAX_PRESS_GROUPS 64
+
+
+/* Min/max/average statistics */
+struct timing_stat {
+	uint64_t count;
+	uint64_t total;
+	uint64_t min;
+	uint64_t max;
+};
+
+/* USB host state */
+enum host_state {
+	HOST_DETACHED,
+	HOST_RESET,
+	HOST_SET_ADDRESS,
+	HOST_SET_ADDRESS_STATUS,
+	HOST_SET_CONFIGURATION,
+	HOST_SET_CONFIGURATION_STATUS,
+	HOST_CONFIGURED,
+};
+
+/* USB setup packet */
+struct setup_packet {
+	uint8_t request_type;
+	uint8_t request;
+	uint16_t value;
+	uint16_t index;
+	uint16_t length;
+} __attribute__((packed));
+
+/* Press group: number of presses, and start time (ms) */
+struct press_group {
+	unsigned count;
+	uint64_t start_ms;
+};
+
+
+/* Simulated µCs */
+static avr_t* usb_avr;
+static avr_t* main_avr;
+
+/* Serial link input IRQs */
+static avr_irq_t* usb_uart_in;
+static avr_irq_t* main_uart_in;
+
+/* Push button IRQ, and its current state */
+static avr_irq_t* button_irq;
+static bool button_held;
+
+/* Press groups */
+static struct press_group presses[MAX_PRESS_GROUPS];
+static unsigned press_count;
+
+/* USB host state, poll interval (in cycles) and report statistics */
+static enum host_state host_state = HOST_DETACHED;
+static avr_cycle_count_t poll_interval = 8 * (CPU_FREQ / 1000);
+static uint64_t poll_count;
+static uint64_t nak_count;
+static uint64_t report_changes;
+static uint8_t last_report[DATA_SIZE];
+
+/* Decoding of the messages sent by the main µC: bytes remaining in the current
+   one, and cycle of its first byte */
+static unsigned msg_remaining;
+static avr_cycle_count_t msg_start;
+
+/* Cycle of the oldest ready signal that was not followed by a message (0 if
+   none) */
+static avr_cycle_count_t ready_time;
+
+/* Message statistics, in cycles */
+static struct timing_stat msg_transfer;
+static struct timing_stat ready_to_msg;
+
+/* Cycles during which the main µC was awake and asleep, and during which
+   the USB µC was asleep */
+static uint64_t main_awake_cycles;
+static uint64_t main_sleep_cycles;
+static uint64_t usb_sleep_cycles;
+
+/* Benchmark names, in bench_id order */
+static const char* const bench_names[BENCH_COUNT] = {
+	"calibration",
+	"send_current",
+	"send_button_sequence_step",
+	"s_scaled",
+	"handle_recv_byte",
+	"refresh_controller_data",
+	"refresh_and_send_controller_data",
+	"init_persist",
+	"persist_set_value",
+	"script_instruction",
+};
+
+/* Benchmark results, in awake cycles, and state of the sections being
+   measured: cycle and sleep cycles at their start */
+static struct timing_stat bench_stats[BENCH_COUNT];
+static avr_cycle_count_t bench_start[BENCH_COUNT];
+static uint64_t bench_start_sleep[BENCH_COUNT];
+static bool bench_running[BENCH_COUNT];
+
+/* The main µC program signaled the end of the benchmarks */
+static bool bench_done;
+
+/* Benchmark result file (NULL if not measured), previous result file to
+   compare with, and regression threshold in percent */
+static const char* bench_file;
+static const char* baseline_file;
+static double bench_threshold = 5;
+
+
+/* Static functions */
+static void usage(const char* prog_name);
+static bool parse_presses(const char* spec);
+static avr_t* load_mcu(const char* path, const char* mcu_name,
+	const char* fallback_name);
+static void disable_uart_stdio(avr_t* avr, char name);
+static void main_uart_out(avr_irq_t* irq, uint32_t value, void* param);
+static void usb_uart_out(avr_irq_t* irq, uint32_t value, void* param);
+static unsigned message_size(uint8_t header);
+static void usb_attach(avr_irq_t* irq, uint32_t value, void* param);
+static avr_cycle_count_t frame_timer(avr_t* avr, avr_cycle_count_t when,
+	void* param);
+static avr_cycle_count_t host_timer(avr_t* avr, avr_cycle_count_t when,
+	void* param);
+static bool send_setup(uint8_t request, uint16_t value);
+static bool read_status(void);
+static void poll_reports(void);
+static void update_button(void);
+static void add_stat(struct timing_stat* stat, uint64_t value);
+static void print_stat(const char* name, const struct timing_stat* stat);
+static void bench_marker(avr_t* avr, avr_io_addr_t addr, uint8_t value,
+	void* param);
+static bool write_bench_results(void);
+static bool compare_bench_results(void);
+static double baseline_average(const char* baseline, const char* name);
+
+
+int main(int argc, char* argv[])
+{
+	double time_limit = 60;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "b:c:j:p:t:T:h")) != -1) {
+		switch (opt) {
+			case 'b':
+				if (!parse_presses(optarg)) {
+					fprintf(stderr, "Invalid button presses: %s\n", optarg);
+					return 2;
+				}
+			break;
+
+			case 'p': {
+				long interval = strtol(optarg, NULL, 10);
+				if ((interval < 1) || (interval > 32)) {
+					fprintf(stderr, "The poll interval must be between 1 and 32 ms\n");
+					return 2;
+				}
+
+				poll_interval = interval * (CPU_FREQ / 1000);
+			}
+			break;
+
+			case 'c':
+				baseline_file = optarg;
+			break;
+
+			case 'j':
+				bench_file = optarg;
+			break;
+
+			case 't':
+				time_limit = strtod(optarg, NULL);
+			break;
+
+			case 'T':
+				bench_threshold = strtod(optarg, NULL);
+			break;
+
+			default:
+				usage(argv[0]);
+				return (opt == 'h') ? 0 : 2;
+		}
+	}
+
+	if (argc - optind != 2) {
+		usage(argv[0]);
+		return 2;
+	}
+
+	/* simavr has no ATmega16U2 core; the AT90USB162 has the same USB and
+	   serial controllers */
+	usb_avr = load_mcu(argv[optind], "atmega16u2", "at90usb162");
+	main_avr = load_mcu(argv[optind + 1], "atmega328p", NULL);
+
+	if ((usb_avr == NULL) || (main_avr == NULL)) {
+		return 1;
+	}
+
+	/* Cross-connect the serial links */
+	disable_uart_stdio(usb_avr, '1');
+	disable_uart_stdio(main_avr, '0');
+
+	usb_uart_in = avr_io_getirq(usb_avr, AVR_IOCTL_UART_GETIRQ('1'), UART_IRQ_INPUT);
+	main_uart_in = avr_io_getirq(main_avr, AVR_IOCTL_UART_GETIRQ('0'), UART_IRQ_INPUT);
+
+	avr_irq_register_notify(avr_io_getirq(main_avr, AVR_IOCTL_UART_GETIRQ('0'),
+		UART_IRQ_OUTPUT), &main_uart_out, NULL);
+	avr_irq_register_notify(avr_io_getirq(usb_avr, AVR_IOCTL_UART_GETIRQ('1'),
+		UART_IRQ_OUTPUT), &usb_uart_out, NULL);
+
+	/* Virtual USB host; it is powered from the start, and enumerates the
+	   device once it attaches */
+	avr_irq_register_notify(avr_io_getirq(usb_avr, AVR_IOCTL_USB_GETIRQ(),
+		USB_IRQ_ATTACH), &usb_attach, NULL);
+	avr_ioctl(usb_avr, AVR_IOCTL_USB_VBUS, (void*)1);
+	avr_cycle_timer_register_usec(usb_avr, 1000, &frame_timer, NULL);
+
+	/* Benchmark markers */
+	if (bench_file != NULL) {
+		avr_register_io_write(main_avr, GPIOR0_ADDR, &bench_marker, NULL);
+		avr_register_io_write(usb_avr, GPIOR0_ADDR, &bench_marker, NULL);
+	}
+
+	/* Push button, released */
+	button_irq = avr_io_getirq(main_avr, AVR_IOCTL_IOPORT_GETIRQ('B'), BUTTON_PIN);
+	avr_raise_irq(button_irq, 1);
+
+	memcpy(last_report, (const uint8_t[]){ 0, 0, 0x08, 128, 128, 128, 128, 0 },
+		DATA_SIZE);
+
+	/* Run both µCs in lockstep, until the time limit */
+	const avr_cycle_count_t end_cycle = time_limit * CPU_FREQ;
+	struct timespec wall_start;
+	struct timespec wall_end;
+
+	clock_gettime(CLOCK_MONOTONIC, &wall_start);
+
+	while (((main_avr->cycle < end_cycle) || (usb_avr->cycle < end_cycle)) &&
+			!bench_done) {
+		int state;
+
+		if (main_avr->cycle <= usb_avr->cycle) {
+			avr_cycle_count_t start = main_avr->cycle;
+			bool sleeping = (main_avr->state == cpu_Sleeping);
+
+			state = avr_run(main_avr);
+
+			if (sleeping) {
+				main_sleep_cycles += main_avr->cycle - start;
+			} else {
+				main_awake_cycles += main_avr->cycle - start;
+			}
+
+			update_button();
+		} else {
+			avr_cycle_count_t start = usb_avr->cycle;
+			bool sleeping = (usb_avr->state == cpu_Sleeping);
+
+			state = avr_run(usb_avr);
+
+			if (sleeping) {
+				usb_sleep_cycles += usb_avr->cycle - start;
+			}
+		}
+
+		if ((state == cpu_Done) || (state == cpu_Crashed)) {
+			fprintf(stderr, "A simulated µC stopped (%s)\n",
+				(state == cpu_Crashed) ? "crashed" : "done");
+			break;
+		}
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &wall_end);
+
+	double virtual_time = (double)main_avr->cycle / CPU_FREQ;
+	double wall_time = (wall_end.tv_sec - wall_start.tv_sec) +
+		(wall_end.tv_nsec - wall_start.tv_nsec) / 1e9;
+	uint64_t main_cycles = main_awake_cycles + main_sleep_cycles;
+
+	printf("Virtual time: %.3f s, wall time: %.3f s\n", virtual_time, wall_time);
+	printf("Host polls: %llu, %llu without a report, %llu report changes\n",
+		(unsigned long long)poll_count, (unsigned long long)nak_count,
+		(unsigned long long)report_changes);
+	print_stat("Message transfer", &msg_transfer);
+	print_stat("Ready signal to message", &ready_to_msg);
+	printf("Main µC: awake (computing or busy-waiting) %.2f%%, asleep %.2f%%\n",
+		main_cycles ? 100.0 * main_awake_cycles / main_cycles : 0.0,
+		main_cycles ? 100.0 * main_sleep_cycles / main_cycles : 0.0);
+
+	if (bench_file != NULL) {
+		if (!bench_done) {
+			fprintf(stderr, "The benchmarks did not complete\n");
+			return 1;
+		}
+
+		if (!write_bench_results()) {
+			return 1;
+		}
+
+		if ((baseline_file != NULL) && !compare_bench_results()) {
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+
+/*
+ * Print the command line usage.
+ */
+void usage(const char* prog_name)
+{
+	fprintf(stderr,
+		"Usage: %s [-p POLL_MS] [-t SECONDS] [-b PRESSES] [-j JSON_FILE]\n"
+		"       [-c BASELINE_FILE] [-T PERCENT] USB_IFACE_ELF MAIN_ELF\n"
+		"Run the USB interface and an automation program in simulated µCs.\n"
+		"\n"
+		"  -b PRESSES       button presses, as a comma-separated list of press\n"
+		"                   groups COUNT@SECONDS: COUNT presses, starting at SECONDS\n"
+		"  -c BASELINE_FILE compare the benchmark results with a previous result\n"
+		"  -j JSON_FILE     write the benchmark results to this file\n"
+		"  -p POLL_MS       USB host poll interval (8 for a Switch, 1 for a PC)\n"
+		"  -t SECONDS       maximum duration of the run (default: 60)\n"
+		"  -T PERCENT       regression threshold of the comparison (default: 5)\n",
+		prog_name);
+}
+
+
+/*
+ * Parse the press groups.
+ */
+bool parse_presses(const char* spec)
+{
+	while (*spec != '\0') {
+		char* end;
+		long count = strtol(spec, &end, 10);
+
+		if ((end == spec) || (count < 1) || (*end != '@') ||
+				(press_count == MAX_PRESS_GROUPS)) {
+			return false;
+		}
+
+		spec = end + 1;
+		double start = strtod(spec, &end);
+		if ((end == spec) || (start < 0)) {
+			return false;
+		}
+
+		spec = end;
+		if (*spec == ',') {
+			spec += 1;
+		} else if (*spec != '\0') {
+			return false;
+		}
+
+		presses[press_count].count = count;
+		presses[press_count].start_ms = start * 1000;
+		press_count += 1;
+	}
+
+	return true;
+}
+
+
+/*
+ * Create a simulated µC and load a program in it. The µC model is the one
+ * specified in the ELF file if any, or the specified one (or its fallback if
+ * simavr does not support it).
+ */
+avr_t* load_mcu(const char* path, const char* mcu_name, const char* fallback_name)
+{
+	elf_firmware_t firmware;
+	memset(&firmware, 0, sizeof(firmware));
+
+	if (elf_read_firmware(path, &firmware) != 0) {
+		fprintf(stderr, "Unable to load %s\n", path);
+		return NULL;
+	}
+
+	if (firmware.mmcu[0] == '\0') {
+		strncpy(firmware.mmcu, mcu_name, sizeof(firmware.mmcu) - 1);
+	}
+
+	avr_t* avr = avr_make_mcu_by_name(firmware.mmcu);
+	if ((avr == NULL) && (fallback_name != NULL)) {
+		avr = avr_make_mcu_by_name(fallback_name);
+	}
+
+	if (avr == NULL) {
+		fprintf(stderr, "simavr does not support the %s µC\n", firmware.mmcu);
+		return NULL;
+	}
+
+	avr_init(avr);
+	firmware.frequency = CPU_FREQ;
+	avr_load_firmware(avr, &firmware);
+
+	return avr;
+}
+
+
+/*
+ * Disable the output of a serial link on the standard output.
+ */
+void disable_uart_stdio(avr_t* avr, char name)
+{
+	uint32_t flags = 0;
+
+	avr_ioctl(avr, AVR_IOCTL_UART_GET_FLAGS(name), &flags);
+	flags &= ~AVR_UART_FLAG_STDIO;
+	avr_ioctl(avr, AVR_IOCTL_UART_SET_FLAGS(name), &flags);
+}
+
+
+/*
+ * Byte sent by the main µC: forward it to the USB µC, and track the message
+ * boundaries.
+ */
+void main_uart_out(avr_irq_t* irq, uint32_t value, void* param)
+{
+	(void)irq;
+	(void)param;
+
+	avr_raise_irq(usb_uart_in, value);
+
+	avr_cycle_count_t now = main_avr->cycle;
+
+	if (msg_remaining == 0) {
+		msg_remaining = message_size(value);
+		msg_start = now;
+
+		if ((msg_remaining > 1) && (ready_time != 0)) {
+			add_stat(&ready_to_msg, now - ready_time);
+			ready_time = 0;
+		}
+	}
+
+	msg_remaining -= 1;
+
+	if (msg_remaining == 0) {
+		add_stat(&msg_transfer, now - msg_start);
+	}
+}
+
+
+/*
+ * Byte sent by the USB µC: forward it to the main µC, and note the ready
+ * signals.
+ */
+void usb_uart_out(avr_irq_t* irq, uint32_t value, void* param)
+{
+	(void)irq;
+	(void)param;
+
+	avr_raise_irq(main_uart_in, value);
+
+	if ((value == READY_FOR_DATA_CHAR) && (ready_time == 0)) {
+		ready_time = usb_avr->cycle;
+	}
+}
+
+
+/*
+ * Returns the size of a message sent by the main µC (including its trailer),
+ * from its first byte. The sync queries are single bytes.
+ */
+unsigned message_size(uint8_t header)
+{
+	/* Magic value byte and trailer */
+	const unsigned trailer = 1 + MESSAGE_TRAILER_SIZE;
+
+	if ((header == RE_SYNC_QUERY_BYTE) || (header == RETRANSMIT_QUERY_BYTE) ||
+			((header & LINK_SPEED_QUERY_MASK) == LINK_SPEED_QUERY_BYTE)) {
+		return 1;
+	}
+
+	if ((header & UPDATE_HEADER_MASK) == UPDATE_HEADER) {
+		unsigned size = 1 + trailer;
+
+		size += (header & UPDATE_BUTTONS) ? 2 : 0;
+		size += (header & UPDATE_D_PAD) ? 1 : 0;
+		size += (header & UPDATE_L_STICK) ? 2 : 0;
+		size += (header & UPDATE_R_STICK) ? 2 : 0;
+		size += (header & UPDATE_REPEAT) ? 2 : 0;
+
+		return size;
+	}
+
+	if ((header & SEQUENCE_CHUNK_HEADER_MASK) == SEQUENCE_CHUNK_HEADER) {
+		unsigned steps = (header & ~SEQUENCE_CHUNK_HEADER_MASK) + 1;
+		return 1 + steps * SEQUENCE_STEP_SIZE + trailer;
+	}
+
+	if ((header & CYCLE_LENGTH_HEADER_MASK) == CYCLE_LENGTH_HEADER) {
+		return 1 + trailer;
+	}
+
+	/* Magic value alone */
+	return trailer;
+}
+
+
+/*
+ * The USB µC attached to (or detached from) the bus.
+ */
+void usb_attach(avr_irq_t* irq, uint32_t value, void* param)
+{
+	(void)irq;
+	(void)param;
+
+	if (value && (host_state == HOST_DETACHED)) {
+		host_state = HOST_RESET;
+		avr_cycle_timer_register_usec(usb_avr, ENUM_STEP_US, &host_timer, NULL);
+	} else if (!value) {
+		host_state = HOST_DETACHED;
+	}
+}
+
+
+/*
+ * Update the USB frame number, every ms.
+ */
+avr_cycle_count_t frame_timer(avr_t* avr, avr_cycle_count_t when, void* param)
+{
+	(void)param;
+
+	uint16_t frame = (when / (CPU_FREQ / 1000)) & 0x7FF;
+
+	avr->data[UDFNUML_ADDR] = frame & 0xFF;
+	avr->data[UDFNUMH_ADDR] = frame >> 8;
+
+	return when + avr_usec_to_cycles(avr, 1000);
+}
+
+
+/*
+ * Enumerate the device (set its address and configuration), then poll the
+ * reports.
+ */
+avr_cycle_count_t host_timer(avr_t* avr, avr_cycle_count_t when, void* param)
+{
+	(void)param;
+
+	switch (host_state) {
+		case HOST_DETACHED:
+			return 0;
+
+		case HOST_RESET:
+			avr_ioctl(avr, AVR_IOCTL_USB_RESET, NULL);
+			host_state = HOST_SET_ADDRESS;
+		break;
+
+		case HOST_SET_ADDRESS:
+			if (send_setup(5, 1)) {
+				host_state = HOST_SET_ADDRESS_STATUS;
+			}
+		break;
+
+		case HOST_SET_ADDRESS_STATUS:
+			if (read_status()) {
+				host_state = HOST_SET_CONFIGURATION;
+			}
+		break;
+
+		case HOST_SET_CONFIGURATION:
+			if (send_setup(9, 1)) {
+				host_state = HOST_SET_CONFIGURATION_STATUS;
+			}
+		break;
+
+		case HOST_SET_CONFIGURATION_STATUS:
+			if (read_status()) {
+				host_state = HOST_CONFIGURED;
+			}
+		break;
+
+		case HOST_CONFIGURED:
+			poll_reports();
+			return when + poll_interval;
+	}
+
+	return when + avr_usec_to_cycles(avr, ENUM_STEP_US);
+}
+
+
+/*
+ * Send a standard request without data to the device. Returns true if it was
+ * accepted.
+ */
+bool send_setup(uint8_t request, uint16_t value)
+{
+	struct setup_packet setup = { 0x00, request, value, 0, 0 };
+	struct avr_io_usb packet = { 0, sizeof(setup), (uint8_t*)&setup };
+
+	return avr_ioctl(usb_avr, AVR_IOCTL_USB_SETUP, &packet) == 0;
+}
+
+
+/*
+ * Read the status stage (zero-length IN packet) of a request. Returns true
+ * once the device sent it.
+ */
+bool read_status(void)
+{
+	uint8_t buffer[8];
+	struct avr_io_usb packet = { 0, sizeof(buffer), buffer };
+
+	return avr_ioctl(usb_avr, AVR_IOCTL_USB_READ, &packet) == 0;
+}
+
+
+/*
+ * Poll the IN endpoint for a report.
+ */
+void poll_reports(void)
+{
+	uint8_t buffer[REPORT_EP_SIZE];
+	struct avr_io_usb packet = { REPORT_PIPE, sizeof(buffer), buffer };
+
+	poll_count += 1;
+
+	if (avr_ioctl(usb_avr, AVR_IOCTL_USB_READ, &packet) != 0) {
+		nak_count += 1;
+		return;
+	}
+
+	if ((packet.sz >= DATA_SIZE) && (memcmp(buffer, last_report, DATA_SIZE) != 0)) {
+		memcpy(last_report, buffer, DATA_SIZE);
+		report_changes += 1;
+	}
+}
+
+
+/*
+ * Update the push button state from the press groups.
+ */
+void update_button(void)
+{
+	const uint64_t press_cycles = (PRESS_HOLD_MS + PRESS_GAP_MS) * (CPU_FREQ / 1000);
+	uint64_t now = main_avr->cycle;
+	bool held = false;
+
+	for (unsigned idx = 0 ; idx < press_count ; idx += 1) {
+		uint64_t start = presses[idx].start_ms * (CPU_FREQ / 1000);
+
+		if ((now >= start) && (now < start + presses[idx].count * press_cycles)) {
+			held = ((now - start) % press_cycles) < PRESS_HOLD_MS * (CPU_FREQ / 1000);
+			break;
+		}
+	}
+
+	if (held != button_held) {
+		button_held = held;
+		avr_raise_irq(button_irq, held ? 0 : 1);
+	}
+}
+
+
+/*
+ * Add a value to statistics.
+ */
+void add_stat(struct timing_stat* stat, uint64_t value)
+{
+	if ((stat->count == 0) || (value < stat->min)) {
+		stat->min = value;
+	}
+
+	if (value > stat->max) {
+		stat->max = value;
+	}
+
+	stat->total += value;
+	stat->count += 1;
+}
+
+
+/*
+ * Print statistics (in cycles) in µs.
+ */
+void print_stat(const char* name, const struct timing_stat* stat)
+{
+	if (stat->count == 0) {
+		printf("%s: none\n", name);
+		return;
+	}
+
+	const double us_cycles = CPU_FREQ / 1e6;
+
+	printf("%s: %llu, min %.1f µs, avg %.1f µs, max %.1f µs\n", name,
+		(unsigned long long)stat->count, stat->min / us_cycles,
+		(double)stat->total / stat->count / us_cycles, stat->max / us_cycles);
+}
+
+
+/*
+ * Benchmark marker written by a µC: start or end of a section.
+ */
+void bench_marker(avr_t* avr, avr_io_addr_t addr, uint8_t value, void* param)
+{
+	(void)param;
+
+	avr->data[addr] = value;
+
+	uint8_t id = value & ~BENCH_END_FLAG;
+	uint64_t sleep_cycles = (avr == main_avr) ? main_sleep_cycles : usb_sleep_cycles;
+
+	if (id >= BENCH_COUNT) {
+		bench_done = true;
+		return;
+	}
+
+	if (!(value & BENCH_END_FLAG)) {
+		bench_start[id] = avr->cycle;
+		bench_start_sleep[id] = sleep_cycles;
+		bench_running[id] = true;
+	} else if (bench_running[id]) {
+		add_stat(&bench_stats[id], (avr->cycle - bench_start[id]) -
+			(sleep_cycles - bench_start_sleep[id]));
+		bench_running[id] = false;
+	}
+}
+
+
+/*
+ * Write the benchmark results, without the marker overhead (the shortest
+ * calibration section). Returns false on a write error.
+ */
+bool write_bench_results(void)
+{
+	FILE* file = (strcmp(bench_file, "-") == 0) ? stdout : fopen(bench_file, "w");
+	if (file == NULL) {
+		fprintf(stderr, "Unable to create %s\n", bench_file);
+		return false;
+	}
+
+	uint64_t overhead = bench_stats[BENCH_CALIBRATION].min;
+
+	fprintf(file, "{\n\t\"poll_interval_ms\": %llu,\n\t\"marker_overhead\": %llu,\n"
+		"\t\"benchmarks\": {\n", (unsigned long long)(poll_interval / (CPU_FREQ / 1000)),
+		(unsigned long long)overhead);
+
+	for (unsigned id = BENCH_CALIBRATION + 1 ; id < BENCH_COUNT ; id += 1) {
+		const struct timing_stat* stat = &bench_stats[id];
+		double average = stat->count ? (double)stat->total / stat->count - overhead : 0;
+
+		fprintf(file, "\t\t\"%s\": { \"count\": %llu, \"min\": %llu, "
+			"\"avg\": %.1f, \"max\": %llu }%s\n", bench_names[id],
+			(unsigned long long)stat->count,
+			(unsigned long long)(stat->count ? stat->min - overhead : 0), average,
+			(unsigned long long)(stat->count ? stat->max - overhead : 0),
+			(id + 1 < BENCH_COUNT) ? "," : "");
+	}
+
+	fprintf(file, "\t}\n}\n");
+
+	if ((file != stdout) && (fclose(file) != 0)) {
+		fprintf(stderr, "Unable to write %s\n", bench_file);
+		return false;
+	}
+
+	return true;
+}
+
+
+/*
+ * Compare the average cycles of the benchmarks with the baseline file.
+ * Returns false if one of them is slower by more than the threshold.
+ */
+bool compare_bench_results(void)
+{
+	FILE* file = fopen(baseline_file, "r");
+	if (file == NULL) {
+		fprintf(stderr, "Unable to open %s\n", baseline_file);
+		return false;
+	}
+
+	char baseline[4096];
+	size_t size = fread(baseline, 1, sizeof(baseline) - 1, file);
+	baseline[size] = '\0';
+	fclose(file);
+
+	uint64_t overhead = bench_stats[BENCH_CALIBRATION].min;
+	bool success = true;
+
+	for (unsigned id = BENCH_CALIBRATION + 1 ; id < BENCH_COUNT ; id += 1) {
+		const struct timing_stat* stat = &bench_stats[id];
+		double previous = baseline_average(baseline, bench_names[id]);
+
+		if ((stat->count == 0) || (previous <= 0)) {
+			continue;
+		}
+
+		double average = (double)stat->total / stat->count - overhead;
+		double change = 100 * (average - previous) / previous;
+
+		printf("%-34s %9.1f cycles (baseline %9.1f, %+.1f%%)%s\n", bench_names[id],
+			average, previous, change,
+			(change > bench_threshold) ? " REGRESSION" : "");
+
+		if (change > bench_threshold) {
+			success = false;
+		}
+	}
+
+	return success;
+}
+
+
+/*
+ * Returns the average cycles of a benchmark in a result file content, or 0 if
+ * it is not found.
+ */
+double baseline_average(const char* baseline, const char* name)
+{
+	char key[64];
+	snprintf(key, sizeof(key), "\"%s\":", name);
+
+	const char* entry = strstr(baseline, key);
+	if (entry == NULL) {
+		return 0;
+	}
+
+	const char* average = strstr(entry, "\"avg\":");
+	double value = 0;
+
+	if ((average == NULL) || (sscanf(average + 6, "%lf", &value) != 1)) {
+		return 0;
+	}
+
+	return value;
+}
@@ -0,0 +1,482 @@
+#!/usr/bin/env python3
+
+"""
+Model of the Switch HOME menu, System Settings and controller pairing screen.
+Reads the USB reports of a trace file (see src/host/trace.h), and reports how
+the menus react to them: where the cursor ends up, the clock settings, the
+state of the virtual controller, and the inputs that were ignored because the
+console was busy.
+
+Each screen change takes some time (its load time) during which the inputs
+are ignored, and an input is only accepted some time after the previous one
+(the input acceptance latency). For each screen change, the slack is the
+time between the end of its load time and the next input: the waits of the
+sequences can be cut by that much (inputs that arrive during a load time,
+like the rest of a mashed button, are not counted).
+
+The user actions are not in the trace: when the virtual controller leaves the
+Change Grip/Order screen idle for a while (see switch_controller), the user is
+assumed to register their controller and go back to the HOME menu.
+"""
+
+import argparse
+import pathlib
+import sys
+
+from regress import read_trace
+
+
+# Report fields (see the report layout in src/host/trace.h)
+HAT_NEUTRAL = 8
+HAT_DIRECTIONS = {0: 'up', 2: 'right', 4: 'down', 6: 'left'}
+
+# Buttons of the report, by bit (see enum button_state in automation.h)
+BUTTONS = {
+    0x0001: 'Y', 0x0002: 'B', 0x0004: 'A', 0x0008: 'X',
+    0x0010: 'L', 0x0020: 'R', 0x0040: 'ZL', 0x0080: 'ZR',
+    0x0100: '-', 0x0200: '+', 0x1000: 'HOME', 0x2000: 'Capture',
+}
+
+# HOME menu icons below the software, since system update 11.0, and before it
+HOME_ICONS = ['Nintendo Switch Online', 'News', 'Nintendo eShop', 'Album',
+    'Controllers', 'System Settings', 'Sleep Mode']
+OLD_HOME_ICONS = HOME_ICONS[1:]
+
+# System Settings categories, and the items of the System category
+SETTINGS_CATEGORIES = ['Airplane Mode', 'Screen Brightness', 'Parental Controls',
+    'Internet', 'Data Management', 'User', 'Mii', 'amiibo', 'Themes',
+    'Notifications', 'Sleep Mode', 'Controllers and Sensors', 'TV Output',
+    'Lock Screen', 'System']
+SYSTEM_ITEMS = ['System Update', 'Console Nickname', 'Language', 'Region',
+    'Date and Time', 'Console', 'Formatting Options']
+
+# Date and Time screen items; the last one is disabled while the clock is
+# synchronized
+DATE_TIME_ITEMS = ['Synchronize Clock via Internet', 'Time Zone', 'Date and Time']
+
+# Fields of the clock setting screen; A goes to the next one
+CLOCK_FIELDS = ['month', 'day', 'year', 'hour', 'minute', 'OK']
+
+# Controllers screen items
+CONTROLLERS_ITEMS = ['Change Grip/Order', 'Find Controllers',
+    'Update Controllers', 'Disconnect Controllers']
+
+# Load time of each screen change, in ms (the inputs are ignored meanwhile)
+DEFAULT_LOAD_MS = {
+    'home': 800, # HOME menu, from the software or a settings screen
+    'software': 1200, # Back to the software, from the HOME menu
+    'software-start': 1500, # Start of the software, from the HOME menu
+    'close-dialog': 500, # “Close the software?” dialog
+    'software-close': 2500, # Software closing
+    'controllers': 300, # Controllers screen
+    'local-comm-dialog': 300, # “Interrupt local communication?” dialog
+    'grip-order': 1500, # Change Grip/Order screen
+    'settings': 600, # System Settings
+    'settings-pane': 150, # Focus moved to the items of a category
+    'date-time': 150, # Date and Time screen
+    'time-zone': 150, # Time Zone screen
+    'clock': 60, # Clock setting screen
+}
+
+# Duration of a cycle of the automation programs (default cycle length), to
+# express the slack in cycles
+CYCLE_MS = 40
+
+
+class Menu:
+    """
+    State of the console menus, updated by the controller inputs
+    """
+
+    def __init__(self, args):
+        self.args = args
+        self.load_ms = dict(DEFAULT_LOAD_MS)
+        self.load_ms.update(args.load)
+        self.icons = OLD_HOME_ICONS if args.old_home else HOME_ICONS
+
+        self.screen = 'home'
+        self.row = 'software' # HOME menu row
+        self.cursor = 0 # Cursor position in the current screen
+        self.home_cursor = ('software', 0) # Kept while in a HOME menu screen
+        self.pane = 'categories' # System Settings pane with the focus
+        self.category = 0
+        self.software_running = True
+        self.clock_auto = not args.manual_clock
+        self.year_offset = 0 # Year change applied to the clock
+        self.pending_year = 0 # Year change in the clock setting screen
+        self.virtual = 'disconnected' # Virtual controller state
+        self.local_comm = args.local_comm
+
+        self.busy_until = 0
+        self.last_input = None
+        self.transition = None # Screen change waiting for its next input
+        self.slacks = {} # Screen change → list of slacks (ms)
+        self.ignored = {'loading': 0, 'latency': 0}
+        self.accepted = 0
+        self.warnings = []
+
+    def log(self, time_us, text):
+        if self.args.verbose:
+            print(f"[{time_us / 1e6:11.3f}] {text}")
+
+    def warn(self, time_us, text):
+        self.warnings.append(f"{time_us / 1e6:.3f} s: {text}")
+        self.log(time_us, f"warning: {text}")
+
+    def location(self):
+        """
+        Description of the screen and of the cursor position
+        """
+
+        if self.screen == 'home':
+            if self.row == 'software':
+                return f"HOME menu, software {self.cursor + 1}"
+            return f"HOME menu, {self.icons[self.cursor]}"
+        if self.screen == 'settings':
+            category = SETTINGS_CATEGORIES[self.category]
+            if self.pane == 'categories':
+                return f"System Settings, {category}"
+            return f"System Settings, {category} > {SYSTEM_ITEMS[self.cursor]}"
+        if self.screen == 'date-time':
+            return f"Date and Time, {DATE_TIME_ITEMS[self.cursor]}"
+        if self.screen == 'clock':
+            return f"clock setting, {CLOCK_FIELDS[self.cursor]}"
+        if self.screen == 'controllers':
+            return f"Controllers, {CONTROLLERS_ITEMS[self.cursor]}"
+        return self.screen
+
+    def change_screen(self, time_us, screen, load, cursor=0):
+        self.screen = screen
+        self.cursor = cursor
+        self.busy_until = time_us + self.load_ms[load] * 1000
+        self.transition = (load, self.busy_until)
+        self.log(time_us, f"-> {self.location()} (loading {self.load_ms[load]:g} ms)")
+
+    def input(self, time_us, name):
+        """
+        Handle a button press or D-pad direction of the virtual controller
+        """
+
+        if self.transition is not None and time_us >= self.transition[1]:
+            kind, ready = self.transition
+            self.slacks.setdefault(kind, []).append((time_us - ready) / 1000)
+            self.transition = None
+
+        if self.screen == 'software' and name != 'HOME':
+            # Software inputs, not handled by the model
+            return
+
+        if self.virtual == 'disconnected':
+            # Any button wakes the controller up; the press is not passed on
+            self.virtual = 'connected'
+            self.log(time_us, f"{name}: virtual controller connected")
+            return
+
+        if time_us < self.busy_until:
+            self.ignored['loading'] += 1
+            self.log(time_us, f"{name}: ignored (loading)")
+            return
+
+        if self.last_input is not None and \
+                time_us - self.last_input < self.args.latency * 1000:
+            self.ignored['latency'] += 1
+            self.log(time_us, f"{name}: ignored (input latency)")
+            return
+
+        self.last_input = time_us
+        self.accepted += 1
+        screen = self.screen
+        getattr(self, 'on_' + screen.replace('-', '_'))(time_us, name)
+
+        if self.screen == screen:
+            self.log(time_us, f"{name}: {self.location()}")
+
+    def idle(self, time_us, gap_us):
+        """
+        No input for gap_us until time_us: in the Change Grip/Order screen,
+        the user registers their controller and goes back to the HOME menu
+        (the virtual controller is then disconnected)
+        """
+
+        if self.screen == 'grip-order' and self.virtual == 'connected' and \
+                gap_us >= self.args.user_gap * 1e6:
+            self.virtual = 'disconnected'
+            self.screen = 'home'
+            self.row, self.cursor = 'software', 0
+            self.log(time_us, "user: controller registered, back to the "
+                "HOME menu (virtual controller disconnected)")
+
+    def move(self, direction, size):
+        step = {'up': -1, 'left': -1, 'down': 1, 'right': 1}[direction]
+        self.cursor = min(max(self.cursor + step, 0), size - 1)
+
+    def go_home(self, time_us, from_software=False):
+        if from_software:
+            self.row, self.cursor = 'software', 0
+        else:
+            self.row, self.cursor = self.home_cursor
+        self.change_screen(time_us, 'home', 'home', self.cursor)
+
+    def on_home(self, time_us, name):
+        if name in ('left', 'right'):
+            self.move(name, self.args.software if self.row == 'software'
+                else len(self.icons))
+        elif name == 'down' and self.row == 'software':
+            self.row, self.cursor = 'icons', 0
+        elif name == 'up' and self.row == 'icons':
+            self.row, self.cursor = 'software', 0
+        elif name == 'HOME':
+            if self.software_running:
+                self.change_screen(time_us, 'software', 'software')
+        elif name == 'X' and self.row == 'software' and self.software_running:
+            self.home_cursor = (self.row, self.cursor)
+            self.change_screen(time_us, 'close-dialog', 'close-dialog')
+        elif name == 'A' and self.row == 'software':
+            load = 'software' if self.software_running else 'software-start'
+            self.software_running = True
+            self.change_screen(time_us, 'software', load)
+        elif name == 'A':
+            icon = self.icons[self.cursor]
+            self.home_cursor = (self.row, self.cursor)
+            if icon == 'Controllers':
+                self.change_screen(time_us, 'controllers', 'controllers')
+            elif icon == 'System Settings':
+                self.pane, self.category = 'categories', 0
+                self.change_screen(time_us, 'settings', 'settings')
+            else:
+                self.warn(time_us, f"{icon} opened (not modeled)")
+                self.change_screen(time_us, icon, 'settings')
+
+    def on_software(self, time_us, name):
+        if name == 'HOME':
+            self.go_home(time_us, from_software=True)
+
+    def on_close_dialog(self, time_us, name):
+        if name == 'A':
+            self.software_running = False
+            self.row, self.cursor = self.home_cursor
+            self.change_screen(time_us, 'home', 'software-close', self.cursor)
+        elif name in ('B', 'HOME'):
+            self.row, self.cursor = self.home_cursor
+            self.change_screen(time_us, 'home', 'home', self.cursor)
+
+    def on_controllers(self, time_us, name):
+        if name in ('up', 'down'):
+            self.move(name, len(CONTROLLERS_ITEMS))
+        elif name == 'A' and self.cursor == 0:
+            if self.local_comm:
+                self.change_screen(time_us, 'local-comm-dialog', 'local-comm-dialog')
+            else:
+                self.change_screen(time_us, 'grip-order', 'grip-order')
+        elif name == 'A':
+            self.warn(time_us, f"{CONTROLLERS_ITEMS[self.cursor]} opened (not modeled)")
+        elif name in ('B', 'HOME'):
+            self.go_home(time_us)
+
+    def on_local_comm_dialog(self, time_us, name):
+        if name == 'A':
+            self.local_comm = False
+            self.change_screen(time_us, 'grip-order', 'grip-order')
+        elif name == 'B':
+            self.change_screen(time_us, 'controllers', 'controllers')
+
+    def on_grip_order(self, time_us, name):
+        if name == 'A' and self.virtual != 'player 1':
+            self.virtual = 'player 1'
+            self.log(time_us, "virtual controller registered as player 1")
+        elif name == 'HOME':
+            self.go_home(time_us)
+
+    def on_settings(self, time_us, name):
+        if self.pane == 'categories':
+            if name in ('up', 'down'):
+                self.category = min(max(self.category +
+                    (1 if name == 'down' else -1), 0), len(SETTINGS_CATEGORIES) - 1)
+            elif name in ('right', 'A'):
+                if SETTINGS_CATEGORIES[self.category] != 'System':
+                    self.warn(time_us, f"{SETTINGS_CATEGORIES[self.category]} "
+                        "category entered (not modeled)")
+                self.pane = 'items'
+                self.change_screen(time_us, 'settings', 'settings-pane')
+            elif name in ('B', 'HOME'):
+                self.go_home(time_us)
+        else:
+            if name in ('up', 'down'):
+                self.move(name, len(SYSTEM_ITEMS))
+            elif name in ('left', 'B'):
+                self.pane = 'categories'
+                self.change_screen(time_us, 'settings', 'settings-pane')
+            elif name == 'A' and SYSTEM_ITEMS[self.cursor] == 'Date and Time':
+                self.change_screen(time_us, 'date-time', 'date-time')
+            elif name == 'A':
+                self.warn(time_us, f"{SYSTEM_ITEMS[self.cursor]} opened (not modeled)")
+            elif name == 'HOME':
+                self.go_home(time_us)
+
+    def on_date_time(self, time_us, name):
+        # The clock setting is disabled while the clock is synchronized
+        enabled = len(DATE_TIME_ITEMS) - (1 if self.clock_auto else 0)
+
+        if name in ('up', 'down'):
+            self.move(name, enabled)
+        elif name == 'A' and self.cursor == 0:
+            self.clock_auto = not self.clock_auto
+            self.log(time_us, "clock synchronization " +
+                ("enabled" if self.clock_auto else "disabled"))
+        elif name == 'A' and self.cursor == 1:
+            self.change_screen(time_us, 'time-zone', 'time-zone')
+        elif name == 'A':
+            self.pending_year = 0
+            self.change_screen(time_us, 'clock', 'clock')
+        elif name == 'B':
+            self.pane = 'items'
+            self.change_screen(time_us, 'settings', 'settings-pane',
+                SYSTEM_ITEMS.index('Date and Time'))
+        elif name == 'HOME':
+            self.go_home(time_us)
+
+    def on_time_zone(self, time_us, name):
+        if name == 'B':
+            self.change_screen(time_us, 'date-time', 'date-time', 1)
+        elif name == 'HOME':
+            self.go_home(time_us)
+
+    def on_clock(self, time_us, name):
+        field = CLOCK_FIELDS[self.cursor]
+
+        if name in ('left', 'right'):
+            self.move(name, len(CLOCK_FIELDS))
+        elif name in ('up', 'down') and field == 'year':
+            self.pending_year += 1 if name == 'up' else -1
+        elif name == 'A' and field == 'OK':
+            self.year_offset += self.pending_year
+            self.log(time_us, f"clock set, year {self.pending_year:+d}")
+            self.change_screen(time_us, 'date-time', 'date-time', 2)
+        elif name == 'A':
+            self.cursor += 1
+        elif name == 'B':
+            self.change_screen(time_us, 'date-time', 'date-time', 2)
+        elif name == 'HOME':
+            self.go_home(time_us)
+
+    def __getattr__(self, name):
+        # Screens that are not modeled: only the HOME button is handled
+        if name.startswith('on_'):
+            return lambda time_us, button: \
+                self.go_home(time_us) if button == 'HOME' else None
+        raise AttributeError(name)
+
+
+def inputs(records, args):
+    """
+    Returns the inputs of the report changes, with their time: newly pressed
+    buttons and D-pad directions (held directions repeat, like on the
+    console). Inputs at the same time as the previous report change are
+    grouped.
+    """
+
+    events = []
+    prev_buttons = 0
+    prev_hat = HAT_NEUTRAL
+
+    for idx, (time_us, report) in enumerate(records):
+        buttons = int.from_bytes(report[0:2], 'little')
+        hat = report[2]
+
+        for bit, name in BUTTONS.items():
+            if buttons & bit and not prev_buttons & bit:
+                events.append((time_us, name))
+
+        if hat != prev_hat and hat in HAT_DIRECTIONS:
+            direction = HAT_DIRECTIONS[hat]
+            events.append((time_us, direction))
+
+            # Repeats while held, until the next report change
+            end_us = records[idx + 1][0] if idx + 1 < len(records) else time_us
+            repeat_us = time_us + args.repeat_delay * 1000
+            while repeat_us < end_us:
+                events.append((repeat_us, direction))
+                repeat_us += args.repeat_interval * 1000
+
+        prev_buttons = buttons
+        prev_hat = hat
+
+    return events
+
+
+def run():
+    """
+    Program entry point
+    """
+
+    parser = argparse.ArgumentParser(description=__doc__)
+    parser.add_argument('trace', type=pathlib.Path, help="Trace file")
+    parser.add_argument('-l', '--latency', type=float, default=30,
+        help="Input acceptance latency: minimum time between two accepted "
+        "inputs, in ms (default: 30)")
+    parser.add_argument('--load', action='append', default=[],
+        type=lambda spec: (spec.split('=')[0], float(spec.split('=')[1])),
+        metavar='SCREEN=MS', help="Load time of a screen change (screens: " +
+        ', '.join(f"{name} ({value:g} ms)" for name, value in DEFAULT_LOAD_MS.items()) +
+        ")")
+    parser.add_argument('--repeat-delay', type=float, default=500,
+        help="Time a D-pad direction is held before it repeats, in ms")
+    parser.add_argument('--repeat-interval', type=float, default=100,
+        help="Interval of the repeats of a held D-pad direction, in ms")
+    parser.add_argument('--user-gap', type=float, default=2.5,
+        help="Time without inputs in the Change Grip/Order screen after which "
+        "the user takes over, in seconds; it must be longer than the waits of "
+        "the sequences in that screen (default: 2.5)")
+    parser.add_argument('--software', type=int, default=1,
+        help="Number of software icons in the HOME menu")
+    parser.add_argument('--old-home', action='store_true',
+        help="HOME menu before system update 11.0 (no Switch Online icon)")
+    parser.add_argument('--manual-clock', action='store_true',
+        help="The clock is initially set manually")
+    parser.add_argument('--local-comm', action='store_true',
+        help="Local communication is active (the Change Grip/Order screen "
+        "asks to interrupt it)")
+    parser.add_argument('--expect', metavar='LOCATION',
+        help="Expected final location (as printed); the exit status is 1 if "
+        "it is different")
+    parser.add_argument('-v', '--verbose', action='store_true',
+        help="Log each input and screen change")
+    args = parser.parse_args()
+
+    for name, _ in args.load:
+        if name not in DEFAULT_LOAD_MS:
+            sys.exit(f"Unknown screen change {name!r}")
+    args.load = dict(args.load)
+
+    _, records = read_trace(args.trace)
+    menu = Menu(args)
+
+    prev_us = 0
+    for time_us, name in inputs(records, args):
+        menu.idle(time_us, time_us - prev_us)
+        menu.input(time_us, name)
+        prev_us = time_us
+
+    print(f"Location: {menu.location()}")
+    print(f"Virtual controller: {menu.virtual}")
+    print(f"Software: {'running' if menu.software_running else 'closed'}")
+    print(f"Clock: {'synchronized' if menu.clock_auto else 'manual'}, "
+        f"year {menu.year_offset:+d}")
+    print(f"Inputs: {menu.accepted} accepted, {menu.ignored['loading']} ignored "
+        f"while loading, {menu.ignored['latency']} ignored by the input latency")
+
+    if menu.slacks:
+        print(f"{'Screen change':<20} {'Count':>6} {'Min slack (ms)':>15} {'Cycles':>7}")
+        for kind, slacks in sorted(menu.slacks.items()):
+            slack = min(slacks)
+            print(f"{kind:<20} {len(slacks):>6} {slack:>15.0f} "
+                f"{int(slack // CYCLE_MS):>7}")
+
+    for warning in menu.warnings:
+        print(f"Warning: {warning}")
+
+    if args.expect is not None and menu.location() != args.expect:
+        sys.exit(f"Expected location {args.expect!r}, got {menu.location()!r}")
+
+if __name__ == '__main__':
+    run()
@@ -0,0 +1,159 @@
+#!/usr/bin/env python3
+
+"""
+Runs each feature of the automation programs in the host build, and compares
+the USB reports they send with the golden traces in tools/golden.
+"""
+
+import argparse
+import pathlib
+import struct
+import subprocess
+import sys
+import tempfile
+
+
+GOLDEN_DIR = pathlib.Path(__file__).resolve().parent / 'golden'
+
+# Trace file layout (see src/host/trace.h)
+HEADER = struct.Struct('<8sHHIQQQII')
+RECORD = struct.Struct('<Q8s')
+TRACE_MAGIC = b'HIDTRACE'
+
+# Scripted runs: name, program, button script, maximum duration (seconds).
+# The first press group starts the program and the second one selects the
+# feature in the menu.
+FEATURES = [
+    ('swsh-temporary-control', 'swsh', '1,1,1@2', None),
+    ('swsh-repeat-press-a', 'swsh', '1,2,1@20', None),
+    ('swsh-max-raid-setup', 'swsh', '1,3,1,1@30', 120),
+    ('swsh-light-pillar-setup', 'swsh', '1,3,2,1@30', 120),
+    ('swsh-repeat-change-raid', 'swsh', '1,3,3,1@30', 120),
+    ('swsh-auto-breeding', 'swsh', '1,4,1,1@180', None),
+    ('swsh-release-full-boxes', 'swsh', '1,5,1,2', None),
+    ('swsh-scan-boxes', 'swsh', '1,6,1@60', None),
+    ('bdsp-temporary-control', 'bdsp', '1,1,1@2', None),
+    ('bdsp-display-reset-count', 'bdsp', '1,2,1@5', None),
+    ('bdsp-zero-reset-count', 'bdsp', '1,3,1', None),
+    ('bdsp-shiny-arceus-hunting', 'bdsp', '1,4,1,2', None),
+]
+
+
+def read_trace(path):
+    """
+    Returns the header fields and the records of a trace file
+    """
+
+    data = path.read_bytes()
+    header = HEADER.unpack_from(data)
+    if header[0] != TRACE_MAGIC:
+        sys.exit(f"{path} is not a trace file")
+
+    record_count = header[4]
+    records = [RECORD.unpack_from(data, HEADER.size + i * RECORD.size)
+        for i in range(record_count)]
+
+    return header, records
+
+
+def run_feature(host_dir, program, script, duration, trace_path):
+    """
+    Runs a feature, recording its trace
+    """
+
+    cmd = [str(host_dir.resolve() / f'{program}-host'), '-b', script, '-r',
+        str(trace_path)]
+    if duration is not None:
+        cmd += ['-t', str(duration)]
+
+    proc = subprocess.run(cmd, stdin=subprocess.DEVNULL,
+        stdout=subprocess.PIPE, text=True)
+    if proc.returncode != 0:
+        print(proc.stdout, end='')
+        sys.exit(f"{' '.join(cmd)} failed")
+
+
+def compare(name, golden_path, trace_path):
+    """
+    Compares a trace with its golden trace, prints the result, and returns
+    True if they match
+    """
+
+    header, records = read_trace(trace_path)
+    golden_header, golden_records = read_trace(golden_path)
+    poll_interval_us = header[3]
+
+    duration_delta_us = header[5] - golden_header[5]
+    report_delta = duration_delta_us / poll_interval_us
+
+    mismatch = None
+    for idx, (record, golden) in enumerate(zip(records, golden_records)):
+        if record != golden:
+            mismatch = idx
+            break
+
+    if mismatch is None and len(records) != len(golden_records):
+        mismatch = min(len(records), len(golden_records))
+
+    status = "OK" if mismatch is None else "DIFFERENT"
+    print(f"{name}: {status}, duration {header[5] / 1e6:.3f} s "
+        f"({duration_delta_us / 1000:+.0f} ms, {report_delta:+.0f} reports)")
+
+    if mismatch is not None:
+        def describe(records):
+            if mismatch >= len(records):
+                return "end of the trace"
+
+            time_us, report = records[mismatch]
+            return f"{report.hex(' ')} at {time_us / 1e6:.3f} s"
+
+        print(f"  first difference (report change {mismatch}): expected "
+            f"{describe(golden_records)}, got {describe(records)}")
+
+    return mismatch is None
+
+
+def run():
+    """
+    Program entry point
+    """
+
+    parser = argparse.ArgumentParser(description=__doc__)
+    parser.add_argument('--update', action='store_true',
+        help="Replace the golden traces with the traces of this run")
+    parser.add_argument('--host-dir', type=pathlib.Path, default=pathlib.Path('.'),
+        help="Directory containing the host programs (built with make host)")
+    parser.add_argument('features', nargs='*',
+        help="Features to run (all by default)")
+    args = parser.parse_args()
+
+    names = [feature[0] for feature in FEATURES]
+    for name in args.features:
+        if name not in names:
+            sys.exit(f"Unknown feature {name!r} (available: {', '.join(names)})")
+
+    failures = 0
+    with tempfile.TemporaryDirectory() as tmp_dir:
+        for name, program, script, duration in FEATURES:
+            if args.features and name not in args.features:
+                continue
+
+            trace_path = pathlib.Path(tmp_dir) / f'{name}.trace'
+            golden_path = GOLDEN_DIR / f'{name}.trace'
+            run_feature(args.host_dir, program, script, duration, trace_path)
+
+            if args.update:
+                GOLDEN_DIR.mkdir(exist_ok=True)
+                golden_path.write_bytes(trace_path.read_bytes())
+                print(f"{name}: updated")
+            elif not golden_path.exists():
+                print(f"{name}: no golden trace (run with --update)")
+                failures += 1
+            elif not compare(name, golden_path, trace_path):
+                failures += 1
+
+    if failures > 0:
+        sys.exit(f"{failures} feature(s) differ from their golden trace")
+
+if __name__ == '__main__':
+    run()
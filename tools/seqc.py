@@ -0,0 +1,393 @@
+#!/usr/bin/env python3
+
+"""
+Compiles a button sequence file (.seq) into a C header, with a macro sending
+each sequence (SEND_<NAME>(), see SEND_BUTTON_SEQUENCE) and its duration in
+cycles (<NAME>_CYCLES), and prints the duration of each sequence.
+
+Sequence file format (one statement per line, # starts a comment; the
+comment of a step is kept in the generated table):
+
+    include "common.seq"        Use the parameters and blocks of another file
+    param NAME = EXPR           Parameter (can be overridden with -D)
+    sequence NAME ... end       Sequence, compiled to SEND_<NAME>()
+    define NAME ... end         Block of steps, only used by other blocks
+
+Steps of the sequences and blocks:
+
+    hold BUTTONS DURATION       Hold the buttons and the D-pad direction
+    press BUTTONS               Same as hold BUTTONS 1
+    mash BUTTONS COUNT          Press and release COUNT times (SEQ_MASH)
+    wait DURATION               Same as hold NONE DURATION
+    repeat COUNT ... end        Repeat the steps
+    use NAME                    Insert the steps of a block or sequence
+
+BUTTONS are button names (A, B, ZL, H...) and a D-pad direction (TOP,
+BOTLEFT...) joined by +, or NONE. A DURATION is a number of cycles, or a time
+in ms if it is followed by ms (rounded up to whole cycles). EXPR, COUNT and
+DURATION are integer expressions of the parameters (+ - * / and parentheses).
+
+The expressions are evaluated at build time, and the adjacent steps with the
+same state are merged. A sequence must have at least one step left once the
+steps of 0 cycles are removed.
+"""
+
+import argparse
+import ast
+import math
+import pathlib
+import re
+import sys
+
+
+# Default cycle length, in ms (see set_cycle_length)
+DEFAULT_CYCLE_MS = 40
+
+# Maximum number of cycles of a step (see struct button_d_pad_state)
+MAX_STEP_COUNT = 2047
+
+BUTTONS = ['Y', 'B', 'A', 'X', 'L', 'R', 'ZL', 'ZR', 'M', 'P', 'H', 'C']
+D_PAD = ['TOP', 'TOPRIGHT', 'RIGHT', 'BOTRIGHT', 'BOTTOM', 'BOTLEFT', 'LEFT',
+    'TOPLEFT', 'NEUTRAL']
+
+OPERATORS = {ast.Add: lambda a, b: a + b, ast.Sub: lambda a, b: a - b,
+    ast.Mult: lambda a, b: a * b, ast.FloorDiv: lambda a, b: a // b}
+
+
+class SeqError(Exception):
+    """
+    Error in a sequence file, with its location
+    """
+
+    def __init__(self, path, line_no, message):
+        super().__init__(f"{path}:{line_no}: {message}")
+
+
+class Step:
+    """
+    Sequence step: buttons (names), D-pad direction, mode (SEQ_HOLD or
+    SEQ_MASH), number of cycles or presses, and comment
+    """
+
+    def __init__(self, buttons, d_pad, mode, count, comment):
+        self.buttons = buttons
+        self.d_pad = d_pad
+        self.mode = mode
+        self.count = count
+        self.comment = comment
+
+    def state(self):
+        return (self.buttons, self.d_pad, self.mode)
+
+    def cycles(self):
+        return self.count * (2 if self.mode == 'SEQ_MASH' else 1)
+
+
+class Sequence:
+    """
+    Compiled sequence: name, steps, whether it is emitted, and location of its
+    definition (file name and line number)
+    """
+
+    def __init__(self, name, steps, emitted, where=None):
+        self.name = name
+        self.steps = steps
+        self.emitted = emitted
+        self.where = where
+
+    def cycles(self):
+        return sum(step.cycles() for step in self.steps)
+
+
+class Compiler:
+    """
+    Parses sequence files and compiles their sequences
+    """
+
+    def __init__(self, defines, cycle_ms):
+        self.params = dict(defines)
+        self.overridden = set(defines)
+        self.cycle_ms = cycle_ms
+        self.blocks = {}
+        self.included = set()
+
+    def evaluate(self, text, where):
+        """
+        Value of an integer expression of the parameters
+        """
+
+        def value(node):
+            if isinstance(node, ast.Constant) and isinstance(node.value, int):
+                return node.value
+            if isinstance(node, ast.Name):
+                if node.id not in self.params:
+                    raise SeqError(*where, f"unknown parameter {node.id}")
+                return self.params[node.id]
+            if isinstance(node, ast.UnaryOp) and isinstance(node.op, ast.USub):
+                return -value(node.operand)
+            if isinstance(node, ast.BinOp) and type(node.op) in OPERATORS:
+                return OPERATORS[type(node.op)](value(node.left),
+                    value(node.right))
+
+            raise SeqError(*where, f"invalid expression {text!r}")
+
+        try:
+            tree = ast.parse(text.replace('/', '//'), mode='eval')
+        except SyntaxError:
+            raise SeqError(*where, f"invalid expression {text!r}")
+
+        return value(tree.body)
+
+    def duration(self, text, where):
+        """
+        Number of cycles of a duration: cycles, or ms followed by ms
+        """
+
+        match = re.match(r'(.*?)\s*ms$', text)
+        if not match:
+            return self.evaluate(text, where)
+
+        return math.ceil(self.evaluate(match.group(1), where) / self.cycle_ms)
+
+    def buttons(self, text, where):
+        """
+        Buttons and D-pad direction of a step
+        """
+
+        buttons = []
+        d_pad = 'NEUTRAL'
+        for name in text.split('+'):
+            if name in BUTTONS:
+                buttons.append(name)
+            elif name in D_PAD and d_pad == 'NEUTRAL':
+                d_pad = name
+            elif name != 'NONE':
+                raise SeqError(*where, f"invalid button or D-pad direction "
+                    f"{name!r}")
+
+        return tuple(sorted(set(buttons), key=BUTTONS.index)), d_pad
+
+    def parse(self, path, emitted=True):
+        """
+        Parses a sequence file; its sequences are emitted unless it is
+        included
+        """
+
+        path = path.resolve()
+        if path in self.included:
+            return
+        self.included.add(path)
+
+        try:
+            lines = path.read_text().split('\n')
+        except OSError as error:
+            raise SeqError(path, 0, str(error))
+
+        # Stack of the blocks being parsed: kind, name or count, steps, location
+        stack = []
+        for line_no, line in enumerate(lines, 1):
+            where = (path.name, line_no)
+            code, _, comment = line.partition('#')
+            words = code.split()
+            comment = comment.strip()
+            if not words:
+                continue
+
+            keyword, arg = words[0], ' '.join(words[1:])
+
+            if keyword == 'include' and not stack:
+                match = re.match(r'"([^"]+)"$', arg)
+                if not match:
+                    raise SeqError(*where, "include needs a quoted path")
+                self.parse(path.parent / match.group(1), emitted=False)
+
+            elif keyword == 'param' and not stack:
+                match = re.match(r'(\w+)\s*=\s*(.+)$', arg)
+                if not match:
+                    raise SeqError(*where, "param needs NAME = EXPR")
+                if match.group(1) not in self.overridden:
+                    self.params[match.group(1)] = self.evaluate(match.group(2),
+                        where)
+
+            elif keyword in ('sequence', 'define') and not stack:
+                if not re.match(r'[A-Za-z_]\w*$', arg):
+                    raise SeqError(*where, f"invalid name {arg!r}")
+                if arg in self.blocks:
+                    raise SeqError(*where, f"{arg} is already defined")
+                stack.append((keyword, arg, [], where))
+
+            elif keyword == 'repeat' and stack:
+                stack.append(('repeat', self.evaluate(arg, where), [], where))
+
+            elif keyword == 'end' and stack and not arg:
+                kind, name, steps, start = stack.pop()
+                if kind == 'repeat':
+                    stack[-1][2].extend(steps * max(name, 0))
+                else:
+                    self.blocks[name] = Sequence(name, steps,
+                        emitted and kind == 'sequence', start)
+
+            elif keyword == 'use' and stack:
+                if arg not in self.blocks:
+                    raise SeqError(*where, f"unknown sequence or block {arg!r}")
+                stack[-1][2].extend(self.blocks[arg].steps)
+
+            elif keyword in ('hold', 'press', 'mash', 'wait') and stack:
+                stack[-1][2].append(self.step(keyword, words[1:], comment,
+                    where))
+
+            else:
+                raise SeqError(*where, f"unexpected {keyword!r}")
+
+        if stack:
+            raise SeqError(path.name, len(lines), f"missing end of {stack[0][1]}")
+
+    def step(self, keyword, words, comment, where):
+        """
+        Step of a hold, press, mash or wait statement
+        """
+
+        if keyword == 'wait':
+            return Step((), 'NEUTRAL', 'SEQ_HOLD',
+                self.duration(' '.join(words), where), comment)
+
+        if not words or (keyword == 'press') != (len(words) == 1):
+            raise SeqError(*where, f"invalid {keyword} step")
+
+        buttons, d_pad = self.buttons(words[0], where)
+        if keyword == 'press':
+            return Step(buttons, d_pad, 'SEQ_HOLD', 1, comment)
+
+        if keyword == 'mash':
+            return Step(buttons, d_pad, 'SEQ_MASH',
+                self.evaluate(' '.join(words[1:]), where), comment)
+
+        return Step(buttons, d_pad, 'SEQ_HOLD',
+            self.duration(' '.join(words[1:]), where), comment)
+
+    def sequences(self):
+        """
+        Returns the emitted sequences, with their adjacent steps of the same
+        state merged, and the steps split to fit the step counter; a sequence
+        without any step is an error (its table would be empty)
+        """
+
+        sequences = []
+        for block in self.blocks.values():
+            if not block.emitted:
+                continue
+
+            merged = []
+            for step in block.steps:
+                if step.count <= 0:
+                    continue
+
+                if merged and merged[-1].state() == step.state():
+                    merged[-1].count += step.count
+                    merged[-1].comment = merged[-1].comment or step.comment
+                else:
+                    merged.append(Step(*step.state(), step.count, step.comment))
+
+            steps = []
+            for step in merged:
+                count = step.count
+                while count > 0:
+                    steps.append(Step(*step.state(), min(count, MAX_STEP_COUNT),
+                        step.comment))
+                    count -= MAX_STEP_COUNT
+
+            if not steps:
+                raise SeqError(*block.where, f"sequence {block.name} has no "
+                    "steps")
+
+            sequences.append(Sequence(block.name, steps, True, block.where))
+
+        return sequences
+
+
+def compile_file(path, defines=None, cycle_ms=DEFAULT_CYCLE_MS):
+    """
+    Returns the sequences of a sequence file (raises SeqError)
+    """
+
+    compiler = Compiler(defines or {}, cycle_ms)
+    compiler.parse(pathlib.Path(path))
+    return compiler.sequences()
+
+
+def steps_text(sequence):
+    count = len(sequence.steps)
+    return f"{count} step{'s' if count != 1 else ''}"
+
+
+def header(path, sequences, cycle_ms):
+    """
+    Returns the C header of the sequences of a file
+    """
+
+    guard = re.sub(r'\W', '_', path.name).upper() + '_H'
+    lines = ['/*', f' * Generated by tools/seqc.py from {path.name}; do not '
+        'edit.', ' */', '', f'#ifndef {guard}',
+        f'#define {guard}', '', '#include "automation.h"']
+
+    for sequence in sequences:
+        name = sequence.name.upper()
+        lines += ['', f'/* {sequence.name}: {steps_text(sequence)}, '
+            f'{sequence.cycles()} cycles ({sequence.cycles() * cycle_ms / 1000:.2f}'
+            f' s at {cycle_ms} ms/cycle) */',
+            f'#define {name}_CYCLES {sequence.cycles()}',
+            f'#define SEND_{name}() SEND_BUTTON_SEQUENCE( \\']
+
+        for step in sequence.steps:
+            buttons = ' | '.join(f'BT_{button}' for button in step.buttons)
+            comment = step.comment.replace('*/', '* /')
+            lines.append(f'\t{{ {buttons or "BT_NONE"},\tDP_{step.d_pad},\t'
+                f'{step.mode},\t{step.count} }},' +
+                (f'\t/* {comment} */' if comment else '') + ' \\')
+
+        lines.append(')')
+
+    lines += ['', '#endif', '']
+    return '\n'.join(lines)
+
+
+def run():
+    """
+    Program entry point
+    """
+
+    parser = argparse.ArgumentParser(description=__doc__,
+        formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument('source', type=pathlib.Path, help="Sequence file")
+    parser.add_argument('-o', dest='output', type=pathlib.Path,
+        help="Header to write (default: the source file with .h appended)")
+    parser.add_argument('-D', dest='defines', action='append', default=[],
+        metavar='NAME=VALUE', help="Set the value of a parameter")
+    parser.add_argument('-c', dest='cycle_ms', type=int,
+        default=DEFAULT_CYCLE_MS, help="Cycle length for the ms durations "
+        f"(default: {DEFAULT_CYCLE_MS} ms)")
+    args = parser.parse_args()
+
+    defines = {}
+    for define in args.defines:
+        name, _, value = define.partition('=')
+        try:
+            defines[name] = int(value, 0) if value else 1
+        except ValueError:
+            sys.exit(f"Invalid parameter value {define!r}")
+
+    try:
+        sequences = compile_file(args.source, defines, args.cycle_ms)
+    except SeqError as error:
+        sys.exit(str(error))
+
+    output = args.output or args.source.with_name(args.source.name + '.h')
+    output.write_text(header(args.source, sequences, args.cycle_ms))
+
+    for sequence in sequences:
+        print(f"{args.source.name}: {sequence.name}: "
+            f"{steps_text(sequence)}, {sequence.cycles()} cycles, "
+            f"{sequence.cycles() * args.cycle_ms / 1000:.2f} s")
+
+if __name__ == '__main__':
+    run()
@@ -0,0 +1,230 @@
+#!/usr/bin/env python3
+
+"""
+Runs an automation program in the host build with many configurations of its
+build-time parameters (preprocessor macros, like the wait times of swsh.c), in
+parallel, and prints the duration and the report statistics of each run.
+"""
+
+import argparse
+import concurrent.futures
+import csv
+import itertools
+import os
+import pathlib
+import re
+import shlex
+import subprocess
+import sys
+import tempfile
+import time
+
+from regress import read_trace
+
+
+ROOT_DIR = pathlib.Path(__file__).resolve().parent.parent
+
+# Compiler flags of the host build, as in the Makefile (which passes its own)
+DEFAULT_CFLAGS = ('-Wall -Wextra -Werror=overflow -Werror=type-limits -std=c11 '
+    '-O2 -g -I src/host -I src/host/include -I src/usb-iface -I src/lib '
+    '-DF_CPU=16000000UL')
+
+# Objects of the host build linked with each program: the HAL, the USB
+# interface program, and the library
+HOST_OBJECTS = ['src/host/hal.host.o', 'src/host/trace.host.o',
+    'src/usb-iface/usb-iface.host.o']
+LIBRARY_OBJECTS = 'src/lib/*.host.o'
+
+# Neutral controller data of a report: no buttons, D-pad centered
+NEUTRAL_BUTTONS = b'\x00\x00\x08'
+NEUTRAL_STICKS = b'\x80\x80\x80\x80'
+
+
+def parse_values(spec):
+    """
+    Returns the name and the values of a parameter: NAME=V1,V2,... or
+    NAME=START:STOP[:STEP] (STOP included)
+    """
+
+    name, _, values = spec.partition('=')
+    if not re.match(r'[A-Za-z_]\w*$', name) or not values:
+        raise argparse.ArgumentTypeError(f"invalid parameter {spec!r}")
+
+    try:
+        if ':' in values:
+            bounds = [int(value, 0) for value in values.split(':')]
+            start, stop, step = (bounds + [1])[:3]
+            return name, list(range(start, stop + 1, step))
+
+        return name, [int(value, 0) for value in values.split(',')]
+    except ValueError:
+        raise argparse.ArgumentTypeError(f"invalid values in {spec!r}")
+
+
+def build(args, defines, work_dir):
+    """
+    Builds the program with the parameters of a configuration, and returns its
+    path
+    """
+
+    obj_path = work_dir / f'{args.program}.host.o'
+    exe_path = work_dir / f'{args.program}-host'
+    source = ROOT_DIR / 'src' / args.program / f'{args.program}.c'
+    macros = [f'-D{name}={value}' for name, value in defines.items()]
+
+    compile_cmd = (shlex.split(args.cc) + shlex.split(args.cflags) + macros +
+        ['-Dmain=program_main', '-o', str(obj_path), '-c', str(source)])
+    objects = HOST_OBJECTS + sorted(str(path.relative_to(ROOT_DIR))
+        for path in ROOT_DIR.glob(LIBRARY_OBJECTS))
+    link_cmd = (shlex.split(args.cc) + ['-o', str(exe_path), str(obj_path)] +
+        objects)
+
+    for cmd in (compile_cmd, link_cmd):
+        proc = subprocess.run(cmd, cwd=ROOT_DIR, stdout=subprocess.PIPE,
+            stderr=subprocess.STDOUT, text=True)
+        if proc.returncode != 0:
+            raise RuntimeError(f"{' '.join(cmd)} failed:\n{proc.stdout}")
+
+    return exe_path
+
+
+def trace_stats(trace_path):
+    """
+    Returns the statistics of a trace: duration (s), report changes, button
+    presses (buttons or D-pad direction newly pressed), and the part of the
+    time with buttons pressed or sticks moved (%)
+    """
+
+    header, records = read_trace(trace_path)
+    duration_us = header[5]
+
+    presses = 0
+    active_us = 0
+    prev = None
+    for idx, (time_us, report) in enumerate(records):
+        buttons = int.from_bytes(report[0:2], 'little')
+        hat = report[2]
+        prev_buttons = int.from_bytes(prev[0:2], 'little') if prev else 0
+        prev_hat = prev[2] if prev else 8
+
+        presses += bin(buttons & ~prev_buttons).count('1')
+        if hat != 8 and hat != prev_hat:
+            presses += 1
+
+        end_us = records[idx + 1][0] if idx + 1 < len(records) else duration_us
+        if report[0:3] != NEUTRAL_BUTTONS or report[3:7] != NEUTRAL_STICKS:
+            active_us += end_us - time_us
+
+        prev = report
+
+    active = 100 * active_us / duration_us if duration_us else 0.0
+    return duration_us / 1e6, len(records), presses, active
+
+
+def run_config(args, defines):
+    """
+    Builds and runs a configuration, and returns its results
+    """
+
+    with tempfile.TemporaryDirectory() as tmp_dir:
+        work_dir = pathlib.Path(tmp_dir)
+        exe_path = build(args, defines, work_dir)
+        trace_path = work_dir / 'run.trace'
+
+        cmd = [str(exe_path), '-b', args.script, '-r', str(trace_path)]
+        if args.time is not None:
+            cmd += ['-t', str(args.time)]
+        if args.poll_ms is not None:
+            cmd += ['-p', str(args.poll_ms)]
+
+        start = time.monotonic()
+        proc = subprocess.run(cmd, stdin=subprocess.DEVNULL,
+            stdout=subprocess.PIPE, text=True)
+        wall_time = time.monotonic() - start
+
+        if proc.returncode != 0 or not trace_path.exists():
+            raise RuntimeError(f"{' '.join(cmd)} failed:\n{proc.stdout}")
+
+        match = re.search(r'^End of the run: (.*)$', proc.stdout, re.MULTILINE)
+        end = match.group(1) if match else "unknown"
+        duration, reports, presses, active = trace_stats(trace_path)
+
+    return {'duration_s': duration, 'reports': reports, 'presses': presses,
+        'active_percent': active, 'wall_s': wall_time, 'end': end}
+
+
+def run():
+    """
+    Program entry point
+    """
+
+    parser = argparse.ArgumentParser(description=__doc__)
+    parser.add_argument('program', help="Program to run (e.g. swsh)")
+    parser.add_argument('-D', dest='params', action='append', default=[],
+        type=parse_values, metavar='NAME=VALUES',
+        help="Parameter values, as a comma-separated list or START:STOP[:STEP]; "
+        "all combinations of the parameters are run")
+    parser.add_argument('-b', dest='script', required=True,
+        help="Button script of the runs (see the -b option of the host programs)")
+    parser.add_argument('-t', dest='time', type=float,
+        help="Maximum virtual duration of each run, in seconds")
+    parser.add_argument('-p', dest='poll_ms', type=int,
+        help="USB host poll interval (8 for a Switch, 1 for a PC)")
+    parser.add_argument('-j', dest='jobs', type=int, default=os.cpu_count(),
+        help="Number of runs done in parallel (default: number of CPUs)")
+    parser.add_argument('--csv', type=pathlib.Path,
+        help="Also write the results to this CSV file")
+    parser.add_argument('--cc', default='cc', help="Host C compiler")
+    parser.add_argument('--cflags', default=DEFAULT_CFLAGS,
+        help="Host C compiler flags")
+    args = parser.parse_args()
+
+    if not (ROOT_DIR / 'src' / args.program / f'{args.program}.c').exists():
+        sys.exit(f"Unknown program {args.program!r}")
+
+    for obj in HOST_OBJECTS:
+        if not (ROOT_DIR / obj).exists():
+            sys.exit(f"{obj} not found (run make host first)")
+
+    names = [name for name, _ in args.params]
+    configs = [dict(zip(names, values))
+        for values in itertools.product(*(values for _, values in args.params))]
+
+    print(f"Running {len(configs)} configuration(s) of {args.program}, "
+        f"{args.jobs} at a time")
+
+    results = [None] * len(configs)
+    with concurrent.futures.ThreadPoolExecutor(args.jobs) as executor:
+        futures = {executor.submit(run_config, args, config): idx
+            for idx, config in enumerate(configs)}
+
+        for future in concurrent.futures.as_completed(futures):
+            try:
+                results[futures[future]] = future.result()
+            except RuntimeError as error:
+                executor.shutdown(cancel_futures=True)
+                sys.exit(str(error))
+
+    columns = names + ['duration_s', 'reports', 'presses', 'active_percent',
+        'wall_s', 'end']
+    rows = [{**config, **result} for config, result in zip(configs, results)]
+
+    widths = {column: max(len(column), 8) for column in columns}
+    print('  '.join(f"{column:>{widths[column]}}" for column in columns[:-1]) +
+        '  end')
+    for row in rows:
+        cells = []
+        for column in columns[:-1]:
+            value = row[column]
+            text = f"{value:.3f}" if isinstance(value, float) else str(value)
+            cells.append(f"{text:>{widths[column]}}")
+        print('  '.join(cells) + f"  {row['end']}")
+
+    if args.csv:
+        with args.csv.open('w', newline='') as csv_file:
+            writer = csv.DictWriter(csv_file, fieldnames=columns)
+            writer.writeheader()
+            writer.writerows(rows)
+
+if __name__ == '__main__':
+    run()
@@ -0,0 +1,129 @@
+#!/usr/bin/env python3
+
+"""
+Runs the tests of the automation library in the host build (test-host, built
+with make host); each test runs in its own process.
+"""
+
+import pathlib
+import subprocess
+import tempfile
+import unittest
+
+from regress import read_trace
+
+
+HOST_DIR = pathlib.Path(__file__).resolve().parent.parent
+
+# Maximum virtual duration of a test run (seconds)
+TIME_LIMIT = 3600
+
+# Duration of a cycle, with the default cycle length (µs)
+CYCLE_US = 40000
+
+# Neutral report
+NEUTRAL_REPORT = bytes([0, 0, 0x08, 128, 128, 128, 128])
+
+# Link faults (see test-host -h) hitting the messages of the tests that send
+# alternating steps, after the link speed negotiation: one corrupted byte and
+# one dropped byte, or a corrupted byte followed by the loss of the link
+RETRANSMIT_FAULTS = '150,d160'
+LINK_LOST_FAULTS = '150,d160-'
+
+
+class HostTest(unittest.TestCase):
+    """
+    Tests of test-host
+    """
+
+    def run_test(self, name, *options):
+        """
+        Runs a test, and returns the output of the run
+        """
+
+        cmd = [str(HOST_DIR / 'test-host'), '-t', str(TIME_LIMIT), *options,
+            name]
+        proc = subprocess.run(cmd, stdin=subprocess.DEVNULL,
+            stdout=subprocess.PIPE, stderr=subprocess.STDOUT, text=True)
+        return proc.returncode, proc.stdout
+
+    def assert_passes(self, name, *options):
+        """
+        Checks that a test passes
+        """
+
+        status, output = self.run_test(name, *options)
+        self.assertIn("the main µC program returned", output)
+        self.assertEqual(status, 0, output)
+
+    def test_queue_many_messages(self):
+        self.assert_passes('queue-many-messages')
+
+    def test_retransmit(self):
+        self.assert_passes('retransmit', '-x', RETRANSMIT_FAULTS)
+
+    def test_link_lost(self):
+        with tempfile.TemporaryDirectory() as tmp_dir:
+            trace_path = pathlib.Path(tmp_dir) / 'link-lost.trace'
+            status, output = self.run_test('link-lost', '-x', LINK_LOST_FAULTS,
+                '-r', str(trace_path))
+            _, records = read_trace(trace_path)
+
+        # The USB µC keeps the last output for 50 cycles after the error, then
+        # enters panic mode, where it outputs neutral data
+        self.assertIn("the main µC program stalled", output)
+        self.assertEqual(status, 1, output)
+        self.assertEqual(records[-1][1][:len(NEUTRAL_REPORT)], NEUTRAL_REPORT)
+        self.assertLessEqual(records[-1][0] - records[-2][0], 55 * CYCLE_US)
+
+    def test_play_sequence(self):
+        self.assert_passes('play-sequence')
+
+    def test_play_control_step(self):
+        status, output = self.run_test('play-control-step')
+        self.assertIn("the main µC program is in panic mode 5", output)
+        self.assertEqual(status, 1, output)
+
+    def test_sequences(self):
+        for name in ('sequence-nested-loops', 'sequence-empty-loop',
+                'sequence-calls'):
+            with self.subTest(name):
+                self.assert_passes(name)
+
+    def test_replay(self):
+        with tempfile.TemporaryDirectory() as tmp_dir:
+            trace_path = pathlib.Path(tmp_dir) / 'swsh.trace'
+            replay_path = pathlib.Path(tmp_dir) / 'replay.trace'
+            for cmd in ([HOST_DIR / 'swsh-host', '-b', '1,2,1@20', '-r',
+                    trace_path], [HOST_DIR / 'replay-host', '-r', replay_path,
+                    trace_path]):
+                proc = subprocess.run([str(arg) for arg in cmd],
+                    stdin=subprocess.DEVNULL, stdout=subprocess.PIPE,
+                    stderr=subprocess.STDOUT, text=True)
+                self.assertEqual(proc.returncode, 0, proc.stdout)
+
+            _, records = read_trace(trace_path)
+            _, replay_records = read_trace(replay_path)
+
+        # Same report changes at the same times
+        self.assertGreater(len(records), 2)
+        self.assertEqual(replay_records, records)
+
+    def test_invalid_sequences(self):
+        for name in ('sequence-stack-overflow', 'sequence-bad-call',
+                'sequence-unterminated-loop'):
+            with self.subTest(name):
+                status, output = self.run_test(name)
+                self.assertIn("the main µC program is in panic mode 5", output)
+                self.assertEqual(status, 1, output)
+
+    def test_invalid_scripts(self):
+        for name in ('script-bad-call', 'script-bad-d-pad'):
+            with self.subTest(name):
+                status, output = self.run_test(name)
+                self.assertIn("the main µC program is in panic mode 4", output)
+                self.assertEqual(status, 1, output)
+
+
+if __name__ == '__main__':
+    unittest.main()
@@ -0,0 +1,71 @@
+#!/usr/bin/env python3
+
+"""
+Tests of the button sequence compiler (tools/seqc.py).
+"""
+
+import pathlib
+import tempfile
+import unittest
+
+from seqc import MAX_STEP_COUNT, SeqError, compile_file
+
+
+class SeqcTest(unittest.TestCase):
+    """
+    Tests of seqc
+    """
+
+    def compile(self, source, **defines):
+        """
+        Compiles a sequence file with the specified content, and returns its
+        sequences
+        """
+
+        with tempfile.TemporaryDirectory() as tmp_dir:
+            path = pathlib.Path(tmp_dir) / 'test.seq'
+            path.write_text(source)
+            return compile_file(path, defines)
+
+    def test_empty_sequence(self):
+        with self.assertRaisesRegex(SeqError, r'^test\.seq:3: sequence empty '
+                r'has no steps$'):
+            self.compile("# Nothing to send\n\nsequence empty\nend\n")
+
+    def test_sequence_without_cycles(self):
+        source = ("param COUNT = 2\n"
+            "sequence nothing\n"
+            "    repeat COUNT\n"
+            "        wait 0\n"
+            "    end\n"
+            "end\n")
+        with self.assertRaisesRegex(SeqError, r'^test\.seq:2: '):
+            self.compile(source)
+
+        with self.assertRaisesRegex(SeqError, r'^test\.seq:2: '):
+            self.compile(source.replace("wait 0", "press A"), COUNT=0)
+
+    def test_empty_block(self):
+        sequences = self.compile("define nothing\nend\n"
+            "sequence press\n    use nothing\n    press A\nend\n")
+        self.assertEqual([sequence.name for sequence in sequences], ['press'])
+
+    def test_long_hold(self):
+        sequences = self.compile("sequence long\n    hold A 5000\n"
+            "    wait 2048\nend\n")
+        steps = [(step.buttons, step.count) for step in sequences[0].steps]
+        self.assertEqual(steps, [(('A',), MAX_STEP_COUNT),
+            (('A',), MAX_STEP_COUNT), (('A',), 906), ((), MAX_STEP_COUNT),
+            ((), 1)])
+        self.assertEqual(sequences[0].cycles(), 7048)
+
+    def test_merged_long_mash(self):
+        sequences = self.compile("sequence mash\n    mash B 2000\n"
+            "    mash B 100\nend\n")
+        steps = [(step.mode, step.count) for step in sequences[0].steps]
+        self.assertEqual(steps, [('SEQ_MASH', MAX_STEP_COUNT),
+            ('SEQ_MASH', 53)])
+
+
+if __name__ == '__main__':
+    unittest.main()
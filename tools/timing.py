@@ -0,0 +1,900 @@
+#!/usr/bin/env python3
+
+"""
+Estimates the duration of the functions of the automation programs, from the
+controller updates they send (button sequences, scripts, updates, repeats) and
+their fixed delays, without running them.
+"""
+
+import argparse
+import math
+import pathlib
+import re
+import sys
+
+from seqc import SeqError, compile_file
+
+
+ROOT_DIR = pathlib.Path(__file__).resolve().parent.parent
+DEFAULT_SOURCES = ['src/swsh/swsh.c', 'src/bdsp/bdsp.c',
+    'src/lib/automation-utils.c']
+
+# Nominal report interval and default cycle length (see common.h)
+REPORT_INTERVAL_MS = 8
+DEFAULT_CYCLE_LENGTH = 5
+
+# Number of functions flagged as the longest ones
+LONGEST_COUNT = 5
+
+TOKEN_RE = re.compile(r'''
+    \s+ | //[^\n]* | /\*.*?\*/
+    | (?P<tok>"(?:\\.|[^"\\])*" | '(?:\\.|[^'\\])*'
+        | [A-Za-z_]\w* | 0[xX][0-9a-fA-F]+[uUlL]* | \d+[uUlL]*
+        | ->|\+\+|--|<<=|>>=|<<|>>|<=|>=|==|!=|&&|\|\||[-+*/%&|^]= | .)
+    ''', re.VERBOSE | re.DOTALL)
+
+TYPE_NAMES = {'void', 'bool', 'char', 'int', 'unsigned', 'signed', 'short',
+    'long', 'uint8_t', 'uint16_t', 'uint32_t', 'int8_t', 'int16_t', 'int32_t',
+    'size_t', 'const', 'static', 'struct', 'enum'}
+
+
+class Duration:
+    """
+    Duration of some code: number of cycles, total time (ms) including the
+    cycles, and notes about the estimate
+    """
+
+    def __init__(self, cycles=0, ms=0.0, notes=()):
+        self.cycles = cycles
+        self.ms = ms
+        self.notes = list(notes)
+
+    def add(self, other):
+        self.cycles += other.cycles
+        self.ms += other.ms
+        for note in other.notes:
+            if note not in self.notes:
+                self.notes.append(note)
+
+    def scaled(self, count):
+        return Duration(self.cycles * count, self.ms * count, self.notes)
+
+    def note(self, text):
+        if text not in self.notes:
+            self.notes.append(text)
+
+
+class Function:
+    """
+    Function definition: name, source file, parameter names, body statement
+    """
+
+    def __init__(self, name, path, params, body):
+        self.name = name
+        self.path = path
+        self.params = params
+        self.body = body
+
+
+def preprocess(text, defines):
+    """
+    Removes the preprocessor directives, and the code excluded by the
+    conditional ones (only #ifdef, #ifndef, #if 0/1 are evaluated). The
+    macros defined as a number are added to the defines, unless they are
+    already defined.
+    """
+
+    output = []
+    active = [True]
+    for line in text.split('\n'):
+        directive = re.match(r'\s*#\s*(\w+)\s*(.*)', line)
+        if not directive:
+            output.append(line if all(active) else '')
+            continue
+
+        name, arg = directive.groups()
+        if name == 'ifdef':
+            active.append(arg.split()[0] in defines)
+        elif name == 'ifndef':
+            active.append(arg.split()[0] not in defines)
+        elif name == 'if':
+            active.append(arg.strip() != '0')
+        elif name == 'else':
+            active[-1] = not active[-1]
+        elif name == 'endif':
+            active.pop()
+        elif name == 'define' and all(active):
+            macro = re.match(r'(\w+)\s+\(?(0[xX][0-9a-fA-F]+|\d+)[uUlL]*\)?\s*$', arg)
+            if macro:
+                defines.setdefault(macro.group(1), int(macro.group(2), 0))
+
+        output.append('')
+
+    return '\n'.join(output)
+
+
+def tokenize(text):
+    return [match.group('tok') for match in TOKEN_RE.finditer(text)
+        if match.group('tok') is not None]
+
+
+def find_close(tokens, pos):
+    """
+    Returns the position of the bracket closing the one at pos
+    """
+
+    pairs = {'(': ')', '{': '}', '[': ']'}
+    opening = tokens[pos]
+    depth = 0
+    for idx in range(pos, len(tokens)):
+        if tokens[idx] == opening:
+            depth += 1
+        elif tokens[idx] == pairs[opening]:
+            depth -= 1
+            if depth == 0:
+                return idx
+
+    raise SyntaxError(f"unbalanced {opening!r}")
+
+
+def split_top(tokens, separator):
+    """
+    Splits tokens on a separator that is not nested in brackets
+    """
+
+    parts = [[]]
+    depth = 0
+    for token in tokens:
+        if token in '([{':
+            depth += 1
+        elif token in ')]}':
+            depth -= 1
+
+        if token == separator and depth == 0:
+            parts.append([])
+        else:
+            parts[-1].append(token)
+
+    return parts if parts != [[]] else []
+
+
+def parse_statement(tokens, pos):
+    """
+    Parses the statement at pos; returns it (as a tuple) and the position
+    after it
+    """
+
+    token = tokens[pos]
+
+    if token == '{':
+        end = find_close(tokens, pos)
+        body = []
+        inner = pos + 1
+        while inner < end:
+            statement, inner = parse_statement(tokens, inner)
+            body.append(statement)
+
+        return ('block', body), end + 1
+
+    if token in ('for', 'while', 'if', 'switch'):
+        close = find_close(tokens, pos + 1)
+        header = tokens[pos + 2:close]
+        body, after = parse_statement(tokens, close + 1)
+
+        if token == 'if':
+            if after < len(tokens) and tokens[after] == 'else':
+                other, after = parse_statement(tokens, after + 1)
+                return ('if', header, body, other), after
+
+            return ('if', header, body, None), after
+
+        if token == 'for':
+            return ('for', split_top(header, ';'), body), after
+
+        return (token, header, body), after
+
+    if token == 'do':
+        body, after = parse_statement(tokens, pos + 1)
+        close = find_close(tokens, after + 1)
+        return ('do', tokens[after + 2:close], body), close + 2
+
+    if token in ('case', 'default'):
+        end = pos
+        while tokens[end] != ':':
+            end += 1
+
+        return ('label',), end + 1
+
+    if token in ('break', 'continue'):
+        return (token,), pos + 2
+
+    # Expression statement or declaration, up to the semicolon
+    end = pos
+    depth = 0
+    while depth > 0 or tokens[end] != ';':
+        if tokens[end] in '([{':
+            depth += 1
+        elif tokens[end] in ')]}':
+            depth -= 1
+        end += 1
+
+    return ('expr', tokens[pos:end]), end + 1
+
+
+def parse_functions(path, defines):
+    """
+    Returns the functions defined in a source file, and the elements of its
+    file-level arrays (sub-sequences and their tables, see automation.h)
+    """
+
+    text = preprocess(path.read_text(), defines)
+    tokens = tokenize(text)
+    functions = {}
+    arrays = {}
+
+    pos = 0
+    start = 0
+    while pos < len(tokens):
+        token = tokens[pos]
+        if token in ';}':
+            start = pos + 1
+        elif token in '({[':
+            close = find_close(tokens, pos)
+            array = re.match(r'(?:[\w*]+ )*?(\w+) \[ [^=]*\] = \{$',
+                ' '.join(tokens[start:pos + 1]))
+            if array:
+                arrays[array.group(1)] = [element for element in
+                    split_top(tokens[pos + 1:close], ',') if element]
+            is_definition = (token == '(' and close + 1 < len(tokens) and
+                tokens[close + 1] == '{' and pos > 0 and
+                re.match(r'[A-Za-z_]\w*$', tokens[pos - 1]))
+
+            if is_definition:
+                name = tokens[pos - 1]
+                params = [param_name(param) for param in
+                    split_top(tokens[pos + 1:close], ',')]
+                body, pos = parse_statement(tokens, close + 1)
+                functions[name] = Function(name, path,
+                    [param for param in params if param], body)
+                start = pos
+                continue
+
+            pos = close
+
+        pos += 1
+
+    return functions, arrays
+
+
+def source_text(tokens):
+    """
+    Returns the source code of tokens, for messages
+    """
+
+    text = ' '.join(tokens)
+    return re.sub(r'(\w) \(', r'\1(', re.sub(r'\( | \)| ,', lambda match:
+        match.group(0).strip(), text))
+
+
+def param_name(tokens):
+    """
+    Returns the name of a parameter from its declaration (None for void)
+    """
+
+    if '(' in tokens:
+        # Function pointer: type (*name)(args)
+        return tokens[tokens.index('*') + 1]
+
+    names = [token for token in tokens if re.match(r'[A-Za-z_]\w*$', token)
+        and token not in TYPE_NAMES]
+    return names[-1] if names else None
+
+
+class Analyzer:
+    """
+    Evaluates the duration of the functions
+    """
+
+    def __init__(self, sources, arrays, sequences, poll_ms, assumptions):
+        self.sources = sources
+        self.arrays = arrays
+        self.sequences = sequences
+        self.poll_ms = poll_ms
+        self.assumptions = assumptions
+        self.cycle_length = DEFAULT_CYCLE_LENGTH
+        self.stack = []
+
+    def cycle_ms(self):
+        """
+        Duration of a cycle: the USB interface starts a cycle on the first
+        poll after the end of the previous one, and keeps the nominal rate
+        unless the host polls less often than the cycles
+        """
+
+        nominal = self.cycle_length * REPORT_INTERVAL_MS
+        if self.poll_ms <= nominal:
+            return nominal
+
+        return math.ceil(nominal / self.poll_ms) * self.poll_ms
+
+    def cycles(self, count):
+        return Duration(count, count * self.cycle_ms())
+
+    def lookup(self, name):
+        """
+        Returns the analyzed function with that name, looked up in the source
+        file of the calling function first (None if not found)
+        """
+
+        if self.stack and name in self.sources[self.stack[-1].path]:
+            return self.sources[self.stack[-1].path][name]
+
+        for functions in self.sources.values():
+            if name in functions:
+                return functions[name]
+
+        return None
+
+    def function(self, func, args):
+        """
+        Duration of a call to an analyzed function
+        """
+
+        if func in self.stack:
+            return Duration(notes=[f"recursive call to {func.name} not counted"])
+
+        env = dict(self.arrays[func.path])
+        env.update(zip(func.params, args))
+        env.update(self.assumptions)
+
+        self.stack.append(func)
+        duration = self.statement(func.body, env)
+        self.stack.pop()
+
+        return duration
+
+    def statement(self, statement, env):
+        kind = statement[0]
+
+        if kind == 'block':
+            duration = Duration()
+            segments = [[]]
+            in_switch_case = False
+
+            for inner in statement[1]:
+                if inner[0] == 'label':
+                    in_switch_case = True
+                    segments.append([])
+                else:
+                    segments[-1].append(inner)
+
+            if not in_switch_case:
+                for inner in statement[1]:
+                    duration.add(self.statement(inner, env))
+                return duration
+
+            # Switch body: the longest case is counted
+            durations = [self.statement(('block', segment), dict(env))
+                for segment in segments[1:]]
+            duration = max(durations, key=lambda d: d.ms, default=Duration())
+            duration.note("switch: longest case counted")
+            return duration
+
+        if kind == 'expr':
+            return self.expression(statement[1], env)
+
+        if kind == 'if':
+            _, cond, body, other = statement
+            duration = self.expression(cond, env)
+            value = self.value(cond, env)
+
+            if value is not None:
+                branch = body if value else other
+                if branch is not None:
+                    duration.add(self.statement(branch, env))
+                return duration
+
+            durations = [self.statement(body, dict(env))]
+            if other is not None:
+                durations.append(self.statement(other, dict(env)))
+
+            longest = max(durations, key=lambda d: d.ms)
+            if len(durations) > 1 or longest.ms > 0:
+                longest.note("condition: longest branch counted")
+            duration.add(longest)
+            return duration
+
+        if kind == 'switch':
+            duration = self.expression(statement[1], env)
+            duration.add(self.statement(statement[2], env))
+            return duration
+
+        if kind == 'for':
+            return self.for_loop(statement, env)
+
+        if kind in ('while', 'do'):
+            _, cond, body = statement
+            duration = self.expression(cond, env)
+            duration.add(self.statement(body, env))
+            if self.value(cond, env) is not None and not self.value(cond, env):
+                return duration
+
+            duration.note(f"loop while ({source_text(cond)}): one iteration "
+                "counted")
+            return duration
+
+        return Duration()
+
+    def for_loop(self, statement, env):
+        """
+        Duration of a for loop: the iterations are counted if the loop
+        variable goes from a known value to a known bound
+        """
+
+        _, header, body = statement
+        if len(header) != 3:
+            return self.statement(body, env)
+
+        init, cond, step = header
+        duration = self.expression(init, env)
+        count = None
+
+        init_match = re.match(r'(?:\w+ )*(\w+) = (.+)$', ' '.join(init))
+        cond_match = re.match(r'(\w+) (<|<=|!=) (.+)$', ' '.join(cond))
+        step_text = ' '.join(step)
+
+        if init_match and cond_match and init_match.group(1) == cond_match.group(1):
+            var = init_match.group(1)
+            start = self.value(init_match.group(2).split(), env)
+            bound = self.value(cond_match.group(3).split(), env)
+            increment = 1 if step_text in (f'{var} ++', f'++ {var}') else None
+            step_match = re.match(rf'{var} \+= (\d+)$', step_text)
+            if step_match:
+                increment = int(step_match.group(1))
+
+            if None not in (start, bound, increment):
+                if cond_match.group(2) == '<=':
+                    bound += 1
+                count = max(0, math.ceil((bound - start) / increment))
+
+        loop_env = dict(env)
+        if init_match:
+            loop_env.pop(init_match.group(1), None)
+
+        iteration = self.statement(body, loop_env)
+        if count is not None:
+            duration.add(iteration.scaled(count))
+            return duration
+
+        duration.add(iteration)
+        if cond:
+            duration.note(f"loop count unknown ({source_text(cond)}): one "
+                "iteration counted")
+        else:
+            duration.note("endless loop: one iteration counted")
+
+        return duration
+
+    def expression(self, tokens, env):
+        """
+        Duration of the calls in an expression; also tracks the local
+        variables with a known value
+        """
+
+        duration = Duration()
+
+        # Array declarations (scripts and their tables, see script.h): their
+        # elements are kept for the run_script calls
+        array = re.match(r'(?:[\w*]+ )*?(\w+) \[ [^=]*\] = \{', ' '.join(tokens))
+        if array and tokens[-1] == '}':
+            start = tokens.index('{')
+            env[array.group(1)] = [element for element in
+                split_top(tokens[start + 1:-1], ',') if element]
+            return duration
+
+        assign = re.match(r'(?:[\w*]+ )*?(\w+) (=|\+=|-=) (.+)$',
+            ' '.join(tokens))
+        if assign and assign.group(1) not in self.assumptions:
+            name, operator, value_text = assign.groups()
+            value = self.value(value_text.split(), env)
+            if operator != '=' and value is not None and env.get(name) is not None:
+                value = env[name] + value if operator == '+=' else env[name] - value
+            elif operator != '=':
+                value = None
+
+            if value is None:
+                env.pop(name, None)
+            else:
+                env[name] = value
+
+        pos = 0
+        while pos < len(tokens) - 1:
+            if re.match(r'[A-Za-z_]\w*$', tokens[pos]) and tokens[pos + 1] == '(':
+                close = find_close(tokens, pos + 1)
+                args = split_top(tokens[pos + 2:close], ',')
+                call = self.call(tokens[pos], args, env)
+                if call is not None:
+                    duration.add(call)
+                    pos = close + 1
+                    continue
+
+            pos += 1
+
+        return duration
+
+    def call(self, name, args, env):
+        """
+        Duration of a call, or None if it is not a known function (the calls
+        in its arguments are then evaluated)
+        """
+
+        target = env.get(name)
+        if isinstance(target, str):
+            name = target
+
+        if name in ('SEND_BUTTON_SEQUENCE', 'SEND_BUTTON_SEQUENCE_RAM',
+                'SEND_STICKS_SEQUENCE', 'PLAY_BUTTON_SEQUENCE'):
+            return self.sequence(args, None, env, 0)
+
+        if name == 'SEND_BUTTON_SEQUENCE_CALLS' and args:
+            return self.sequence(args[1:], env.get(' '.join(args[0])), env, 0)
+
+        if name in self.sequences:
+            return self.cycles(self.sequences[name])
+
+        if name == 'run_script' and len(args) == 4:
+            return self.run_script(args, env)
+
+        if name in ('send_update', 'send_current', 'send_current_async',
+                'pause_automation'):
+            return self.cycles(1)
+
+        if name == 'send_update_hold' and len(args) == 5:
+            return self.counted_cycles(args[4], 1, env, name)
+
+        if name == 'send_buttons' and len(args) == 3:
+            return self.counted_cycles(args[2], 2, env, name)
+
+        if name == 'set_cycle_length' and len(args) == 1:
+            length = self.value(args[0], env)
+            if length is None:
+                return Duration(notes=["unknown cycle length"])
+
+            self.cycle_length = length if length > 0 else DEFAULT_CYCLE_LENGTH
+            return Duration()
+
+        if name == '_delay_ms' and len(args) == 1:
+            return self.delay(args[0], env)
+
+        if name in ('delay', 'wait_for_button_timeout') and len(args) == 3:
+            duration = self.delay(args[2], env)
+            duration.note("timeout counted (a button press ends it early)")
+            return duration
+
+        if name == 'count_button_presses':
+            return Duration(notes=["waits for the user"])
+
+        if name == 'beep':
+            return Duration(0, 1)
+
+        func = self.lookup(name)
+        if func is not None:
+            values = [self.argument(arg, env) for arg in args]
+            return self.function(func, values)
+
+        return None
+
+    def sequence(self, steps, subsequences, env, depth):
+        """
+        Duration of a button sequence: each step lasts for its number of
+        cycles, doubled in SEQ_MASH mode; the loops and the calls of the
+        sub-sequences (elements of the subsequences table) are followed
+        """
+
+        duration = Duration()
+        loops = []
+        for step in steps:
+            if len(step) > 2 and step[0] == '{' and step[1].startswith('SEQ_'):
+                # Control step of a sequence with stick positions
+                step = step[1:-1]
+
+            name = step[0] if step else None
+            args = split_top(step[2:-1], ',') if len(step) > 1 else []
+
+            if name == 'SEQ_LOOP' and len(args) == 1:
+                loops.append((self.value(args[0], env), duration))
+                duration = Duration()
+                continue
+
+            if name == 'SEQ_END_LOOP' and loops:
+                count, outer = loops.pop()
+                if count is None:
+                    outer.add(duration)
+                    outer.note("sequence loop count unknown: one iteration "
+                        "counted")
+                else:
+                    outer.add(duration.scaled(count))
+                duration = outer
+                continue
+
+            if name == 'SEQ_CALL' and len(args) == 1:
+                subsequence = self.subsequence(subsequences, args[0], env)
+                if subsequence is None or depth > 4:
+                    duration.note("unknown called sub-sequence")
+                else:
+                    duration.add(self.sequence(subsequence, subsequences, env,
+                        depth + 1))
+                continue
+
+            if not step or step[0] != '{':
+                continue
+
+            fields = split_top(step[1:-1], ',')
+            if fields and fields[0][:1] == ['{']:
+                # Step with stick positions: the button state comes first
+                fields = split_top(fields[0][1:-1], ',')
+
+            if len(fields) < 4:
+                continue
+
+            factor = 2 if fields[2] == ['SEQ_MASH'] else 1
+            duration.add(self.counted_cycles(fields[3], factor, env,
+                "sequence step"))
+
+        return duration
+
+    def subsequence(self, subsequences, index, env):
+        """
+        Steps of the sub-sequence with that index in a table (None if
+        unknown); the index can be the designator of an element
+        """
+
+        if not isinstance(subsequences, list):
+            return None
+
+        names = []
+        for element in subsequences:
+            if element[0] == '[' and '=' in element:
+                equals = element.index('=')
+                if element[1:equals - 1] == index:
+                    names = [element[equals + 1:]]
+                    break
+            else:
+                names.append(element)
+        else:
+            position = self.value(index, env)
+            names = names[position:position + 1] if position is not None \
+                else []
+
+        if names and names[0][:2] == ['SUBSEQUENCE', '(']:
+            # Element built from an array of steps
+            names = [names[0][2:-1]]
+
+        subsequence = env.get(' '.join(names[0])) if names else None
+        return subsequence if isinstance(subsequence, list) else None
+
+    def run_script(self, args, env):
+        """
+        Duration of a run_script call; the longest script is counted if it
+        depends on a condition
+        """
+
+        names = [args[0]]
+        if '?' in args[0]:
+            question = args[0].index('?')
+            choices = split_top(args[0][question + 1:], ':')
+            value = self.value(args[0][:question], env)
+            names = choices if value is None else [choices[0 if value else 1]]
+
+        subscripts = env.get(' '.join(args[1]))
+        param = (self.value(args[3], env), source_text(args[3]))
+        durations = []
+        for name in names:
+            script = env.get(' '.join(name))
+            if not isinstance(script, list):
+                return Duration(notes=[f"unknown script {source_text(name)}"])
+
+            durations.append(self.script(script, subscripts, param, env, 0))
+
+        duration = max(durations, key=lambda d: d.ms)
+        if len(durations) > 1:
+            duration.note("condition: longest branch counted")
+        return duration
+
+    def script(self, elements, subscripts, param, env, depth):
+        """
+        Duration of the instructions of a script (see script.h); param is the
+        value (None if unknown) and source of the run_script parameter, and
+        mashes last twice their count, like in button sequences
+        """
+
+        duration = Duration()
+        loops = []
+        for element in elements:
+            name = element[0]
+            args = split_top(element[2:-1], ',') if len(element) > 1 else []
+
+            if name == 'SC_END':
+                break
+
+            if name in ('SC_LOOP', 'SC_LOOP_PARAM'):
+                count = self.value(args[0], env) if args else param[0]
+                loops.append((count, duration))
+                duration = Duration()
+            elif name == 'SC_END_LOOP' and loops:
+                count, outer = loops.pop()
+                if count is None:
+                    outer.add(duration)
+                    outer.note(f"loop count unknown ({param[1]}): one "
+                        "iteration counted")
+                else:
+                    outer.add(duration.scaled(count))
+                duration = outer
+            elif name == 'SC_PRESS':
+                duration.add(self.cycles(1))
+            elif name in ('SC_HOLD', 'SC_MASH') and len(args) == 3:
+                factor = 2 if name == 'SC_MASH' else 1
+                duration.add(self.counted_cycles(args[2], factor, env,
+                    "script instruction"))
+            elif name == 'SC_WAIT' and len(args) == 1:
+                duration.add(self.counted_cycles(args[0], 1, env,
+                    "script instruction"))
+            elif name == 'SC_DELAY' and len(args) == 1:
+                duration.add(self.delay(args[0], env))
+            elif name == 'SC_CHECK_BUTTON' and len(args) == 2:
+                duration.add(self.delay(args[0], env))
+                duration.note("timeout counted (a button press ends it early)")
+            elif name == 'SC_CALL' and len(args) == 1:
+                index = self.value(args[0], env)
+                if not isinstance(subscripts, list) or index is None or \
+                        index >= len(subscripts) or depth > 8:
+                    duration.note("unknown called script")
+                    continue
+
+                script = env.get(' '.join(subscripts[index]))
+                if isinstance(script, list):
+                    duration.add(self.script(script, subscripts, param, env,
+                        depth + 1))
+
+        return duration
+
+    def counted_cycles(self, tokens, factor, env, what):
+        count = self.value(tokens, env)
+        if count is None:
+            return Duration(notes=[f"{what}: unknown number of cycles"])
+
+        return self.cycles(count * factor)
+
+    def delay(self, tokens, env):
+        value = self.value(tokens, env)
+        if value is None:
+            return Duration(notes=["unknown delay"])
+
+        return Duration(0, value)
+
+    def argument(self, tokens, env):
+        """
+        Value of a call argument: a number, a function name, or None
+        """
+
+        names = [token for token in tokens if token != '&']
+        if len(names) == 1 and self.lookup(names[0]) is not None:
+            return names[0]
+
+        return self.value(tokens, env)
+
+    def value(self, tokens, env):
+        """
+        Value of a constant expression, or None if it cannot be evaluated
+        """
+
+        expr = []
+        pos = 0
+        while pos < len(tokens):
+            token = tokens[pos]
+
+            # Casts
+            if token == '(' and pos + 2 < len(tokens) and \
+                    tokens[pos + 1] in TYPE_NAMES and tokens[pos + 2] == ')':
+                pos += 3
+                continue
+
+            if re.match(r'(0[xX][0-9a-fA-F]+|\d+)[uUlL]*$', token):
+                expr.append(str(int(token.rstrip('uUlL'), 0)))
+            elif token in ('true', 'false'):
+                expr.append('1' if token == 'true' else '0')
+            elif re.match(r'[A-Za-z_]\w*$', token):
+                value = env.get(token)
+                if not isinstance(value, int):
+                    return None
+                expr.append(str(value))
+            elif token in ('&&', '||'):
+                expr.append(' and ' if token == '&&' else ' or ')
+            elif token == '!':
+                expr.append(' not ')
+            elif token == '/':
+                expr.append('//')
+            elif token in ('+', '-', '*', '%', '(', ')', '<', '>', '<=', '>=',
+                    '==', '!=', '<<', '>>', '&', '|', '^', '~'):
+                expr.append(token)
+            else:
+                return None
+
+            pos += 1
+
+        if not expr:
+            return None
+
+        try:
+            return int(eval(''.join(expr), {'__builtins__': {}}))
+        except Exception:
+            return None
+
+
+def run():
+    """
+    Program entry point
+    """
+
+    parser = argparse.ArgumentParser(description=__doc__)
+    parser.add_argument('-p', '--poll-ms', type=int, default=REPORT_INTERVAL_MS,
+        help="USB host poll interval (8 for a Switch, 1 for a PC)")
+    parser.add_argument('-D', dest='assumptions', action='append', default=[],
+        metavar='NAME=VALUE', help="Assume a variable or parameter has a "
+        "value (e.g. -D hatch_time=1000), or define a preprocessor macro")
+    parser.add_argument('sources', nargs='*', type=pathlib.Path,
+        help="Source files to analyze (default: the programs and "
+        "automation-utils.c)")
+    args = parser.parse_args()
+
+    assumptions = {}
+    for assumption in args.assumptions:
+        name, _, value = assumption.partition('=')
+        assumptions[name] = int(value, 0) if value else 1
+
+    sources = {}
+    arrays = {}
+    sequences = {}
+    for path in args.sources or [ROOT_DIR / path for path in DEFAULT_SOURCES]:
+        try:
+            sources[path], arrays[path] = parse_functions(path, assumptions)
+        except (OSError, SyntaxError, IndexError) as error:
+            sys.exit(f"Unable to parse {path}: {error}")
+
+        # Compiled button sequences (SEND_<NAME>() macros, see seqc.py)
+        if path.with_suffix('.seq').exists():
+            try:
+                for sequence in compile_file(path.with_suffix('.seq'),
+                        assumptions):
+                    sequences[f'SEND_{sequence.name.upper()}'] = \
+                        sequence.cycles()
+            except SeqError as error:
+                sys.exit(str(error))
+
+    results = []
+    for functions in sources.values():
+        for func in functions.values():
+            analyzer = Analyzer(sources, arrays, sequences, args.poll_ms,
+                assumptions)
+            results.append((func,
+                analyzer.function(func, [None] * len(func.params))))
+
+    results.sort(key=lambda result: result[1].ms, reverse=True)
+    longest = [func for func, duration in results
+        if func.name != 'main'][:LONGEST_COUNT]
+
+    print(f"Poll interval: {args.poll_ms} ms, default cycle: "
+        f"{DEFAULT_CYCLE_LENGTH * REPORT_INTERVAL_MS} ms")
+    print(f"{'Function':<40} {'Cycles':>8} {'CPU cycles':>14} {'Seconds':>9}")
+
+    for func, duration in results:
+        label = f"{func.name} ({func.path.name})"
+        marker = '  <- longest' if func in longest else ''
+        cpu_cycles = round(duration.ms * 16000)
+        print(f"{label:<40} {duration.cycles:>8} {cpu_cycles:>14} "
+            f"{duration.ms / 1000:>9.2f}{marker}")
+        for note in duration.notes:
+            print(f"    {note}")
+
+if __name__ == '__main__':
+    run()
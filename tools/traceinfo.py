@@ -0,0 +1,373 @@
+#!/usr/bin/env python3
+
+"""
+Reads the USB reports of a trace file (see src/host/trace.h) of a long run,
+and shows where the time goes: the part of the cycles that are neutral waits
+and active input, the longest idle stretches, the efficiency of the mashed
+buttons, and the features completed per hour.
+
+The idle stretches are attributed to the functions of the program, and the
+features are counted, from the function markers recorded along with the
+trace (-m option of the host programs): the entries and exits of the
+functions, whose addresses are mapped to their names with nm. The markers
+are in the time of the main µC, which runs ahead of the reports by at most
+the frame queue of the USB interface, so the attribution of a stretch goes
+to the function that spent the most time in it.
+"""
+
+import argparse
+import bisect
+import csv
+import pathlib
+import subprocess
+import sys
+
+from regress import read_trace
+
+
+# Neutral controller data of a report: no buttons, D-pad centered, sticks
+# centered
+NEUTRAL_BUTTONS = b'\x00\x00\x08'
+NEUTRAL_STICKS = b'\x80\x80\x80\x80'
+
+# Functions whose calls are counted as completed features, and their labels
+FEATURE_FUNCTIONS = {
+    'get_egg': "Eggs collected",
+    'hatch_egg': "Eggs hatched",
+    'reset_game': "Game resets",
+    'restart_game': "Game resets",
+    'change_raid': "Raid changes",
+    'release_from_box': "Pokémon released",
+}
+
+# Functions of the shim headers of the host build (src/host/include) are
+# inlined helpers like _delay_ms: their time goes to their caller
+HEADER_DIR = '/src/host/include/'
+
+
+def format_duration(time_us):
+    """
+    Returns a duration as H:MM:SS.mmm
+    """
+
+    ms = round(time_us / 1000)
+    return f"{ms // 3600000}:{ms // 60000 % 60:02}:{ms // 1000 % 60:02}.{ms % 1000:03}"
+
+
+def report_segments(header, records):
+    """
+    Returns the segments of the trace during which the report does not
+    change: (start, end, report), times in µs
+    """
+
+    duration_us = header[5]
+    return [(time_us, records[idx + 1][0] if idx + 1 < len(records)
+        else duration_us, report) for idx, (time_us, report) in enumerate(records)]
+
+
+def read_symbols(executable):
+    """
+    Returns the functions of an executable, by address: (name, defined in a
+    shim header)
+    """
+
+    proc = subprocess.run(['nm', '--defined-only', '--line-numbers',
+        str(executable)], stdout=subprocess.PIPE, text=True)
+    if proc.returncode != 0:
+        sys.exit(f"Unable to read the symbols of {executable}")
+
+    symbols = {}
+    for line in proc.stdout.splitlines():
+        fields = line.split('\t')[0].split()
+        if len(fields) != 3 or fields[1] not in 'tT':
+            continue
+
+        location = line.partition('\t')[2]
+        symbols[int(fields[0], 16)] = (fields[2], HEADER_DIR in location)
+
+    return symbols
+
+
+def read_markers(path, executable):
+    """
+    Returns the timeline of the innermost function of the program, as a list
+    of (start time in µs, function name or None), and the number of calls of
+    each function
+    """
+
+    symbols = read_symbols(executable)
+    main_address = next((address for address, (name, _) in symbols.items()
+        if name == 'program_main'), None)
+    if main_address is None:
+        sys.exit(f"{executable} is not a host program")
+
+    timeline = [(0, None)]
+    calls = {}
+    stack = []
+    offset = None
+
+    with path.open() as marker_file:
+        for line in marker_file:
+            fields = line.split()
+            if fields[:2] == ['#', 'program_main']:
+                offset = int(fields[2], 16) - main_address
+                continue
+
+            if offset is None or len(fields) != 3:
+                sys.exit(f"{path} is not a function marker file")
+
+            time_us = int(fields[0])
+            address = int(fields[2], 16) - offset
+            name, in_header = symbols.get(address, (hex(address), False))
+            if in_header:
+                continue
+
+            if fields[1] == 'E':
+                stack.append(name)
+                calls[name] = calls.get(name, 0) + 1
+            elif stack:
+                stack.pop()
+
+            function = stack[-1] if stack else None
+            if timeline[-1][0] == time_us:
+                timeline[-1] = (time_us, function)
+            elif timeline[-1][1] != function:
+                timeline.append((time_us, function))
+
+    return timeline, calls
+
+
+def main_function(timeline, start_us, end_us):
+    """
+    Returns the function of the timeline that spent the most time between
+    the specified times
+    """
+
+    starts = [time_us for time_us, _ in timeline]
+    idx = max(bisect.bisect_right(starts, start_us) - 1, 0)
+
+    spent = {}
+    while idx < len(timeline) and timeline[idx][0] < end_us:
+        seg_end = timeline[idx + 1][0] if idx + 1 < len(timeline) else end_us
+        overlap = min(seg_end, end_us) - max(timeline[idx][0], start_us)
+        function = timeline[idx][1] or '-'
+        spent[function] = spent.get(function, 0) + max(overlap, 0)
+        idx += 1
+
+    return max(spent, key=spent.get) if spent else '-'
+
+
+def idle_stretches(segments, min_us):
+    """
+    Returns the idle stretches of the trace: neutral reports (whatever the
+    number of report changes in between) for longer than the specified time,
+    so the releases of the mashed and held buttons are not counted, as
+    (start, end), times in µs
+    """
+
+    stretches = []
+    for start_us, end_us, report in segments:
+        if report[0:3] != NEUTRAL_BUTTONS or report[3:7] != NEUTRAL_STICKS:
+            continue
+
+        if stretches and stretches[-1][1] == start_us:
+            stretches[-1] = (stretches[-1][0], end_us)
+        else:
+            stretches.append((start_us, end_us))
+
+    return [(start_us, end_us) for start_us, end_us in stretches
+        if end_us - start_us > min_us]
+
+
+def mash_runs(segments, cycle_us, poll_us):
+    """
+    Returns the mash runs of the trace: the same buttons pressed and released
+    on successive cycles, at least twice, as (start, end, presses), times in
+    µs. The release that ends a run counts for one cycle.
+    """
+
+    max_us = cycle_us + poll_us
+    runs = []
+    run = None
+
+    for start_us, end_us, report in segments:
+        buttons = report[0:3]
+        short = end_us - start_us <= max_us
+
+        if run is not None:
+            if run['pressed'] and buttons == NEUTRAL_BUTTONS:
+                run['end'] = min(end_us, start_us + cycle_us)
+                run['pressed'] = False
+                if short:
+                    continue
+            elif not run['pressed'] and buttons == run['buttons'] and short:
+                run['end'] = end_us
+                run['presses'] += 1
+                run['pressed'] = True
+                continue
+
+            if run['presses'] >= 2:
+                runs.append((run['start'], run['end'], run['presses']))
+            run = None
+
+        if buttons != NEUTRAL_BUTTONS and short:
+            run = {'start': start_us, 'end': end_us, 'buttons': buttons,
+                'presses': 1, 'pressed': True}
+
+    if run is not None and run['presses'] >= 2:
+        runs.append((run['start'], run['end'], run['presses']))
+
+    return runs
+
+
+def run():
+    """
+    Program entry point
+    """
+
+    parser = argparse.ArgumentParser(description=__doc__,
+        formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument('trace', type=pathlib.Path, help="Trace file")
+    parser.add_argument('-m', dest='markers', type=pathlib.Path,
+        help="Function marker file recorded with the trace")
+    parser.add_argument('-e', dest='executable', type=pathlib.Path,
+        help="Host program that recorded the markers (e.g. ./swsh-host)")
+    parser.add_argument('-c', dest='cycle_ms', type=float, default=40,
+        help="Cycle length, in ms (default: 40)")
+    parser.add_argument('-n', dest='count', type=int, default=10,
+        help="Number of idle stretches shown (default: 10)")
+    parser.add_argument('--feature', action='append', default=[],
+        metavar='FUNCTION=LABEL',
+        help="Also count the calls of this function as completed features")
+    parser.add_argument('--csv', type=pathlib.Path,
+        help="Write the statistics of each function to this CSV file")
+    args = parser.parse_args()
+
+    if (args.markers is None) != (args.executable is None):
+        parser.error("the marker file (-m) and the program (-e) go together")
+
+    features = dict(FEATURE_FUNCTIONS)
+    for spec in args.feature:
+        function, _, label = spec.partition('=')
+        features[function] = label or function
+
+    header, records = read_trace(args.trace)
+    poll_us = header[3]
+    duration_us = header[5]
+    cycle_us = args.cycle_ms * 1000
+    hours = duration_us / 3.6e9
+    segments = report_segments(header, records)
+
+    if args.markers is not None:
+        timeline, calls = read_markers(args.markers, args.executable)
+    else:
+        timeline, calls = [(0, None)], {}
+
+    # Input density
+    neutral_us = 0
+    sticks_us = 0
+    for start_us, end_us, report in segments:
+        if report[0:3] == NEUTRAL_BUTTONS:
+            if report[3:7] == NEUTRAL_STICKS:
+                neutral_us += end_us - start_us
+            else:
+                sticks_us += end_us - start_us
+    buttons_us = duration_us - neutral_us - sticks_us
+
+    print(f"Trace {args.trace}: {format_duration(duration_us)}, "
+        f"{len(records)} report changes, {args.cycle_ms:g} ms cycles")
+    print()
+    print("Input density:")
+    for label, time_us in (("Neutral waits", neutral_us),
+            ("Active input, buttons", buttons_us),
+            ("Active input, sticks only", sticks_us)):
+        share = 100 * time_us / duration_us if duration_us else 0.0
+        print(f"  {label:<27} {time_us / cycle_us:12.0f} cycles  {share:6.2f} %")
+
+    # Mash efficiency: the part of the USB polls that get a press or a
+    # release, during the mash runs
+    runs = mash_runs(segments, cycle_us, poll_us)
+    mash_us = sum(end_us - start_us for start_us, end_us, _ in runs)
+    presses = sum(count for _, _, count in runs)
+    print()
+    print("Mash efficiency:")
+    if runs:
+        print(f"  {len(runs)} runs, {presses} presses in "
+            f"{format_duration(mash_us)} ({presses * 1e6 / mash_us:.2f} presses/s)")
+        print(f"  {100 * 2 * presses * poll_us / mash_us:.1f} % of the "
+            f"{poll_us / 1000:g} ms USB polls get a press or a release")
+    else:
+        print("  No mashed buttons")
+
+    # Features completed per hour
+    print()
+    print("Features completed:")
+    totals = {}
+    for function, label in features.items():
+        if calls.get(function):
+            totals[label] = totals.get(label, 0) + calls[function]
+    if args.markers is None:
+        print("  Unknown (no function markers)")
+    elif not totals:
+        print("  None")
+    for label, count in totals.items():
+        print(f"  {label:<27} {count:8} {count / hours if hours else 0.0:10.1f} per hour")
+
+    # Idle stretches, by function
+    stretches = [(start_us, end_us, main_function(timeline, start_us, end_us))
+        for start_us, end_us in idle_stretches(segments, cycle_us + poll_us)]
+    longest = sorted(stretches, key=lambda stretch: stretch[0] - stretch[1])
+
+    print()
+    print("Longest idle stretches:")
+    print(f"  {'duration':>14}  {'start':>14}  function")
+    for start_us, end_us, function in longest[:args.count]:
+        print(f"  {format_duration(end_us - start_us):>14}  "
+            f"{format_duration(start_us):>14}  {function}")
+
+    stats = {}
+    for start_us, end_us, function in stretches:
+        stat = stats.setdefault(function, {'idle_us': 0, 'stretches': 0,
+            'longest_us': 0, 'longest_start_us': 0})
+        stat['idle_us'] += end_us - start_us
+        stat['stretches'] += 1
+        if end_us - start_us > stat['longest_us']:
+            stat['longest_us'] = end_us - start_us
+            stat['longest_start_us'] = start_us
+
+    rows = []
+    for function in sorted(set(stats) | set(calls),
+            key=lambda name: -stats.get(name, {'idle_us': 0})['idle_us']):
+        stat = stats.get(function, {'idle_us': 0, 'stretches': 0,
+            'longest_us': 0, 'longest_start_us': 0})
+        rows.append({
+            'function': function,
+            'calls': calls.get(function, 0),
+            'calls_per_hour': calls.get(function, 0) / hours if hours else 0.0,
+            'idle_s': stat['idle_us'] / 1e6,
+            'idle_percent': 100 * stat['idle_us'] / duration_us if duration_us else 0.0,
+            'idle_stretches': stat['stretches'],
+            'longest_idle_s': stat['longest_us'] / 1e6,
+            'longest_idle_start_s': stat['longest_start_us'] / 1e6,
+        })
+
+    print()
+    print("Idle time by function:")
+    print(f"  {'function':<32} {'calls':>8} {'idle':>14} {'idle %':>7} "
+        f"{'stretches':>9} {'longest':>14}")
+    for row in rows:
+        if row['idle_stretches'] == 0:
+            continue
+        print(f"  {row['function']:<32} {row['calls']:>8} "
+            f"{format_duration(row['idle_s'] * 1e6):>14} {row['idle_percent']:7.2f} "
+            f"{row['idle_stretches']:>9} {format_duration(row['longest_idle_s'] * 1e6):>14}")
+
+    if args.csv:
+        with args.csv.open('w', newline='') as csv_file:
+            writer = csv.DictWriter(csv_file, fieldnames=list(rows[0]) if rows
+                else ['function'])
+            writer.writeheader()
+            writer.writerows(rows)
+
+if __name__ == '__main__':
+    run()